@@ -0,0 +1,347 @@
+/* *****************************************************************
+ *                      textbench.c
+ * Microbenchmarks for the text side of palutils: color_strtocolor(),
+ * colorscan_next() (getcolorvals), colorscan_match() (getcolorvals
+ * --rewrite) and colorio_readcolor_mem() (makepal).
+ * Every corpus is generated in memory from a fixed seed, so runs are
+ * comparable across machines and commits.
+ * Results can be saved as a baseline and later runs compared against
+ * it; a benchmark slower than the baseline by more than the tolerance
+ * is reported as a regression and makes the exit code non-zero.
+ *
+ * *****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+#include "../color.h"
+#include "../colorio.h"
+#include "../colorscan.h"
+
+#define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
+#define BASELINE "bench/textbench.baseline"
+#define MAXBENCH 16
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t candidates;  /* color candidates put in the corpus */
+} Corpus;
+
+typedef struct {
+    const char *name;
+    double ns_per_color;
+    double gb_per_s;
+    size_t colors;
+} Result;
+
+static uint64_t rngstate = 0x9E3779B97F4A7C15ull;
+
+static uint32_t rng(void)
+{
+    rngstate ^= rngstate << 13;
+    rngstate ^= rngstate >> 7;
+    rngstate ^= rngstate << 17;
+    return (uint32_t) (rngstate >> 16);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int corpus_put(Corpus *c, size_t cap, const char *s)
+{
+    size_t n = strlen(s);
+
+    if (c->len + n >= cap)
+        return 1;
+    memcpy(c->buf + c->len, s, n);
+    c->len += n;
+    return 0;
+}
+
+/* Generates about size bytes of text. kind is one of:
+ * "list"      - 8 digit lists, as written by getpal
+ * "listcrlf"  - the same with CRLF line endings
+ * "dense"     - one #RRGGBB per line
+ * "crlf"      - the same with CRLF line endings
+ * "sparse"    - prose with a #RRGGBB every few hundred bytes
+ * "malformed" - '#' followed by too few, too many or bad digits
+ * "notations" - every notation colorscan knows, one per line */
+static int corpus_make(Corpus *c, const char *kind, size_t size)
+{
+    static const char *words[] = {
+        "the", "palette", "of", "this", "theme", "is", "mostly", "blue",
+        "and", "gray", "with", "a", "few", "accents", "here", "there",
+    };
+    static const char *bad[] = {
+        "#12345", "#1234567", "#12G456", "#", "#XYZ", "#123456789A",
+    };
+    uint32_t v;
+    char tmp[32];
+
+    c->buf = malloc(size + 1);
+    if (!c->buf)
+        return 1;
+    c->len = 0;
+    c->candidates = 0;
+    for (;;) {
+        int candidate = 1;
+
+        if (strcmp(kind, "list") == 0 || strcmp(kind, "listcrlf") == 0)
+            snprintf(tmp, sizeof(tmp), "%08X%s", rng(), kind[4] ? "\r\n" : "\n");
+        else if (strcmp(kind, "dense") == 0 || strcmp(kind, "crlf") == 0)
+            snprintf(tmp, sizeof(tmp), "#%06x%s", rng() & 0xFFFFFF, kind[0] == 'c' ? "\r\n" : "\n");
+        else if (strcmp(kind, "sparse") == 0) {
+            if (rng() % 64 == 0)
+                snprintf(tmp, sizeof(tmp), "#%06X ", rng() & 0xFFFFFF);
+            else {
+                snprintf(tmp, sizeof(tmp), "%s%s", words[rng() % 16], rng() % 12 ? " " : ".\n");
+                candidate = 0;
+            }
+        } else if (strcmp(kind, "malformed") == 0)
+            snprintf(tmp, sizeof(tmp), "%s\n", bad[rng() % 6]);
+        else if (strcmp(kind, "notations") == 0) {
+            v = rng();
+            switch (rng() % 5) {
+            case 0: snprintf(tmp, sizeof(tmp), "#%03x\n", v & 0xFFF); break;
+            case 1: snprintf(tmp, sizeof(tmp), "#%08X\n", v); break;
+            case 2: snprintf(tmp, sizeof(tmp), "0x%06X\n", v & 0xFFFFFF); break;
+            case 3: snprintf(tmp, sizeof(tmp), "rgb(%u, %u, %u)\n", v & 0xFF, v >> 8 & 0xFF, v >> 16 & 0xFF); break;
+            case 4: snprintf(tmp, sizeof(tmp), "rgba(%u %u %u / %u%%)\n", v & 0xFF, v >> 8 & 0xFF, v >> 16 & 0xFF, v >> 24 & 0x3F); break;
+            }
+        }
+        else {
+            free(c->buf);
+            return 1;
+        }
+        if (corpus_put(c, size, tmp) != 0)
+            break;
+        c->candidates += candidate;
+    }
+    c->buf[c->len] = '\0';
+    return 0;
+}
+
+/* every benchmark returns the number of colors it found */
+static size_t bench_strtocolor(Corpus *c)
+{
+    size_t n = 0;
+    char *s, *end, save;
+    Color col;
+
+    for (s = c->buf; *s; s = end + 1) {
+        end = strchr(s, '\n');
+        if (!end)
+            break;
+        save = *end;
+        *end = '\0';
+        n += color_strtocolor(s, &col) == 0;
+        *end = save;
+    }
+    return n;
+}
+
+static size_t bench_scan(Corpus *c)
+{
+    size_t n = 0;
+    Color col;
+    const char *p = c->buf, *end = c->buf + c->len;
+
+    while (colorscan_next(&p, end, &col) != EOF)
+        n++;
+    return n;
+}
+
+static size_t bench_match(Corpus *c)
+{
+    size_t n = 0;
+    Color col;
+    ColorMatch m;
+    const char *p = c->buf, *end = c->buf + c->len;
+
+    while (colorscan_match(&p, end, &col, &m) != EOF)
+        n++;
+    return n;
+}
+
+static size_t bench_readcolor(Corpus *c)
+{
+    size_t n = 0, line = 0;
+    Color col;
+    const char *p = c->buf, *end = c->buf + c->len;
+
+    while (colorio_readcolor_mem(&p, end, &col, &line) == 0)
+        n++;
+    return n;
+}
+
+static const struct {
+    const char *name;
+    const char *corpus;
+    size_t (*fn)(Corpus *);
+} benches[] = {
+    { "strtocolor/list",      "list",      bench_strtocolor },
+    { "strtocolor/malformed", "malformed", bench_strtocolor },
+    { "scan/dense",           "dense",     bench_scan       },
+    { "scan/sparse",          "sparse",    bench_scan       },
+    { "scan/malformed",       "malformed", bench_scan       },
+    { "scan/crlf",            "crlf",      bench_scan       },
+    { "scan/notations",       "notations", bench_scan       },
+    { "match/dense",          "dense",     bench_match      },
+    { "match/sparse",         "sparse",    bench_match      },
+    { "match/notations",      "notations", bench_match      },
+    { "readcolor/list",       "list",      bench_readcolor  },
+    { "readcolor/crlf",       "listcrlf",  bench_readcolor  },
+};
+
+#define NBENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/* Runs a benchmark reps times and keeps the fastest run. */
+static int run(size_t i, size_t size, int reps, Result *res)
+{
+    Corpus c;
+    uint64_t t, best = UINT64_MAX;
+    int r;
+
+    rngstate = 0x9E3779B97F4A7C15ull;
+    if (corpus_make(&c, benches[i].corpus, size) != 0)
+        return 1;
+    for (r = 0; r < reps; r++) {
+        t = now_ns();
+        res->colors = benches[i].fn(&c);
+        t = now_ns() - t;
+        if (t < best)
+            best = t;
+    }
+    res->name = benches[i].name;
+    /* per candidate rather than per color found, so that malformed
+     * corpora, where (almost) nothing is found, are measured too */
+    res->ns_per_color = (double) best / (c.candidates ? c.candidates : 1);
+    res->gb_per_s = (double) c.len / best;
+    free(c.buf);
+    return 0;
+}
+
+static void free_baseline(Result *base, size_t nbase)
+{
+    for (size_t i = 0; i < nbase; i++)
+        free((char *) base[i].name);
+}
+
+/* Returns 1 if the baseline can't be read, which leaves it empty. */
+static int load_baseline(const char *fname, Result *base, size_t *nbase)
+{
+    FILE *f = fopen(fname, "r");
+    char name[64];
+    double ns;
+
+    *nbase = 0;
+    if (!f)
+        return 1;
+    while (*nbase < MAXBENCH && fscanf(f, "%63s %lf", name, &ns) == 2) {
+        if (name[0] == '#')
+            continue;
+        base[*nbase].name = strdup(name);
+        if (!base[*nbase].name) {
+            free_baseline(base, *nbase);
+            *nbase = 0;
+            fclose(f);
+            return 1;
+        }
+        base[*nbase].ns_per_color = ns;
+        (*nbase)++;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int save_baseline(const char *fname, Result *res, size_t n)
+{
+    FILE *f = fopen(fname, "w");
+
+    if (!f)
+        return 1;
+    for (size_t i = 0; i < n; i++)
+        fprintf(f, "%s %.3f\n", res[i].name, res[i].ns_per_color);
+    fclose(f);
+    return 0;
+}
+
+static void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-s] [-b BASELINE] [-t TOLERANCE%%] [-m MiB] [-r REPS] [NAME...]\n",
+            progname);
+}
+
+int main(int argc, char **argv)
+{
+    Result res[MAXBENCH], base[MAXBENCH];
+    size_t nres = 0, nbase = 0, size = 8, i, j;
+    int opt, save = 0, reps = 5, regressions = 0, k;
+    double tolerance = 10.0, delta;
+    const char *baseline = BASELINE;
+
+    while (opt = getopt(argc, argv, "sb:t:m:r:"), opt != -1) {
+        switch (opt) {
+        case 's': save = 1; break;
+        case 'b': baseline = optarg; break;
+        case 't': tolerance = atof(optarg); break;
+        case 'm': size = strtoul(optarg, NULL, 10); break;
+        case 'r': reps = atoi(optarg); break;
+        default:
+            usage(*argv);
+            return 1;
+        }
+    }
+    if (size == 0 || reps < 1) {
+        usage(*argv);
+        return 1;
+    }
+
+    if (!save)
+        load_baseline(baseline, base, &nbase);
+
+    printf("%-22s %10s %12s %8s %9s\n", "benchmark", "colors", "ns/color", "GB/s", "vs base");
+    for (i = 0; i < NBENCHES; i++) {
+        if (optind < argc) {    /* only run the benchmarks named on the command line */
+            for (k = optind; k < argc && strcmp(argv[k], benches[i].name) != 0; k++)
+                ;
+            if (k == argc)
+                continue;
+        }
+        if (run(i, size << 20, reps, &res[nres]) != 0) {
+            error("out of memory\n");
+            free_baseline(base, nbase);
+            return 1;
+        }
+        printf("%-22s %10zu %12.2f %8.3f", res[nres].name, res[nres].colors,
+                res[nres].ns_per_color, res[nres].gb_per_s);
+        for (j = 0; j < nbase && strcmp(base[j].name, res[nres].name) != 0; j++)
+            ;
+        if (j < nbase) {
+            delta = (res[nres].ns_per_color / base[j].ns_per_color - 1.0) * 100.0;
+            printf(" %+8.1f%%%s", delta, delta > tolerance ? "  REGRESSION" : "");
+            regressions += delta > tolerance;
+        }
+        putchar('\n');
+        nres++;
+    }
+    free_baseline(base, nbase);
+
+    if (save) {
+        if (save_baseline(baseline, res, nres) != 0) {
+            error("can't write %s\n", baseline);
+            return 1;
+        }
+        fprintf(stderr, "saved baseline to %s\n", baseline);
+    }
+    return regressions != 0;
+}
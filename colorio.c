@@ -0,0 +1,45 @@
+/* *******************************************************************
+ *                          colorio.c
+ * Reading colors out of color lists.
+ *
+ * *******************************************************************/
+
+#include "colorio.h"
+
+#include <string.h>
+#include "stats.h"
+
+/* Gets the next color from the list in memory that ends at end, starting
+ * at *p, and moves *p past the line the color is on. A list looks like
+ * this:
+ * 0CFA2E25
+ * 09BC6751
+ * ...
+ * Blank lines are skipped, and lines may end in CRLF. *line is
+ * incremented for every line read, blank ones too, so that it's the
+ * number of the line of the color, or of the one that isn't a color.
+ * Returns 1 for a line that isn't a color, 2 at the end of the list. */
+int colorio_readcolor_mem(const char **p, const char *end, Color *cptr, size_t *line)
+{
+    const char *nl, *s;
+    char buf[16];
+    size_t llen;
+
+    do {
+        if (*p >= end)
+            return 2;
+        STATS_ENTER(STATS_PARSE);
+        s = *p;
+        nl = memchr(s, '\n', end - s);
+        llen = (nl ? nl : end) - s;
+        if (llen > 0 && s[llen-1] == '\r')
+            llen--;
+        *p = nl ? nl + 1 : end;
+        (*line)++;
+    } while (llen == 0);
+    if (llen >= sizeof(buf))        /* too long to be a color anyway */
+        return 1;
+    memcpy(buf, s, llen);
+    buf[llen] = '\0';
+    return color_strtocolor(buf, cptr) != 0;
+}
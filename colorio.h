@@ -0,0 +1,17 @@
+/* *******************************************************************
+ *                          colorio.h
+ * Reading colors out of color lists (one color per line, as read by
+ * makepal), already in memory. Colors in free-form text are found by
+ * colorscan.
+ *
+ * *******************************************************************/
+
+#ifndef COLORIO_H_INCLUDED
+#define COLORIO_H_INCLUDED
+
+#include <stddef.h>
+#include "color.h"
+
+int     colorio_readcolor_mem(const char **p, const char *end, Color *c, size_t *line);
+
+#endif
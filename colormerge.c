@@ -0,0 +1,162 @@
+/* *******************************************************************
+ *                          colormerge.c
+ * Merging of near colors, with a grid index of the colors kept.
+ *
+ * *******************************************************************/
+
+#include "colormerge.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "colorspace.h"
+
+#define EMPTY UINT32_MAX
+
+/* A cell of the grid. Cells are kept in a hash table, by their
+ * coordinates and alpha; head is the first kept color in the cell, the
+ * others are chained through next. */
+typedef struct {
+    uint64_t key;
+    uint32_t head;
+} Cell;
+
+typedef struct {
+    Cell *cells;
+    size_t mask;
+    uint32_t *next;
+} Grid;
+
+static const char *space_names[] = { "oklab", "lab" };
+
+/* Returns the COLORMERGE_* space named by s, or -1. */
+int colormerge_parse_space(const char *s)
+{
+    for (size_t i = 0; i < sizeof(space_names) / sizeof(space_names[0]); i++)
+        if (strcmp(s, space_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+/* The key of the cell at x, y, z for alpha. Coordinates are wrapped to 16
+ * bits: cells that end up with the same key just share a chain, and
+ * every candidate is checked for distance anyway. */
+static uint64_t cell_key(int32_t x, int32_t y, int32_t z, uint8_t alpha)
+{
+    return (uint64_t) (uint16_t) x << 40 | (uint64_t) (uint16_t) y << 24
+         | (uint64_t) (uint16_t) z << 8 | alpha;
+}
+
+static Cell *grid_cell(const Grid *grid, uint64_t key)
+{
+    size_t i;
+
+    for (i = (key * 0x9E3779B97F4A7C15ull) >> 32 & grid->mask;
+         grid->cells[i].head != EMPTY && grid->cells[i].key != key;
+         i = (i + 1) & grid->mask)
+        ;
+    return &grid->cells[i];
+}
+
+/* Merges colors[0..*n) as described in colormerge.h. On entry, counts[i]
+ * is how many colors colors[i] stands for: 1, unless it comes out of an
+ * earlier merge. On return, *n is the number of colors kept, which are
+ * moved to the front of colors, and counts[i] is the sum of the counts
+ * merged into colors[i], its own included. de must be more than 0, and
+ * is at least COLORMERGE_MIN_DE.
+ * Returns COLORMERGE_ERR_BADPARAM, COLORMERGE_ERR_NOMEM. */
+int colormerge_merge(Color *colors, uint32_t *counts, size_t *n, double de, int space)
+{
+    float *l, *a, *b, t, pl, pa, pb;
+    Grid grid;
+    Cell *cell;
+    int32_t cx, cy, cz;
+    uint32_t j, best;
+    size_t i, kept = 0, cap;
+    float d, bestd, dl, da, db;
+    int x, y, z;
+
+    if ((space != COLORMERGE_OKLAB && space != COLORMERGE_LAB) || !(de > 0)
+     || *n >= EMPTY)
+        return COLORMERGE_ERR_BADPARAM;
+    t = de < COLORMERGE_MIN_DE ? COLORMERGE_MIN_DE : de;
+    if (*n == 0)
+        return 0;
+
+    for (cap = 1024; cap < *n * 2; cap *= 2)
+        ;
+    l = malloc(*n * 3 * sizeof(float));
+    grid.cells = malloc(cap * sizeof(Cell));
+    grid.next = malloc(*n * sizeof(uint32_t));
+    if (!l || !grid.cells || !grid.next) {
+        free(l);
+        free(grid.cells);
+        free(grid.next);
+        return COLORMERGE_ERR_NOMEM;
+    }
+    grid.mask = cap - 1;
+    for (i = 0; i < cap; i++)
+        grid.cells[i].head = EMPTY;
+    a = l + *n;
+    b = a + *n;
+    if (space == COLORMERGE_OKLAB) {
+        colorspace_to_oklab(colors, *n, l, a, b);
+        /* OKLab is scaled so that distances are like CIELAB's */
+        t /= 100.0f;
+    } else
+        colorspace_to_lab(colors, *n, l, a, b);
+
+    for (i = 0; i < *n; i++) {
+        pl = l[i];
+        pa = a[i];
+        pb = b[i];
+        cx = (int32_t) floorf(pl / t);
+        cy = (int32_t) floorf(pa / t);
+        cz = (int32_t) floorf(pb / t);
+
+        /* the nearest kept color within t */
+        best = EMPTY;
+        bestd = t * t;
+        for (x = -1; x <= 1; x++)
+            for (y = -1; y <= 1; y++)
+                for (z = -1; z <= 1; z++) {
+                    cell = grid_cell(&grid, cell_key(cx + x, cy + y, cz + z, colors[i].alpha));
+                    for (j = cell->head; j != EMPTY; j = grid.next[j]) {
+                        if (colors[j].alpha != colors[i].alpha)
+                            continue;
+                        dl = l[j] - pl;
+                        da = a[j] - pa;
+                        db = b[j] - pb;
+                        d = dl * dl + da * da + db * db;
+                        if (d <= bestd) {
+                            bestd = d;
+                            best = j;
+                        }
+                    }
+                }
+        if (best != EMPTY) {
+            counts[best] += counts[i];
+            continue;
+        }
+
+        /* kept colors only move backwards, so the ones not looked at yet
+         * are never overwritten */
+        colors[kept] = colors[i];
+        counts[kept] = counts[i];
+        l[kept] = pl;
+        a[kept] = pa;
+        b[kept] = pb;
+        cell = grid_cell(&grid, cell_key(cx, cy, cz, colors[i].alpha));
+        if (cell->head == EMPTY)
+            cell->key = cell_key(cx, cy, cz, colors[i].alpha);
+        grid.next[kept] = cell->head;
+        cell->head = kept;
+        kept++;
+    }
+
+    *n = kept;
+    free(l);
+    free(grid.cells);
+    free(grid.next);
+    return 0;
+}
@@ -0,0 +1,43 @@
+/* *******************************************************************
+ *                          colormerge.h
+ * Merging of near-identical colors. Colors are compared in a perceptual
+ * space, OKLab or CIELAB, and a color within a given distance (delta E)
+ * of one already kept is merged into it. OKLab distances are scaled by
+ * 100, so that in both spaces a delta E of about 2 is the smallest
+ * difference one can see.
+ * Colors are taken in order and each one either joins the nearest kept
+ * color within delta E or is kept itself, so the first color of each
+ * cluster is its representative, and a sorted array stays sorted. Kept
+ * colors are indexed by a uniform 3D grid with cells delta E wide: a
+ * color only has to be compared with those in the 27 cells around it.
+ * Alpha is not part of the distance: colors with different alpha are
+ * never merged.
+ *
+ * *******************************************************************/
+
+#ifndef COLORMERGE_H_INCLUDED
+#define COLORMERGE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+enum {
+    COLORMERGE_OKLAB,
+    COLORMERGE_LAB,
+};
+
+/* smaller delta Es are taken as this one: the grid's cell coordinates
+ * must fit in 32 bits, and distinct 8-bit colors are much further apart
+ * anyway */
+#define COLORMERGE_MIN_DE 0.001
+
+enum {
+    COLORMERGE_ERR_BADPARAM = 1,
+    COLORMERGE_ERR_NOMEM,
+};
+
+int     colormerge_parse_space(const char *s);
+int     colormerge_merge(Color *colors, uint32_t *counts, size_t *n, double de, int space);
+
+#endif
@@ -0,0 +1,140 @@
+/* *******************************************************************
+ *                          colorscan.c
+ * The color scanner: runs the DFA in scantab.h (see scangen.c) and turns
+ * what it matches into colors.
+ *
+ * *******************************************************************/
+
+#include "colorscan.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include "stats.h"
+#include "scantab.h"
+
+static unsigned hexval(unsigned char c)
+{
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+/* Reads the hex digits between s and end, which the scanner says are 3,
+ * 4, 6 or 8. */
+static uint32_t hexcolor(const char *s, const char *end)
+{
+    uint32_t v = 0;
+    ptrdiff_t n = end - s;
+
+    for ( ; s < end; s++) {
+        v = v << 4 | hexval(*s);
+        if (n <= 4)     /* #RGB is #RRGGBB */
+            v = v << 4 | hexval(*s);
+    }
+    return v;
+}
+
+/* Reads the next number of an rgb() starting at or after *s, scaled to
+ * 0-255: a channel is 0-255 or a percentage, alpha is 0-1 or a
+ * percentage. */
+static uint32_t rgbnumber(const char **s, int alpha)
+{
+    const char *p = *s;
+    double v = 0, scale = 1;
+
+    while (*p != '.' && (*p < '0' || *p > '9'))
+        p++;
+    for ( ; *p >= '0' && *p <= '9'; p++)
+        v = v * 10 + (*p - '0');
+    if (*p == '.')
+        for (p++; *p >= '0' && *p <= '9'; p++)
+            v += (*p - '0') * (scale /= 10);
+    if (*p == '%') {
+        v = v * 255 / 100;
+        p++;
+    } else if (alpha)
+        v *= 255;
+    *s = p;
+    return v >= 255 ? 255 : (uint32_t) (v + 0.5);
+}
+
+/* Reads an rgb() or rgba() between s and end. Sets *alpha if it has an
+ * alpha channel. */
+static uint32_t rgbcolor(const char *s, const char *end, int *alpha)
+{
+    uint32_t v = 0;
+    int i;
+
+    while (*s != '(')
+        s++;
+    for (i = 0; i < 3; i++)
+        v = v << 8 | rgbnumber(&s, 0);
+    /* skip to the next number, if any */
+    while (s < end && *s != '.' && (*s < '0' || *s > '9'))
+        s++;
+    *alpha = s < end;
+    if (*alpha)
+        v = v << 8 | rgbnumber(&s, 1);
+    return v;
+}
+
+/* Finds the next color in the text between *p and end, and moves *p
+ * past it. Returns EOF when there are no more. */
+int colorscan_next(const char **p, const char *end, Color *c)
+{
+    ColorMatch m;
+
+    return colorscan_match(p, end, c, &m);
+}
+
+/* Like colorscan_next, and fills m. */
+int colorscan_match(const char **p, const char *end, Color *c, ColorMatch *m)
+{
+    const unsigned char *s = (const unsigned char *) *p, *q, *last;
+    const unsigned char *e = (const unsigned char *) end;
+    unsigned state, rule;
+
+    STATS_ENTER(STATS_PARSE);
+    while (s < e) {
+        /* longest match from s. every byte matches something, so last
+         * always moves forward */
+        state = SCAN_START;
+        last = s + 1;
+        rule = SCAN_OTHER;
+        for (q = s; q < e; ) {
+            state = scan_next[state][scan_class[*q++]];
+            if (state == SCAN_DEAD)
+                break;
+            if (scan_rule[state]) {
+                last = q;
+                rule = scan_rule[state];
+            }
+        }
+        switch (rule) {
+        case SCAN_HASH:
+            m->notation = COLORSCAN_HASH;
+            m->digits = last - s - 1;
+            m->alpha = m->digits == 4 || m->digits == 8;
+            c->value = hexcolor((const char *) s + 1, (const char *) last);
+            break;
+        case SCAN_HEX0X:
+            m->notation = COLORSCAN_HEX0X;
+            m->digits = last - s - 2;
+            m->alpha = 0;
+            c->value = hexcolor((const char *) s + 2, (const char *) last);
+            break;
+        case SCAN_RGB:
+            m->notation = COLORSCAN_RGB;
+            m->digits = 0;
+            c->value = rgbcolor((const char *) s, (const char *) last, &m->alpha);
+            break;
+        default:
+            s = last;
+            continue;
+        }
+        m->start = (const char *) s;
+        m->end = (const char *) last;
+        *p = (const char *) last;
+        return 0;
+    }
+    *p = (const char *) s;
+    return EOF;
+}
@@ -0,0 +1,41 @@
+/* *******************************************************************
+ *                          colorscan.h
+ * Finds colors in free-form text (CSS, config files, vim color
+ * schemes, source code) in a single pass. The notations recognized are
+ *   #RGB  #RGBA  #RRGGBB  #RRGGBBAA
+ *   0xRRGGBB
+ *   rgb(r, g, b)  rgba(r, g, b, a)  rgb(r g b / a)
+ * vim's guifg=#RRGGBB and friends are found by the first one. rgb()
+ * channels are 0-255 or percentages, alpha is 0-1 or a percentage.
+ * A color must be a whole word, on both sides: "#define", "#1234567"
+ * and "abc#fed" aren't colors.
+ * Every color comes out the way color_strtocolor reads the equivalent
+ * "RRGGBB" or "RRGGBBAA". colorscan_match also tells where the color
+ * is and how it's written, for callers that replace it.
+ * The scanner is a DFA whose tables are generated at build time by
+ * scangen from the list of notations in scangen.c.
+ *
+ * *******************************************************************/
+
+#ifndef COLORSCAN_H_INCLUDED
+#define COLORSCAN_H_INCLUDED
+
+#include "color.h"
+
+enum {
+    COLORSCAN_HASH = 1,     /* #RGB, #RGBA, #RRGGBB, #RRGGBBAA */
+    COLORSCAN_HEX0X,        /* 0xRRGGBB */
+    COLORSCAN_RGB,          /* rgb(), rgba() */
+};
+
+typedef struct _colormatch {
+    const char *start, *end;
+    int notation;           /* COLORSCAN_* */
+    int digits;             /* hex digits, for COLORSCAN_HASH and COLORSCAN_HEX0X */
+    int alpha;              /* the color has an alpha channel */
+} ColorMatch;
+
+int     colorscan_next(const char **p, const char *end, Color *c);
+int     colorscan_match(const char **p, const char *end, Color *c, ColorMatch *m);
+
+#endif
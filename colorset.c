@@ -0,0 +1,112 @@
+/* *******************************************************************
+ *                          colorset.c
+ * A generation-stamped hash set of colors.
+ *
+ * *******************************************************************/
+
+#include "colorset.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+#define INIT_CAP 1024
+
+/* fibonacci hashing: the top bits of the product are well mixed */
+static inline size_t hash(uint32_t value, size_t mask)
+{
+    return (size_t) ((value * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+static int grow(ColorSet *set)
+{
+    size_t newcap = set->cap ? set->cap * 2 : INIT_CAP, i, j;
+    ColorSlot *slots = calloc(newcap, sizeof(ColorSlot));
+
+    if (!slots)
+        return COLORSET_ERR_NOMEM;
+    /* generation 0 is never used, so calloc'ed slots are all free */
+    for (i = 0; i < set->cap; i++) {
+        if (set->slots[i].gen != set->gen)
+            continue;
+        for (j = hash(set->slots[i].value, newcap - 1); slots[j].gen != 0; j = (j + 1) & (newcap - 1))
+            ;
+        slots[j].value = set->slots[i].value;
+        slots[j].gen = 1;
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->cap = newcap;
+    set->gen = 1;
+    return 0;
+}
+
+/* Returns 1 if c was added, 0 if it was already there, COLORSET_ERR_NOMEM.
+ * For --stats, every slot looked at counts as a probe, and a lookup that
+ * needed more than one probe counts as a collision. */
+int colorset_add(ColorSet *set, Color c)
+{
+    size_t i, mask, probes = 1;
+
+    /* keep the load factor under 1/2 */
+    if ((set->len + 1) * 2 > set->cap && grow(set) != 0)
+        return COLORSET_ERR_NOMEM;
+    mask = set->cap - 1;
+    for (i = hash(c.value, mask); set->slots[i].gen == set->gen; i = (i + 1) & mask, probes++) {
+        if (set->slots[i].value == c.value) {
+            STATS_ADD(STATS_PROBES, probes);
+            STATS_ADD(STATS_COLLISIONS, probes > 1);
+            return 0;
+        }
+    }
+    STATS_ADD(STATS_PROBES, probes);
+    STATS_ADD(STATS_COLLISIONS, probes > 1);
+    set->slots[i].value = c.value;
+    set->slots[i].gen = set->gen;
+    set->len++;
+    return 1;
+}
+
+/* Same as colorset_add, for a key under COLORSET_SMALL_KEYS in the
+ * direct-mapped table. Keys live apart from the colors added with
+ * colorset_add. */
+int colorset_add_small(ColorSet *set, uint32_t key)
+{
+    if (!set->small) {
+        set->small = calloc(COLORSET_SMALL_KEYS, sizeof(uint32_t));
+        if (!set->small)
+            return COLORSET_ERR_NOMEM;
+    }
+    STATS_ADD(STATS_PROBES, 1);
+    if (set->small[key] == set->smallgen)
+        return 0;
+    set->small[key] = set->smallgen;
+    return 1;
+}
+
+/* Empties the set in O(1). Only when the generation counter wraps around
+ * does the memory get cleared. */
+void colorset_clear(ColorSet *set)
+{
+    set->len = 0;
+    if (++set->gen == 0) {
+        if (set->slots)
+            memset(set->slots, 0, set->cap * sizeof(ColorSlot));
+        set->gen = 1;
+    }
+    if (++set->smallgen == 0) {
+        if (set->small)
+            memset(set->small, 0, COLORSET_SMALL_KEYS * sizeof(uint32_t));
+        set->smallgen = 1;
+    }
+}
+
+void colorset_free(ColorSet *set)
+{
+    free(set->slots);
+    free(set->small);
+    set->slots = NULL;
+    set->small = NULL;
+    set->cap = set->len = 0;
+    set->gen = set->smallgen = 1;
+}
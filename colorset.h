@@ -0,0 +1,49 @@
+/* *******************************************************************
+ *                          colorset.h
+ * A hash set of colors, used to deduplicate pixels.
+ * Open addressing with linear probing. Every slot carries the
+ * generation it was written in, so clearing the set is just a matter
+ * of bumping the generation: a set can be reused for image after image
+ * without touching its memory.
+ * Colors that fit in 16 bits, like the gray and gray+alpha pairs of
+ * gray images, can go in a direct-mapped table instead: one stamp per
+ * key, no hashing and no probing. It's generation-stamped too, and
+ * cleared along with the hash set.
+ *
+ * *******************************************************************/
+
+#ifndef COLORSET_H_INCLUDED
+#define COLORSET_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+typedef struct {
+    uint32_t value;
+    uint32_t gen;   /* slot is used if gen is the set's current one */
+} ColorSlot;
+
+typedef struct _colorset {
+    ColorSlot *slots;
+    size_t cap;     /* always a power of two */
+    size_t len;
+    uint32_t gen;
+    uint32_t *small;    /* COLORSET_SMALL_KEYS stamps, allocated when first used */
+    uint32_t smallgen;
+} ColorSet;
+
+enum {
+    COLORSET_ERR_NOMEM = -1,
+};
+
+#define COLORSET_SMALL_KEYS 65536
+
+#define COLORSET_INIT { NULL, 0, 0, 1, NULL, 1 }
+
+int     colorset_add(ColorSet *set, Color c);
+int     colorset_add_small(ColorSet *set, uint32_t key);
+void    colorset_clear(ColorSet *set);
+void    colorset_free(ColorSet *set);
+
+#endif
@@ -0,0 +1,145 @@
+/* *******************************************************************
+ *                          colorsort.c
+ * Radix sorting of colors.
+ *
+ * *******************************************************************/
+
+#include "colorsort.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "colorspace.h"
+
+/* lightness is converted this many colors at a time */
+#define CHUNK 256
+
+static const char *key_names[] = {
+    "value", "red", "green", "blue", "alpha", "luma", "hue",
+    "lightness",
+};
+
+/* Returns the COLORSORT_* key named by s, or -1. */
+int colorsort_parse_key(const char *s)
+{
+    for (size_t i = 0; i < sizeof(key_names) / sizeof(key_names[0]); i++)
+        if (strcmp(s, key_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+/* Rec. 709 luma, in 16.16 fixed point (weights add up to 65536). */
+static uint32_t key_luma(Color c)
+{
+    return 13933u * c.red + 46871u * c.green + 4732u * c.blue;
+}
+
+/* Hue, scaled so that a full turn is about 65536, plus one: grays get 0,
+ * so that they come first. */
+static uint32_t key_hue(Color c)
+{
+    int max = c.red, min = c.red, d;
+    int32_t h;
+
+    if (c.green > max) max = c.green;
+    if (c.blue  > max) max = c.blue;
+    if (c.green < min) min = c.green;
+    if (c.blue  < min) min = c.blue;
+    d = max - min;
+    if (d == 0)
+        return 0;
+    /* the hue circle is split in 6 sectors of 65536/6 */
+    if (max == c.red)
+        h = (int32_t) (c.green - c.blue) * 10923 / d;
+    else if (max == c.green)
+        h = (int32_t) (c.blue - c.red) * 10923 / d + 2 * 10923;
+    else
+        h = (int32_t) (c.red - c.green) * 10923 / d + 4 * 10923;
+    if (h < 0)
+        h += 6 * 10923;
+    return (uint32_t) h + 1;
+}
+
+static uint32_t sort_key(Color c, int key)
+{
+    switch (key) {
+    case COLORSORT_RED:   return c.red;
+    case COLORSORT_GREEN: return c.green;
+    case COLORSORT_BLUE:  return c.blue;
+    case COLORSORT_ALPHA: return c.alpha;
+    case COLORSORT_LUMA:  return key_luma(c);
+    case COLORSORT_HUE:   return key_hue(c);
+    }
+    return 0;
+}
+
+/* Sorts n 64-bit items, 8 bits at a time starting from the least
+ * significant byte. All the histograms are built in a single pass, and
+ * a byte that's the same for every item (e.g. the upper key bytes of a
+ * channel sort, or all of them for COLORSORT_VALUE) costs nothing.
+ * The result ends up in a or tmp; the one it's in is returned. */
+static uint64_t *radix_sort(uint64_t *a, uint64_t *tmp, size_t n)
+{
+    size_t count[8][256];
+    uint64_t *src = a, *dst = tmp, *t;
+    size_t i, sum, c;
+    int b;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++)
+        for (b = 0; b < 8; b++)
+            count[b][(src[i] >> (b * 8)) & 0xFF]++;
+
+    for (b = 0; b < 8; b++) {
+        if (count[b][(src[0] >> (b * 8)) & 0xFF] == n)
+            continue;
+        for (sum = 0, i = 0; i < 256; i++) {
+            c = count[b][i];
+            count[b][i] = sum;
+            sum += c;
+        }
+        for (i = 0; i < n; i++)
+            dst[count[b][(src[i] >> (b * 8)) & 0xFF]++] = src[i];
+        t = src;
+        src = dst;
+        dst = t;
+    }
+    return src;
+}
+
+/* Sorts colors in place by key (COLORSORT_*), then by value.
+ * Returns COLORSORT_ERR_BADPARAM, COLORSORT_ERR_NOMEM. */
+int colorsort_sort(Color *colors, size_t n, int key)
+{
+    uint64_t *items, *sorted;
+    float l[CHUNK], a[CHUNK], b[CHUNK];
+    size_t i, j, len;
+
+    if (key < COLORSORT_VALUE || key > COLORSORT_LIGHTNESS)
+        return COLORSORT_ERR_BADPARAM;
+    if (n < 2)
+        return 0;
+    items = malloc(2 * n * sizeof(*items));
+    if (!items)
+        return COLORSORT_ERR_NOMEM;
+
+    if (key == COLORSORT_LIGHTNESS) {
+        /* 0-1, in 24 bits */
+        for (i = 0; i < n; i += len) {
+            len = n - i < CHUNK ? n - i : CHUNK;
+            colorspace_to_oklab(colors + i, len, l, a, b);
+            for (j = 0; j < len; j++)
+                items[i + j] = (uint64_t) (uint32_t) (l[j] * 16777216.0f) << 32
+                             | colors[i + j].value;
+        }
+    } else {
+        for (i = 0; i < n; i++)
+            items[i] = (uint64_t) sort_key(colors[i], key) << 32 | colors[i].value;
+    }
+    sorted = radix_sort(items, items + n, n);
+    for (i = 0; i < n; i++)
+        colors[i].value = (uint32_t) sorted[i];
+
+    free(items);
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* *******************************************************************
+ *                          colorsort.h
+ * Sorting arrays of colors. Every sort key is reduced to a 32-bit
+ * integer, computed once per color, and colors are then sorted with an
+ * LSD radix sort on (key, value) pairs: equal keys are ordered by
+ * value, so the output only depends on the set of colors and not on
+ * the order they came in.
+ * Channels are the fields of Color, the same ones getpal and makepal
+ * use. Lightness is OKLab's L (see colorspace.h), which unlike luma
+ * follows how light a color looks.
+ *
+ * *******************************************************************/
+
+#ifndef COLORSORT_H_INCLUDED
+#define COLORSORT_H_INCLUDED
+
+#include <stddef.h>
+#include "color.h"
+
+enum {
+    COLORSORT_VALUE,
+    COLORSORT_RED,
+    COLORSORT_GREEN,
+    COLORSORT_BLUE,
+    COLORSORT_ALPHA,
+    COLORSORT_LUMA,
+    COLORSORT_HUE,
+    COLORSORT_LIGHTNESS,
+};
+
+enum {
+    COLORSORT_ERR_BADPARAM = 1,
+    COLORSORT_ERR_NOMEM,
+};
+
+int     colorsort_parse_key(const char *s);
+int     colorsort_sort(Color *colors, size_t n, int key);
+
+#endif
@@ -0,0 +1,440 @@
+/* *******************************************************************
+ *                          colorspace.c
+ * Batch color space conversions, with SSE2 where there is.
+ * Colors are first spread into planes of linear RGB, from the table
+ * below, and the rest works on the planes, a chunk at a time.
+ *
+ * *******************************************************************/
+
+#include "colorspace.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* colors are converted this many at a time, through planes on the stack */
+#define CHUNK 256
+
+/* sRGB to linear, for every 8-bit value */
+static const float srgb_linear[256] = {
+    0.0f, 0.000303526984f, 0.000607053967f, 0.000910580951f, 0.00121410793f,
+    0.00151763492f, 0.0018211619f, 0.00212468888f, 0.00242821587f,
+    0.00273174285f, 0.00303526984f, 0.00334653576f, 0.00367650732f,
+    0.00402471702f, 0.00439144204f, 0.00477695348f, 0.0051815167f,
+    0.00560539162f, 0.00604883302f, 0.00651209079f, 0.00699541019f,
+    0.00749903204f, 0.00802319299f, 0.00856812562f, 0.0091340587f,
+    0.00972121732f, 0.010329823f, 0.010960094f, 0.0116122452f, 0.0122864884f,
+    0.0129830323f, 0.013702083f, 0.0144438436f, 0.0152085144f, 0.0159962934f,
+    0.0168073758f, 0.0176419545f, 0.0185002201f, 0.019382361f, 0.0202885631f,
+    0.0212190104f, 0.0221738848f, 0.0231533662f, 0.0241576324f, 0.0251868596f,
+    0.0262412219f, 0.0273208916f, 0.0284260395f, 0.0295568344f, 0.0307134437f,
+    0.0318960331f, 0.0331047666f, 0.0343398068f, 0.0356013149f, 0.0368894504f,
+    0.0382043716f, 0.0395462353f, 0.0409151969f, 0.0423114106f, 0.0437350293f,
+    0.0451862044f, 0.0466650863f, 0.0481718242f, 0.049706566f, 0.0512694584f,
+    0.052860647f, 0.0544802764f, 0.05612849f, 0.0578054302f, 0.0595112382f,
+    0.0612460542f, 0.0630100177f, 0.0648032667f, 0.0666259386f, 0.0684781698f,
+    0.0703600957f, 0.0722718507f, 0.0742135684f, 0.0761853815f, 0.0781874218f,
+    0.0802198203f, 0.0822827071f, 0.0843762115f, 0.086500462f, 0.0886555863f,
+    0.0908417112f, 0.0930589628f, 0.0953074666f, 0.0975873471f, 0.0998987282f,
+    0.102241733f, 0.104616484f, 0.107023103f, 0.109461711f, 0.111932428f,
+    0.114435374f, 0.116970668f, 0.119538428f, 0.122138772f, 0.124771818f,
+    0.12743768f, 0.130136477f, 0.132868322f, 0.13563333f, 0.138431615f,
+    0.141263291f, 0.144128471f, 0.147027266f, 0.14995979f, 0.152926152f,
+    0.155926464f, 0.158960835f, 0.162029376f, 0.165132195f, 0.1682694f,
+    0.171441101f, 0.174647404f, 0.177888416f, 0.181164244f, 0.184474995f,
+    0.187820772f, 0.191201683f, 0.19461783f, 0.19806932f, 0.201556254f,
+    0.205078736f, 0.20863687f, 0.212230757f, 0.2158605f, 0.2195262f,
+    0.223227957f, 0.226965874f, 0.230740049f, 0.234550582f, 0.238397574f,
+    0.242281122f, 0.246201327f, 0.250158285f, 0.254152094f, 0.258182853f,
+    0.262250658f, 0.266355605f, 0.270497791f, 0.274677312f, 0.278894263f,
+    0.28314874f, 0.287440838f, 0.29177065f, 0.296138271f, 0.300543794f,
+    0.304987314f, 0.309468923f, 0.313988713f, 0.318546778f, 0.323143209f,
+    0.327778098f, 0.332451536f, 0.337163615f, 0.341914425f, 0.346704056f,
+    0.3515326f, 0.356400144f, 0.36130678f, 0.366252596f, 0.37123768f,
+    0.376262123f, 0.381326011f, 0.386429434f, 0.391572478f, 0.396755231f,
+    0.40197778f, 0.407240212f, 0.412542613f, 0.417885071f, 0.42326767f,
+    0.428690497f, 0.434153636f, 0.439657174f, 0.445201195f, 0.450785783f,
+    0.456411023f, 0.462077f, 0.467783796f, 0.473531496f, 0.479320183f,
+    0.48514994f, 0.49102085f, 0.496932995f, 0.502886458f, 0.508881321f,
+    0.514917665f, 0.520995573f, 0.527115126f, 0.533276404f, 0.539479489f,
+    0.545724461f, 0.552011402f, 0.55834039f, 0.564711506f, 0.571124829f,
+    0.57758044f, 0.584078418f, 0.590618841f, 0.597201788f, 0.603827339f,
+    0.610495571f, 0.617206562f, 0.623960392f, 0.630757136f, 0.637596874f,
+    0.644479682f, 0.651405637f, 0.658374817f, 0.665387298f, 0.672443157f,
+    0.67954247f, 0.686685312f, 0.693871761f, 0.701101892f, 0.70837578f,
+    0.715693501f, 0.723055129f, 0.73046074f, 0.737910409f, 0.74540421f,
+    0.752942217f, 0.760524505f, 0.768151147f, 0.775822218f, 0.783537792f,
+    0.79129794f, 0.799102738f, 0.806952258f, 0.814846572f, 0.822785754f,
+    0.830769877f, 0.838799012f, 0.846873232f, 0.854992608f, 0.863157213f,
+    0.871367119f, 0.879622397f, 0.887923118f, 0.896269353f, 0.904661174f,
+    0.913098652f, 0.921581856f, 0.930110858f, 0.938685728f, 0.947306537f,
+    0.955973353f, 0.964686248f, 0.97344529f, 0.98225055f, 0.991102097f, 1.0f
+};
+
+/* the linear value halfway between two consecutive 8-bit sRGB values:
+ * the sRGB value of x is the number of these below it. The last two are
+ * above any x, so that encode can always look at two. */
+static const float linear_mid[257] = {
+    0.000151763492f, 0.000455290475f, 0.000758817459f, 0.00106234444f,
+    0.00136587143f, 0.00166939841f, 0.00197292539f, 0.00227645238f,
+    0.00257997936f, 0.00288350634f, 0.0031883009f, 0.00350925935f,
+    0.00384831493f, 0.00420574803f, 0.00458183274f, 0.00497683725f,
+    0.00539102416f, 0.00582465078f, 0.00627796943f, 0.00675122763f,
+    0.00724466842f, 0.0077585305f, 0.00829304845f, 0.00884845295f,
+    0.00942497089f, 0.0100228256f, 0.0106422369f, 0.0112834213f,
+    0.0119465921f, 0.0126319598f, 0.0133397316f, 0.014070112f, 0.0148233028f,
+    0.0155995031f, 0.0163989095f, 0.0172217161f, 0.0180681146f, 0.0189382945f,
+    0.0198324428f, 0.0207507446f, 0.0216933829f, 0.0226605384f, 0.0236523902f,
+    0.024669115f, 0.0257108881f, 0.0267778826f, 0.0278702702f, 0.0289882206f,
+    0.0301319019f, 0.0313014806f, 0.0324971216f, 0.0337189882f, 0.0349672424f,
+    0.0362420443f, 0.037543553f, 0.0388719259f, 0.0402273192f, 0.0416098877f,
+    0.0430197848f, 0.0444571628f, 0.0459221727f, 0.047414964f, 0.0489356854f,
+    0.0504844842f, 0.0520615066f, 0.0536668976f, 0.0553008013f, 0.0569633604f,
+    0.0586547169f, 0.0603750115f, 0.0621243839f, 0.0639029729f, 0.0657109163f,
+    0.0675483509f, 0.0694154125f, 0.0713122362f, 0.0732389559f, 0.0751957047f,
+    0.077182615f, 0.0791998181f, 0.0812474446f, 0.0833256241f, 0.0854344855f,
+    0.087574157f, 0.0897447658f, 0.0919464383f, 0.0941793004f, 0.096443477f,
+    0.0987390924f, 0.10106627f, 0.103425133f, 0.105815802f, 0.108238401f,
+    0.110693048f, 0.113179865f, 0.11569897f, 0.118250482f, 0.12083452f,
+    0.1234512f, 0.12610064f, 0.128782955f, 0.131498261f, 0.134246673f,
+    0.137028306f, 0.139843272f, 0.142691686f, 0.14557366f, 0.148489305f,
+    0.151438734f, 0.154422057f, 0.157439385f, 0.160490827f, 0.163576493f,
+    0.166696492f, 0.169850932f, 0.17303992f, 0.176263564f, 0.179521971f,
+    0.182815248f, 0.186143498f, 0.189506829f, 0.192905345f, 0.196339151f,
+    0.19980835f, 0.203313045f, 0.20685334f, 0.210429338f, 0.21404114f,
+    0.217688849f, 0.221372565f, 0.225092389f, 0.228848422f, 0.232640764f,
+    0.236469515f, 0.240334772f, 0.244236636f, 0.248175205f, 0.252150577f,
+    0.256162849f, 0.260212118f, 0.264298482f, 0.268422037f, 0.272582879f,
+    0.276781103f, 0.281016805f, 0.285290081f, 0.289601024f, 0.293949728f,
+    0.298336289f, 0.302760799f, 0.307223352f, 0.31172404f, 0.316262956f,
+    0.320840192f, 0.325455841f, 0.330109993f, 0.33480274f, 0.339534173f,
+    0.344304382f, 0.349113458f, 0.353961491f, 0.35884857f, 0.363774785f,
+    0.368740224f, 0.373744977f, 0.378789131f, 0.383872775f, 0.388995998f,
+    0.394158885f, 0.399361525f, 0.404604005f, 0.409886411f, 0.41520883f,
+    0.420571347f, 0.42597405f, 0.431417022f, 0.43690035f, 0.442424119f,
+    0.447988412f, 0.453593316f, 0.459238914f, 0.46492529f, 0.470652528f,
+    0.476420711f, 0.482229923f, 0.488080246f, 0.493971763f, 0.499904557f,
+    0.505878709f, 0.511894303f, 0.517951419f, 0.524050139f, 0.530190544f,
+    0.536372716f, 0.542596734f, 0.54886268f, 0.555170635f, 0.561520677f,
+    0.567912887f, 0.574347344f, 0.580824128f, 0.587343319f, 0.593904994f,
+    0.600509233f, 0.607156115f, 0.613845717f, 0.620578117f, 0.627353395f,
+    0.634171626f, 0.641032889f, 0.647937261f, 0.654884819f, 0.66187564f,
+    0.668909801f, 0.675987377f, 0.683108445f, 0.690273081f, 0.697481362f,
+    0.704733362f, 0.712029156f, 0.719368822f, 0.726752432f, 0.734180063f,
+    0.741651788f, 0.749167683f, 0.756727821f, 0.764332277f, 0.771981125f,
+    0.779674438f, 0.787412289f, 0.795194753f, 0.803021903f, 0.810893811f,
+    0.81881055f, 0.826772194f, 0.834778813f, 0.842830482f, 0.850927271f,
+    0.859069253f, 0.867256499f, 0.875489082f, 0.883767073f, 0.892090542f,
+    0.900459561f, 0.908874202f, 0.917334534f, 0.925840628f, 0.934392556f,
+    0.942990386f, 0.95163419f, 0.960324036f, 0.969059996f, 0.977842139f,
+    0.986670534f, 0.99554525f, 2.0f, 2.0f
+};
+
+/* the number of linear_mid below (i / 256)^2: where to start looking
+ * for the sRGB value of x, with i = sqrt(x) * 256. Consecutive entries
+ * are never more than 2 apart. */
+static const uint8_t mid_start[257] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 4, 5, 6, 7, 8, 10, 11, 13, 14, 15, 17, 18, 19,
+    21, 22, 23, 25, 26, 27, 29, 30, 31, 32, 34, 35, 36, 37, 38, 40, 41, 42,
+    43, 44, 46, 47, 48, 49, 50, 51, 53, 54, 55, 56, 57, 58, 60, 61, 62, 63,
+    64, 65, 66, 67, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 81, 82, 83,
+    84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95, 96, 98, 99, 100, 101, 102,
+    103, 104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115, 116, 117,
+    118, 119, 120, 121, 122, 123, 124, 125, 126, 127, 128, 129, 130, 131, 132,
+    133, 134, 135, 136, 137, 138, 139, 140, 141, 142, 143, 144, 145, 146, 147,
+    148, 149, 150, 151, 152, 153, 153, 154, 155, 156, 157, 158, 159, 160, 161,
+    162, 163, 164, 165, 166, 167, 168, 169, 170, 171, 172, 173, 173, 174, 175,
+    176, 177, 178, 179, 180, 181, 182, 183, 184, 185, 186, 187, 187, 188, 189,
+    190, 191, 192, 193, 194, 195, 196, 197, 198, 199, 199, 200, 201, 202, 203,
+    204, 205, 206, 207, 208, 209, 210, 210, 211, 212, 213, 214, 215, 216, 217,
+    218, 219, 219, 220, 221, 222, 223, 224, 225, 226, 227, 228, 228, 229, 230,
+    231, 232, 233, 234, 235, 236, 236, 237, 238, 239, 240, 241, 242, 243, 244,
+    244, 245, 246, 247, 248, 249, 250, 251, 251, 252, 253, 254, 255
+};
+
+/* OKLab, from Bjorn Ottosson: linear RGB to LMS, then cube roots of
+ * LMS to Lab */
+static const float oklab_m1[3][3] = {
+    { 0.4122214708f, 0.5363325363f, 0.0514459929f },
+    { 0.2119034982f, 0.6806995451f, 0.1073969566f },
+    { 0.0883024619f, 0.2817188376f, 0.6299787005f },
+};
+
+static const float oklab_m2[3][3] = {
+    { 0.2104542553f,  0.7936177850f, -0.0040720468f },
+    { 1.9779984951f, -2.4285922050f,  0.4505937099f },
+    { 0.0259040371f,  0.7827717662f, -0.8086757660f },
+};
+
+/* and their inverses */
+static const float oklab_m2inv[3][3] = {
+    { 1.0f,  0.3963377774f,  0.2158037573f },
+    { 1.0f, -0.1055613458f, -0.0638541728f },
+    { 1.0f, -0.0894841775f, -1.2914855480f },
+};
+
+static const float oklab_m1inv[3][3] = {
+    {  4.0767416621f, -3.3077115913f,  0.2309699292f },
+    { -1.2684380046f,  2.6097574011f, -0.3413193965f },
+    { -0.0041960863f, -0.7034186147f,  1.7076147010f },
+};
+
+/* linear RGB to XYZ, divided by the D65 white */
+static const float xyz_m[3][3] = {
+    { 0.4124564f / 0.95047f, 0.3575761f / 0.95047f, 0.1804375f / 0.95047f },
+    { 0.2126729f,            0.7151522f,            0.0721750f            },
+    { 0.0193339f / 1.08883f, 0.1191920f / 1.08883f, 0.9503041f / 1.08883f },
+};
+
+/* Cube root of x >= 0: a guess from the bits of x, good to a few
+ * percent, then two steps of Newton. */
+static inline float fast_cbrt(float x)
+{
+    union { float f; int32_t i; } u = { x };
+    float y;
+
+    u.i = (int32_t) ((float) u.i * (1.0f / 3.0f)) + 709921077;
+    y = u.f;
+    y = (2.0f * y + x / (y * y)) * (1.0f / 3.0f);
+    y = (2.0f * y + x / (y * y)) * (1.0f / 3.0f);
+    return y;
+}
+
+static void planes_linear(const Color *colors, size_t n, float *r, float *g, float *b)
+{
+    for (size_t i = 0; i < n; i++) {
+        r[i] = srgb_linear[colors[i].red];
+        g[i] = srgb_linear[colors[i].green];
+        b[i] = srgb_linear[colors[i].blue];
+    }
+}
+
+/* The nearest sRGB value of the linear value x, in 0-1, with
+ * i = sqrt(x) * 256: the number of linear_mid below x. Those below
+ * mid_start[i] are, and of the others only the next two can be. */
+static inline uint8_t encode_at(float x, unsigned i)
+{
+    unsigned k = mid_start[i];
+
+    return k + (linear_mid[k] < x) + (linear_mid[k + 1] < x);
+}
+
+static uint8_t encode(float x)
+{
+    x = x > 0 ? (x < 1 ? x : 1) : 0;
+    return encode_at(x, (unsigned) (sqrtf(x) * 256.0f));
+}
+
+#ifdef __SSE2__
+static inline __m128 cbrt4(__m128 x)
+{
+    const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+    __m128 y;
+
+    y = _mm_castsi128_ps(_mm_add_epi32(
+            _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(x)), third)),
+            _mm_set1_epi32(709921077)));
+    y = _mm_mul_ps(_mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(x, _mm_mul_ps(y, y))), third);
+    y = _mm_mul_ps(_mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(x, _mm_mul_ps(y, y))), third);
+    return y;
+}
+
+/* encode of 4 values at a time: all but the table lookups */
+static inline void encode4(__m128 x, uint8_t k[4])
+{
+    float v[4];
+    int32_t i[4];
+
+    x = _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    _mm_storeu_ps(v, x);
+    _mm_storeu_si128((__m128i *) i, _mm_cvttps_epi32(_mm_mul_ps(_mm_sqrt_ps(x), _mm_set1_ps(256.0f))));
+    k[0] = encode_at(v[0], i[0]);
+    k[1] = encode_at(v[1], i[1]);
+    k[2] = encode_at(v[2], i[2]);
+    k[3] = encode_at(v[3], i[3]);
+}
+
+static inline __m128 row4(const float m[3], __m128 x, __m128 y, __m128 z)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0]), x),
+                                 _mm_mul_ps(_mm_set1_ps(m[1]), y)),
+                      _mm_mul_ps(_mm_set1_ps(m[2]), z));
+}
+#endif
+
+/* x, y, z = m * (x, y, z), in place, then the cube root of each if root
+ * is set. */
+static void transform(const float m[3][3], float *x, float *y, float *z, size_t n, int root)
+{
+    size_t i = 0;
+    float a, b, c;
+
+#ifdef __SSE2__
+    for ( ; i + 4 <= n; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+        __m128 va = row4(m[0], vx, vy, vz), vb = row4(m[1], vx, vy, vz), vc = row4(m[2], vx, vy, vz);
+        if (root) {
+            va = cbrt4(va);
+            vb = cbrt4(vb);
+            vc = cbrt4(vc);
+        }
+        _mm_storeu_ps(x + i, va);
+        _mm_storeu_ps(y + i, vb);
+        _mm_storeu_ps(z + i, vc);
+    }
+#endif
+    for ( ; i < n; i++) {
+        a = m[0][0] * x[i] + m[0][1] * y[i] + m[0][2] * z[i];
+        b = m[1][0] * x[i] + m[1][1] * y[i] + m[1][2] * z[i];
+        c = m[2][0] * x[i] + m[2][1] * y[i] + m[2][2] * z[i];
+        x[i] = root ? fast_cbrt(a) : a;
+        y[i] = root ? fast_cbrt(b) : b;
+        z[i] = root ? fast_cbrt(c) : c;
+    }
+}
+
+/* The cube root of every x, in place. */
+static void roots(float *x, size_t n)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for ( ; i + 4 <= n; i += 4)
+        _mm_storeu_ps(x + i, cbrt4(_mm_loadu_ps(x + i)));
+#endif
+    for ( ; i < n; i++)
+        x[i] = fast_cbrt(x[i]);
+}
+
+/* Converts n colors to linear RGB. */
+void colorspace_to_linear(const Color *colors, size_t n, float *r, float *g, float *b)
+{
+    planes_linear(colors, n, r, g, b);
+}
+
+/* Converts n linear RGB colors to sRGB, leaving their alpha as it is. */
+void colorspace_from_linear(const float *r, const float *g, const float *b, size_t n,
+                            Color *colors)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    uint8_t kr[4], kg[4], kb[4];
+
+    for ( ; i + 4 <= n; i += 4) {
+        encode4(_mm_loadu_ps(r + i), kr);
+        encode4(_mm_loadu_ps(g + i), kg);
+        encode4(_mm_loadu_ps(b + i), kb);
+        for (int j = 0; j < 4; j++) {
+            colors[i + j].red   = kr[j];
+            colors[i + j].green = kg[j];
+            colors[i + j].blue  = kb[j];
+        }
+    }
+#endif
+    for ( ; i < n; i++) {
+        colors[i].red   = encode(r[i]);
+        colors[i].green = encode(g[i]);
+        colors[i].blue  = encode(b[i]);
+    }
+}
+
+/* Converts n colors to OKLab. */
+void colorspace_to_oklab(const Color *colors, size_t n, float *l, float *a, float *b)
+{
+    size_t i, len;
+
+    /* a chunk at a time, so that each pass finds it in the cache */
+    for (i = 0; i < n; i += len) {
+        len = n - i < CHUNK ? n - i : CHUNK;
+        planes_linear(colors + i, len, l + i, a + i, b + i);
+        transform(oklab_m1, l + i, a + i, b + i, len, 1);
+        transform(oklab_m2, l + i, a + i, b + i, len, 0);
+    }
+}
+
+/* Converts n OKLab colors to sRGB, leaving their alpha as it is. */
+void colorspace_from_oklab(const float *l, const float *a, const float *b, size_t n,
+                           Color *colors)
+{
+    float x[CHUNK], y[CHUNK], z[CHUNK];
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = n - i < CHUNK ? n - i : CHUNK;
+        memcpy(x, l + i, len * sizeof(float));
+        memcpy(y, a + i, len * sizeof(float));
+        memcpy(z, b + i, len * sizeof(float));
+        transform(oklab_m2inv, x, y, z, len, 0);
+        for (j = 0; j < len; j++) {
+            x[j] = x[j] * x[j] * x[j];
+            y[j] = y[j] * y[j] * y[j];
+            z[j] = z[j] * z[j] * z[j];
+        }
+        transform(oklab_m1inv, x, y, z, len, 0);
+        colorspace_from_linear(x, y, z, len, colors + i);
+    }
+}
+
+/* f of CIELAB, given the cube root of t. */
+static inline float lab_f(float t, float root)
+{
+    return t > 216.0f / 24389.0f ? root : (24389.0f / 27.0f * t + 16.0f) / 116.0f;
+}
+
+/* Converts n colors to CIELAB. */
+void colorspace_to_lab(const Color *colors, size_t n, float *l, float *a, float *b)
+{
+    float x[CHUNK], y[CHUNK], z[CHUNK], fx, fy, fz;
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = n - i < CHUNK ? n - i : CHUNK;
+        planes_linear(colors + i, len, l + i, a + i, b + i);
+        transform(xyz_m, l + i, a + i, b + i, len, 0);
+        memcpy(x, l + i, len * sizeof(float));
+        memcpy(y, a + i, len * sizeof(float));
+        memcpy(z, b + i, len * sizeof(float));
+        roots(x, len);
+        roots(y, len);
+        roots(z, len);
+        for (j = 0; j < len; j++) {
+            fx = lab_f(l[i + j], x[j]);
+            fy = lab_f(a[i + j], y[j]);
+            fz = lab_f(b[i + j], z[j]);
+            l[i + j] = 116.0f * fy - 16.0f;
+            a[i + j] = 500.0f * (fx - fy);
+            b[i + j] = 200.0f * (fy - fz);
+        }
+    }
+}
+
+/* Converts n colors to HSV. Grays have hue and saturation 0. */
+void colorspace_to_hsv(const Color *colors, size_t n, float *h, float *s, float *v)
+{
+    float r, g, b, max, min, d, hue;
+
+    for (size_t i = 0; i < n; i++) {
+        r = colors[i].red   * (1.0f / 255.0f);
+        g = colors[i].green * (1.0f / 255.0f);
+        b = colors[i].blue  * (1.0f / 255.0f);
+        max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+        d = max - min;
+        if (d == 0)
+            hue = 0;
+        else if (max == r)
+            hue = (g - b) / d;
+        else if (max == g)
+            hue = 2.0f + (b - r) / d;
+        else
+            hue = 4.0f + (r - g) / d;
+        hue *= 1.0f / 6.0f;
+        h[i] = hue < 0 ? hue + 1.0f : hue;
+        s[i] = max == 0 ? 0 : d / max;
+        v[i] = max;
+    }
+}
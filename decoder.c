@@ -0,0 +1,342 @@
+/* *******************************************************************
+ *                          decoder.c
+ * Reusable decoder contexts.
+ *
+ * *******************************************************************/
+
+#include "decoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stats.h"
+
+/* images smaller than this aren't worth a thread */
+#define PIPELINE_MIN_BYTES (1u << 18)
+
+void decoder_init(Decoder *dec)
+{
+    Palette pal = PALETTE_INIT;
+    ColorSet set = COLORSET_INIT;
+    RawImage raw = RAWIMAGE_INIT;
+    RowPipe pipe = ROWPIPE_INIT;
+    PngDirect direct = PNGDIRECT_INIT;
+
+    memset(&dec->arena, 0, sizeof(dec->arena));
+    dec->img = pngimage_default;
+    dec->img.arena = &dec->arena;
+    dec->raw = raw;
+    dec->direct = direct;
+    dec->format = IMAGE_FORMAT_UNKNOWN;
+    dec->usedirect = 1;
+    dec->isdirect = 0;
+    dec->set = set;
+    dec->pal = pal;
+    dec->built = 0;
+    dec->pipeline = 0;
+    dec->pipe = pipe;
+}
+
+/* The second thread of a pipelined decode: rows go from libpng
+ * straight into the ring, or from pngdirect's own row buffer. */
+static void *decoder_produce(void *arg)
+{
+    Decoder *dec = arg;
+    unsigned char *slot, *row;
+    int err = 0;
+
+    while (err == 0 && dec->img.row < dec->img.h) {
+        slot = rowpipe_slot(&dec->pipe);
+        if (!slot)
+            break;
+        if (dec->isdirect) {
+            err = pngdirect_next_row(&dec->direct, &row);
+            dec->img.row = dec->direct.row;
+            if (err == 0 && dec->img.row == dec->img.h)
+                err = pngdirect_finish(&dec->direct);
+            if (err == 0)
+                memcpy(slot, row, dec->img.rowbytes);
+        } else
+            err = pngimage_read_row(&dec->img, slot);
+        if (err == 0)
+            rowpipe_push(&dec->pipe);
+    }
+    rowpipe_close(&dec->pipe, err);
+    return NULL;
+}
+
+/* Builds the palette of the opened PNG image from rows decoded on
+ * another thread. Falls back to doing everything here if the thread
+ * can't be started. */
+static int decoder_pipe_rows(Decoder *dec)
+{
+    pthread_t thread;
+    const unsigned char *row;
+    uint32_t w = dec->img.w;
+    int ch = dec->img.ch, depth = dec->img.depth, err = 0;
+
+    if (rowpipe_reset(&dec->pipe, dec->img.rowbytes) != 0) {
+        decoder_close(dec);
+        return IMAGE_ERR_NOMEM;
+    }
+    if (pthread_create(&thread, NULL, decoder_produce, dec) != 0) {
+        while (err == 0 && dec->img.row < dec->img.h)
+            err = decoder_next_row(dec);
+        decoder_close(dec);
+        return err;
+    }
+    /* dec->img belongs to the other thread until it's joined */
+    while ((row = rowpipe_peek(&dec->pipe)) != NULL) {
+        if (palette_add_row(&dec->pal, &dec->set, row, w, ch, depth, 1) != 0) {
+            err = IMAGE_ERR_NOMEM;
+            rowpipe_cancel(&dec->pipe);
+            break;
+        }
+        rowpipe_pop(&dec->pipe);
+    }
+    pthread_join(thread, NULL);
+    if (err == 0)
+        err = rowpipe_error(&dec->pipe);
+    decoder_close(dec);
+    return err;
+}
+
+/* Opens the PNG image at buf with pngdirect, if dec->usedirect is set
+ * and pngdirect can decode it. Returns PNGDIRECT_UNSUPPORTED if not,
+ * and the same errors as pngdirect_open. */
+static int decoder_open_direct(Decoder *dec, const unsigned char *buf, size_t len)
+{
+    int err;
+
+    if (!dec->usedirect)
+        return PNGDIRECT_UNSUPPORTED;
+    err = pngdirect_open(&dec->direct, buf, len);
+    if (err != 0)
+        return err;
+    dec->isdirect = 1;
+    dec->img.w = dec->direct.w;
+    dec->img.h = dec->direct.h;
+    dec->img.ch = dec->direct.ch;
+    dec->img.depth = 8;
+    dec->img.rowbytes = dec->direct.rowbytes;
+    dec->img.row = 0;
+    dec->img.npasses = 1;
+    return 0;
+}
+
+/* Decodes the image at buf. PNG images that pngdirect can't decode are
+ * decoded whole into dec->img, unless dec->pipeline is set; the others
+ * are cheap enough to decode that their palette is built right away,
+ * row by row, with no image buffer. With dec->pipeline, so are all PNG
+ * images, and big enough ones that aren't interlaced are decoded on a
+ * second thread. Either way, decoder_palette must be called next.
+ * Returns the same errors as pngimage_read_image_mem, and
+ * IMAGE_ERR_BADDATA. */
+int decoder_read_mem(Decoder *dec, const unsigned char *buf, size_t len)
+{
+    int err;
+
+    dec->format = rawimage_sniff(buf, len);
+    dec->isdirect = 0;
+    if (dec->format == IMAGE_FORMAT_PNG && !dec->pipeline) {
+        dec->pal.len = 0;
+        err = decoder_open_direct(dec, buf, len);
+        if (err == PNGDIRECT_UNSUPPORTED) {
+            dec->built = 0;
+            dec->img.native = 1;
+            return pngimage_read_image_mem(&dec->img, buf, len);
+        }
+        dec->built = 1;
+        colorset_clear(&dec->set);
+    } else
+        err = decoder_open_mem(dec, buf, len);
+    if (err == 0 && dec->pipeline && dec->format == IMAGE_FORMAT_PNG && dec->img.npasses == 1
+     && dec->img.rowbytes * dec->img.h >= PIPELINE_MIN_BYTES)
+        return decoder_pipe_rows(dec);
+    while (err == 0 && dec->img.row < dec->img.h)
+        err = decoder_next_row(dec);
+    /* where libpng would have gone through png_read_end; pipelined
+     * images finish in decoder_produce instead */
+    if (err == 0 && dec->isdirect)
+        err = pngdirect_finish(&dec->direct);
+    decoder_close(dec);
+    return err;
+}
+
+/* Puts the palette of the last decoded image in dec->pal. Returns the
+ * same errors as palette_from_image. */
+int decoder_palette(Decoder *dec)
+{
+    if (dec->built) {       /* already there */
+        STATS_ADD(STATS_COLORS, dec->pal.len);
+        return 0;
+    }
+    return palette_from_image(&dec->pal, &dec->img, &dec->set);
+}
+
+/* Copies what the callers look at from the raw image to dec->img. */
+static void decoder_sync(Decoder *dec)
+{
+    dec->img.w = dec->raw.w;
+    dec->img.h = dec->raw.h;
+    dec->img.ch = dec->raw.ch;
+    dec->img.depth = 8;
+    dec->img.row = dec->raw.row;
+}
+
+/* Starts decoding the image at buf one row at a time, with an empty
+ * palette. Returns the same errors as pngimage_open_mem, and
+ * IMAGE_ERR_BADDATA. */
+int decoder_open_mem(Decoder *dec, const unsigned char *buf, size_t len)
+{
+    int err;
+
+    dec->pal.len = 0;
+    dec->built = 1;
+    colorset_clear(&dec->set);
+    dec->format = rawimage_sniff(buf, len);
+    dec->isdirect = 0;
+    if (dec->format == IMAGE_FORMAT_PNG) {
+        err = decoder_open_direct(dec, buf, len);
+        if (err != PNGDIRECT_UNSUPPORTED)
+            return err;
+        dec->img.native = 1;
+        return pngimage_open_mem(&dec->img, buf, len);
+    }
+    err = rawimage_open(&dec->raw, buf, len);
+    decoder_sync(dec);
+    return err;
+}
+
+/* Decodes the next row of the opened image, with whichever decoder it
+ * needs, and keeps dec->img.row up to date. */
+static int decoder_row(Decoder *dec, unsigned char **row)
+{
+    int err;
+
+    if (dec->isdirect) {
+        err = pngdirect_next_row(&dec->direct, row);
+        dec->img.row = dec->direct.row;
+    } else if (dec->format == IMAGE_FORMAT_PNG)
+        err = pngimage_next_row(&dec->img, row);
+    else {
+        err = rawimage_next_row(&dec->raw, row);
+        dec->img.row = dec->raw.row;
+    }
+    return err;
+}
+
+/* Decodes the whole image at buf into dec->img.data, whatever its
+ * format, as rows of dec->img.rowbytes bytes of 8-bit RGB or RGBA. Unlike
+ * decoder_read_mem, nothing is done with the colors, but decoder_palette
+ * can still be called. Returns the same errors as decoder_read_mem. */
+int decoder_read_image(Decoder *dec, const unsigned char *buf, size_t len)
+{
+    unsigned char *row;
+    size_t rowbytes;
+    uint32_t y;
+    int err;
+
+    dec->pal.len = 0;
+    dec->built = 0;
+    dec->format = rawimage_sniff(buf, len);
+    dec->isdirect = 0;
+    if (dec->format == IMAGE_FORMAT_PNG) {
+        err = decoder_open_direct(dec, buf, len);
+        if (err == PNGDIRECT_UNSUPPORTED) {
+            dec->img.native = 0;
+            return pngimage_read_image_mem(&dec->img, buf, len);
+        }
+    } else {
+        err = rawimage_open(&dec->raw, buf, len);
+        decoder_sync(dec);
+    }
+    if (err != 0)
+        return err;
+    rowbytes = (size_t) dec->img.w * dec->img.ch;
+    if (dec->img.datacap < rowbytes * dec->img.h) {
+        free(dec->img.data);
+        dec->img.data = malloc(rowbytes * dec->img.h);
+        dec->img.datacap = dec->img.data ? rowbytes * dec->img.h : 0;
+        if (!dec->img.data)
+            return IMAGE_ERR_NOMEM;
+    }
+    dec->img.rowbytes = rowbytes;
+    for (y = 0; y < dec->img.h; y++) {
+        err = decoder_row(dec, &row);
+        if (err != 0)
+            break;
+        memcpy(dec->img.data + y * rowbytes, row, rowbytes);
+    }
+    if (err == 0 && dec->isdirect)
+        err = pngdirect_finish(&dec->direct);
+    return err;
+}
+
+/* Decodes the next row and adds its new colors to dec->pal.
+ * Returns IMAGE_ERR_GENERIC, IMAGE_ERR_NOMEM, IMAGE_ERR_BADDATA. */
+int decoder_next_row(Decoder *dec)
+{
+    return decoder_sample_row(dec, 1);
+}
+
+/* Like decoder_next_row, but only looks at every step-th pixel of the
+ * row. */
+int decoder_sample_row(Decoder *dec, uint32_t step)
+{
+    unsigned char *row;
+    int err;
+
+    err = decoder_row(dec, &row);
+    if (err != 0)
+        return err;
+    if (palette_add_row(&dec->pal, &dec->set, row, dec->img.w, dec->img.ch, dec->img.depth,
+                        step) != 0)
+        return IMAGE_ERR_NOMEM;
+    return 0;
+}
+
+/* Skips n rows without looking at their colors. */
+int decoder_skip_rows(Decoder *dec, uint32_t n)
+{
+    int err;
+
+    if (dec->isdirect) {
+        err = pngdirect_skip_rows(&dec->direct, n);
+        dec->img.row = dec->direct.row;
+        return err;
+    }
+    if (dec->format == IMAGE_FORMAT_PNG)
+        return pngimage_skip_rows(&dec->img, n);
+    err = rawimage_skip_rows(&dec->raw, n);
+    dec->img.row = dec->raw.row;
+    return err;
+}
+
+/* Returns an upper bound on the number of colors in the opened image,
+ * from its header alone. */
+size_t decoder_max_colors(const Decoder *dec)
+{
+    if (dec->isdirect)
+        return (size_t) dec->img.w * dec->img.h;
+    if (dec->format == IMAGE_FORMAT_PNG)
+        return pngimage_max_colors(&dec->img);
+    return rawimage_max_colors(&dec->raw);
+}
+
+void decoder_close(Decoder *dec)
+{
+    if (dec->format == IMAGE_FORMAT_PNG && !dec->isdirect)
+        pngimage_close(&dec->img);
+}
+
+void decoder_free(Decoder *dec)
+{
+    pngimage_free(&dec->img);
+    pngimage_arena_free(&dec->arena);
+    rawimage_free(&dec->raw);
+    pngdirect_free(&dec->direct);
+    rowpipe_free(&dec->pipe);
+    colorset_free(&dec->set);
+    palette_free(&dec->pal);
+}
@@ -0,0 +1,67 @@
+/* *******************************************************************
+ *                          decoder.h
+ * A decoder context: everything needed to go from image data to a
+ * palette, kept from one image to the next. The format is sniffed from
+ * the data: PNG goes through pngimage, PPM/PAM, QOI and BMP through
+ * rawimage, and either way the rows end up in the same palette code.
+ * 8-bit RGB(A) PNGs that pngdirect can decode go there instead of
+ * pngimage, unless usedirect is cleared.
+ * PNG rows are kept in the file's format when that's gray, gray+alpha
+ * or 16-bit (see palette_add_row), instead of being made 8-bit RGB(A)
+ * first, except with decoder_read_image.
+ * The pixel buffers, libpng's memory, the dedup set and the palette
+ * array only ever grow, and the set is cleared in constant time, so a
+ * batch of same-sized images reaches a steady state where nothing gets
+ * allocated.
+ * Images can also be decoded one row at a time with decoder_open_mem
+ * and decoder_next_row, building the palette as rows come in, so that
+ * callers can stop as soon as they've seen enough, or only look at some
+ * of the rows and pixels (decoder_sample_row, decoder_skip_rows).
+ * decoder_read_image decodes every format into a whole image buffer,
+ * for callers that need the pixels where they are.
+ * With pipeline set, decoder_read_mem decodes big PNG images on a
+ * second thread, handing rows over through a RowPipe, while the calling
+ * thread builds the palette from them.
+ *
+ * *******************************************************************/
+
+#ifndef DECODER_H_INCLUDED
+#define DECODER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pngimage.h"
+#include "rawimage.h"
+#include "pngdirect.h"
+#include "colorset.h"
+#include "palette.h"
+#include "rowpipe.h"
+
+typedef struct _decoder {
+    Image img;          /* w, h, ch and row are kept up to date for every format */
+    PngArena arena;
+    RawImage raw;
+    PngDirect direct;
+    int format;         /* IMAGE_FORMAT_* of the current image */
+    int usedirect;      /* decode PNGs with pngdirect when it can; 1 by default */
+    int isdirect;       /* the current image is a PNG in direct */
+    ColorSet set;
+    Palette pal;
+    int built;          /* pal was built while decoding */
+    int pipeline;       /* decode big PNGs on a second thread; 0 by default */
+    RowPipe pipe;
+} Decoder;
+
+void    decoder_init(Decoder *dec);
+int     decoder_read_mem(Decoder *dec, const unsigned char *buf, size_t len);
+int     decoder_read_image(Decoder *dec, const unsigned char *buf, size_t len);
+int     decoder_palette(Decoder *dec);
+int     decoder_open_mem(Decoder *dec, const unsigned char *buf, size_t len);
+int     decoder_next_row(Decoder *dec);
+int     decoder_sample_row(Decoder *dec, uint32_t step);
+int     decoder_skip_rows(Decoder *dec, uint32_t n);
+size_t  decoder_max_colors(const Decoder *dec);
+void    decoder_close(Decoder *dec);
+void    decoder_free(Decoder *dec);
+
+#endif
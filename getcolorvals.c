@@ -1,93 +1,206 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <getopt.h>
 #include "color.h"
-#include "autoarray.h"
+#include "colorscan.h"
+#include "colorset.h"
+#include "palette.h"
+#include "colorsort.h"
+#include "palfile.h"
+#include "membuf.h"
+#ifndef _WIN32
+#include <unistd.h>
+#include "recolor.h"
+#endif
 
 #define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
 
-int findcolors(FILE *fin, AutoArray *arr);
-int findnext(FILE *f, Color *col);
+int addcolor(Palette *pal, ColorSet *set, Color c);
+int findcolors(const MemBuf *in, Palette *pal, ColorSet *set);
+int rewrite(const char *mapname, char **files, size_t nfiles, int nthreads);
+void usage(const char *progname);
 
-int findcolors(FILE *fin, AutoArray *arr)
+/* returns 1 for memory error */
+int addcolor(Palette *pal, ColorSet *set, Color c)
 {
-    int err;
+    int added = colorset_add(set, c);
+
+    return added == COLORSET_ERR_NOMEM || (added == 1 && palette_append(pal, c) != 0);
+}
+
+/* Adds the colors in in, which is either text or a binary palette file.
+ * returns 1 for memory error, 2 for a bad palette file */
+int findcolors(const MemBuf *in, Palette *pal, ColorSet *set)
+{
+    const char *p = (const char *) in->data, *end = p + in->len;
+    PalFile pf;
     Color col;
+    int err = 0;
 
-    while (err = findnext(fin, &col), err != EOF) {
-        if (autoarr_find(arr, &col, color_compare) != NULL)
-            continue;
-        autoarr_append(arr, color_dup(col));
+    if (palfile_check(in->data, in->len)) {
+        err = palfile_parse(&pf, in->data, in->len);
+        if (err != 0)
+            return err == PALFILE_ERR_NOMEM ? 1 : 2;
+        for (size_t i = 0; i < pf.len && err == 0; i++)
+            err = addcolor(pal, set, pf.colors[i]);
+        palfile_free(&pf);
+        return err;
     }
+    while (colorscan_next(&p, end, &col) != EOF)
+        if (addcolor(pal, set, col) != 0)
+            return 1;
     return 0;
 }
 
-/* Returns EOF if f is NULL or if reached end of file */
-int findnext(FILE *f, Color *cptr)
+#ifndef _WIN32
+/* Replaces colors in files, in place, by the map in mapname (see
+ * recolor.h). Prints how many colors changed in each file that did.
+ * Returns 1 if anything went wrong. */
+int rewrite(const char *mapname, char **files, size_t nfiles, int nthreads)
 {
-    char colstr[9]; /* +1 for terminating character */
-    int i, c;
+    MemBuf mapfile;
+    RecolorMap map = RECOLORMAP_INIT;
+    RecolorResult *res;
+    size_t line, i;
+    int err, retval = 0;
 
-    if (!f)
-        return EOF;
+    err = membuf_open(&mapfile, mapname);
+    if (err != 0) {
+        error("%s: %s\n", mapname, err == MEMBUF_ERR_NOMEM ? "out of memory" : "can't read file");
+        return 1;
+    }
+    err = recolor_load(&map, (const char *) mapfile.data, mapfile.len, &line);
+    membuf_close(&mapfile);
+    if (err == RECOLOR_ERR_FORMAT)
+        error("%s:%zu: expected an old and a new color\n", mapname, line);
+    res = err == 0 ? malloc(nfiles * sizeof(RecolorResult)) : NULL;
+    if (err == 0 && !res) {
+        error("out of memory\n");
+        err = RECOLOR_ERR_NOMEM;
+    }
+    if (err != 0) {
+        recolor_free(&map);
+        return 1;
+    }
 
-    while (c = getc(f), c != EOF) {
-        if (c != '#')
-            continue;
-        i = 0;
-        /* collect value */
-        while (isxdigit(c = getc(f)) && i != 8)
-            colstr[i++] = toupper(c);
-        colstr[i] = '\0';
-        if (color_strtocolor(colstr, cptr) != 0)
+    recolor_files(&map, files, nfiles, nthreads, res);
+    for (i = 0; i < nfiles; i++) {
+        switch (res[i].err) {
+        case 0:
+            if (res[i].replaced > 0)
+                printf("%s: %zu color%s replaced\n", files[i], res[i].replaced,
+                       res[i].replaced == 1 ? "" : "s");
             continue;
-        return 0;
+        case RECOLOR_ERR_NOMEM: error("%s: out of memory\n", files[i]); break;
+        case RECOLOR_ERR_OPEN:  error("%s: can't read file\n", files[i]); break;
+        default:                error("%s: can't write file, left as it was\n", files[i]); break;
+        }
+        retval = 1;
     }
+    free(res);
+    recolor_free(&map);
+    return retval;
+}
+#endif
 
-    return EOF;
+void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [--sort=KEY] [files...|palette files...]\n"
+                    "       %s --rewrite=MAP [--threads=N] files...\n"
+                    "KEY is one of value, red, green, blue, alpha, luma, hue, lightness\n"
+                    "MAP has an old and a new color on each line\n", progname, progname);
 }
 
 int main(int argc, char **argv)
 {
-    FILE *infile = NULL;
-    int retval = 0;
-    AutoArray *autarr;
+    MemBuf infile;
+    int retval = 0, opt, sortkey = -1, i, nfiles, nthreads = 0;
+    const char *fname, *mapname = NULL;
+    Palette pal = PALETTE_INIT;
+    ColorSet set = COLORSET_INIT;
+    const char *progname = *argv;
+    static const struct option longopts[] = {
+        { "sort",    required_argument, NULL, 'o' },
+        { "rewrite", required_argument, NULL, 'w' },
+        { "threads", required_argument, NULL, 'j' },
+        { NULL, 0, NULL, 0 },
+    };
 
-    autarr = autoarr_make();
-    if (!autarr) {
-        error("out of memory\n");
+    while (opt = getopt_long(argc, argv, "", longopts, NULL), opt != -1) {
+        switch (opt) {
+        case 'o':
+            sortkey = colorsort_parse_key(optarg);
+            if (sortkey == -1) {
+                error("invalid sort key: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w':
+            mapname = optarg;
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            if (nthreads < 1) {
+                error("invalid number of threads: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(progname);
+            return 1;
+        }
+    }
+    if (mapname) {
+#ifdef _WIN32
+        error("--rewrite is not supported on this system\n");
         return 1;
+#else
+        if (optind == argc || sortkey != -1) {
+            usage(progname);
+            return 1;
+        }
+        if (nthreads == 0)
+            nthreads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+        return rewrite(mapname, argv + optind, argc - optind, nthreads);
+#endif
     }
 
-    if (argc == 1) {        /* no arguments: get values from stdin */
-        retval = findcolors(stdin, autarr);
-        if (retval == 1)
+    /* get values from every file passed as arguments, or from stdin */
+    nfiles = argc - optind;
+    for (i = 0; i < (nfiles > 0 ? nfiles : 1); i++) {
+        fname = nfiles > 0 ? argv[optind + i] : "-";
+        switch (membuf_open(&infile, fname)) {
+        case 0: break;
+        case MEMBUF_ERR_NOMEM:
+            retval = 1;
             goto cleanup;
-    } else {
-        while (--argc) {    /* get values from every file passed as arguments */
-            infile = fopen(*++argv, "r");
-            if (!infile) {
-                error("%s: no such file or directory\n", *argv);
-                continue;
-            }
-            retval = findcolors(infile, autarr);
-            if (retval == 1)
-                break;
-            fclose(infile);
-            infile = NULL;
+        default:
+            error("%s: no such file or directory\n", fname);
+            continue;
         }
+        retval = findcolors(&infile, &pal, &set);
+        membuf_close(&infile);
+        if (retval == 2) {
+            error("%s: malformed palette file\n", fname);
+            retval = 0;
+        }
+        if (retval == 1)
+            break;
     }
-
-    for (size_t i = 0; i < AUTOARR_SIZE(autarr); i++) {
-        Color *tmp = (Color *) AUTOARR_GET(autarr, i);
-        printf("%08X\n", tmp->value);
-        free(tmp);
+    if (retval == 0 && sortkey != -1 && colorsort_sort(pal.colors, pal.len, sortkey) != 0)
+        retval = 1;
+    if (retval == 1) {
+        error("out of memory\n");
+        goto cleanup;
     }
 
+    for (size_t j = 0; j < pal.len; j++)
+        printf("%08X\n", pal.colors[j].value);
+
 cleanup:
-    autoarr_free(autarr);
-    if (infile)
-        fclose(infile);
+    palette_free(&pal);
+    colorset_free(&set);
     return retval;
 }
 
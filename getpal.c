@@ -4,95 +4,535 @@
  * prints its palette to stdout.
  * The palette is a list of colors where every element is 
  * unique.
- * Only PNG images are supported.
+ * PNG, PPM/PAM, QOI and uncompressed BMP images are supported; the
+ * format is found from the content. A file name of "-" reads the
+ * image from standard input.
+ * With --max-colors=N, getpal only tells whether each image has at
+ * most N colors, and stops decoding as soon as it finds out.
+ * With --row-stride, --pixel-stride or --pixel-budget, only some of the
+ * pixels are looked at, which gives an approximate palette of very big
+ * images in a fraction of the time. How many pixels were sampled is
+ * printed to stderr.
+ * With --sort=KEY, colors are printed sorted by value, by one channel,
+ * or by luma, hue or lightness (see colorsort.h) instead of in first-seen order.
+ * With --merge=DE, colors within DE of each other in OKLab (or CIELAB,
+ * with --merge-space=lab) are merged into one, and every color is
+ * printed with how many it stands for (see colormerge.h).
+ * With --tiles=WxH, the image is cut in tiles and the palette of each
+ * tile is printed on a line of its own, after the file name and the
+ * tile's column and row; with --tile-colors=N too, only the tiles with
+ * more than N colors are printed, with their number of colors (see
+ * tilepal.h).
+ * With --binary, the colors of all images are written to stdout as a
+ * single binary palette file (see palfile.h) instead of as text.
+ * Big PNG images are decoded on a second thread while the first one
+ * looks at the colors of the rows already decoded, if there's more than
+ * one core; --threads=1 turns this off.
+ * With --serve, getpal stays resident and answers requests on a
+ * Unix domain socket or on standard input (see palserver.h).
+ * With --watch, getpal stays resident and prints how the palettes of
+ * the given files, or of the files in the given directories, change as
+ * they're saved; --palette-image=FILE keeps the palette image of all of
+ * them up to date too (see palwatch.h). Linux only.
  * 
  * ***********************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
 #include <png.h>
 #include "pngimage.h"
+#include "membuf.h"
 #include "color.h"
+#include "palette.h"
+#include "decoder.h"
+#include "colorsort.h"
+#include "colormerge.h"
+#include "tilepal.h"
+#include "palfile.h"
+#include "stats.h"
+#ifndef _WIN32
+#include <unistd.h>
+#include "palserver.h"
+#endif
+#ifdef __linux__
+#include "palwatch.h"
+#endif
 
 #define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
 
-const Image pngimage_default = { NULL, 0, 0, NULL, NULL, 0, 0, 0 };
+typedef struct {
+    Palette pal;
+    uint32_t *counts;   /* with --merge, one for each color of pal */
+} Output;
 
-int printcolors(Image *img);
-int checkdup(Color *arr, size_t currpos, Color c);
+int printcolors(Palette *pal, int sortkey, double mergede, int space, Output *binout);
+int checkcolors(Decoder *dec, const MemBuf *in, size_t max, int *over);
+int samplecolors(Decoder *dec, const MemBuf *in, uint32_t rowstep, uint32_t pixstep,
+                 unsigned long long budget, unsigned long long *sampled);
+int printtiles(const char *fname, TilePal *tp, int sortkey, size_t budget, int *over);
+uint32_t parsestride(const char *s);
+void usage(const char *progname);
 
-/* Gets and printf every color in an image. It needs the image's data.
+/* printf every color in pal, sorted by sortkey unless it's -1. If
+ * mergede isn't 0, near colors are merged first, in the given
+ * COLORMERGE_* space, and each color is followed by its count. If binout
+ * isn't NULL, the colors are added to it instead, to be written as a
+ * palette file at the end.
  * Returns 1 for memory error. */
-int printcolors(Image *img)
+int printcolors(Palette *pal, int sortkey, double mergede, int space, Output *binout)
 {
-    unsigned char *data, *data_end;
-    Color         *colorarr, col;
-    size_t        currpos;
-
-    currpos = 0;
-    colorarr = calloc(img->w * img->h, sizeof(Color));
-    if (!colorarr)
-        return 1; /* memory error */
-
-    /* The image data is composed of bytes representing every pixel in the image.
-     * The pixels in turn are represented of red, green and blue values. If there are
-     * 4 channels, there's an alpha value too and must be taken in consideration. */
-    data = img->data;
-    data_end = img->data + img->w * img->h * img->ch;
-    col.alpha = 0xFF;
-    while(data < data_end) {     /* read data and get color values */
-        col.red = *data++;
-        col.green = *data++;
-        col.blue = *data++;
-        if (img->ch == 4)
-            col.alpha = *data++;
-        if (checkdup(colorarr, currpos, col))
-            continue;
-        colorarr[currpos++].value = col.value;
+    uint32_t *counts = NULL, *tmp;
+    size_t i, n = pal->len, start;
+
+    STATS_ENTER(STATS_OUTPUT);
+    if (sortkey != -1 && colorsort_sort(pal->colors, pal->len, sortkey) != 0)
+        return 1;
+    /* merged colors keep their order, so they stay sorted */
+    if (mergede != 0) {
+        STATS_ENTER(STATS_DEDUP);
+        counts = malloc((n ? n : 1) * sizeof(uint32_t));
+        if (!counts)
+            return 1;
+        for (i = 0; i < n; i++)
+            counts[i] = 1;
+        if (colormerge_merge(pal->colors, counts, &n, mergede, space) != 0) {
+            free(counts);
+            return 1;
+        }
+        STATS_ENTER(STATS_OUTPUT);
+    }
+    if (binout) {
+        start = binout->pal.len;
+        for (i = 0; i < n; i++)
+            if (palette_append(&binout->pal, pal->colors[i]) != 0)
+                goto nomem;
+        if (counts) {
+            tmp = realloc(binout->counts, (binout->pal.len ? binout->pal.len : 1) * sizeof(uint32_t));
+            if (!tmp)
+                goto nomem;
+            binout->counts = tmp;
+            memcpy(binout->counts + start, counts, n * sizeof(uint32_t));
+        }
+        free(counts);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (counts)
+            printf("%08X %lu\n", pal->colors[i].value, (unsigned long) counts[i]);
+        else
+            printf("%08X\n", pal->colors[i].value);
+    }
+    free(counts);
+    return 0;
+
+nomem:
+    free(counts);
+    return 1;
+}
+
+/* Finds out whether the image in in has more than max colors, without
+ * decoding more of it than needed: rows are read until max is exceeded,
+ * and if the header alone says there can't be more than max colors (e.g.
+ * a small PLTE), no row is read at all. Sets *over to 1 if there are more
+ * than max colors. Returns the same errors as pngimage_read_image_mem. */
+int checkcolors(Decoder *dec, const MemBuf *in, size_t max, int *over)
+{
+    int err;
+
+    *over = 0;
+    err = decoder_open_mem(dec, in->data, in->len);
+    if (err != 0)
+        return err;
+    if (decoder_max_colors(dec) > max) {
+        while (dec->img.row < dec->img.h) {
+            STATS_ENTER(STATS_DECODE);
+            err = decoder_next_row(dec);
+            if (err != 0)
+                break;
+            STATS_ENTER(STATS_DEDUP);
+            if (dec->pal.len > max) {
+                *over = 1;
+                break;
+            }
+        }
+        STATS_ADD(STATS_COLORS, dec->pal.len);
     }
+    decoder_close(dec);
+    return err;
+}
 
-    for (size_t i = 0; i < currpos; i++)
-        printf("%08X\n", colorarr[i].value);
-    free(colorarr);
+/* Builds an approximate palette of the image in in, made of the colors
+ * of every rowstep-th row and, in those rows, every pixstep-th pixel. If
+ * budget isn't 0, the two steps are chosen instead, the same for rows and
+ * columns, so that at most budget pixels are looked at. Skipped rows are
+ * still inflated and unfiltered by libpng, but never copied or looked at,
+ * and nothing after the last sampled row is decoded.
+ * Sets *sampled to the number of pixels looked at. Returns the same
+ * errors as pngimage_read_image_mem. */
+int samplecolors(Decoder *dec, const MemBuf *in, uint32_t rowstep, uint32_t pixstep,
+                 unsigned long long budget, unsigned long long *sampled)
+{
+    int err;
+    uint32_t w, h;
+
+    *sampled = 0;
+    err = decoder_open_mem(dec, in->data, in->len);
+    if (err != 0)
+        return err;
+    w = dec->img.w;
+    h = dec->img.h;
+    if (budget != 0) {
+        for (rowstep = 1; (unsigned long long) ((w + rowstep - 1) / rowstep)
+                          * ((h + rowstep - 1) / rowstep) > budget; rowstep++)
+            ;
+        pixstep = rowstep;
+    }
+    for (;;) {
+        STATS_ENTER(STATS_DECODE);
+        err = decoder_sample_row(dec, pixstep);
+        if (err != 0)
+            break;
+        *sampled += (w + pixstep - 1) / pixstep;
+        if (h - dec->img.row < rowstep)
+            break;
+        err = decoder_skip_rows(dec, rowstep - 1);
+        if (err != 0)
+            break;
+    }
+    STATS_ADD(STATS_COLORS, dec->pal.len);
+    decoder_close(dec);
+    return err;
+}
+
+/* Prints the palette of every tile in tp, each sorted by sortkey unless
+ * it's -1. If budget isn't 0, only the tiles with more than budget colors
+ * are printed, and *over is set if there are any.
+ * Returns 1 for memory error. */
+int printtiles(const char *fname, TilePal *tp, int sortkey, size_t budget, int *over)
+{
+    Color *colors;
+    size_t tile;
+    uint32_t i;
+
+    STATS_ENTER(STATS_OUTPUT);
+    for (tile = 0; tile < (size_t) tp->cols * tp->rows; tile++) {
+        if (budget != 0) {
+            if (tp->len[tile] > budget) {
+                printf("%s %zu,%zu: %lu colors\n", fname, tile % tp->cols, tile / tp->cols,
+                       (unsigned long) tp->len[tile]);
+                *over = 1;
+            }
+            continue;
+        }
+        colors = tp->colors + tile * tp->tw * tp->th;
+        if (sortkey != -1 && colorsort_sort(colors, tp->len[tile], sortkey) != 0)
+            return 1;
+        printf("%s %zu,%zu:", fname, tile % tp->cols, tile / tp->cols);
+        for (i = 0; i < tp->len[tile]; i++)
+            printf(" %08X", colors[i].value);
+        putchar('\n');
+    }
     return 0;
 }
 
-int checkdup(Color *arr, size_t currpos, Color c)
+/* Returns 0 if s isn't a valid stride. */
+uint32_t parsestride(const char *s)
 {
-    if (!arr || currpos == 0)
-        return 0;
-    for (size_t i = 0; i < currpos; i++)
-        if (arr[i].value == c.value)
-            return 1;   /* found */
-    return 0;   /* not found */
+    char *end;
+    unsigned long n = strtoul(s, &end, 10);
+
+    return *end != '\0' || n > UINT32_MAX ? 0 : n;
+}
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [--stats[=text|json]] [--sort=KEY] [--binary] [--threads=N] [--libpng]\n"
+                    "              [--merge=DE [--merge-space=SPACE]] [image files...|-]\n"
+                    "       %s [--stats[=text|json]] --max-colors=N [image files...|-]\n"
+                    "       %s [--stats[=text|json]] [--sort=KEY] [--binary] [--row-stride=N]\n"
+                    "              [--pixel-stride=N] [--pixel-budget=N]\n"
+                    "              [--merge=DE [--merge-space=SPACE]] [image files...|-]\n"
+                    "       %s [--stats[=text|json]] --tiles=WxH [--tile-colors=N] [--sort=KEY]\n"
+                    "              [--threads=N] [image files...|-]\n"
+                    "       %s --serve=SOCKET|- [--threads=N]\n"
+                    "       %s --watch [--debounce=MS] [--palette-image=FILE] files or directories...\n"
+                    "KEY is one of value, red, green, blue, alpha, luma, hue, lightness\n"
+                    "SPACE is one of oklab, lab\n",
+                    progname, progname, progname, progname, progname, progname);
 }
 
 int main(int argc, char **argv)
 {
-    FILE *infile;
-    int err;
-    Image img;
+    MemBuf infile;
+    int err, opt, mode, nthreads = 0, over, anyover = 0;
+    size_t maxcolors = 0;
+    uint32_t rowstep = 1, pixstep = 1;
+    unsigned long long budget = 0, sampled;
+    int sampling = 0, sortkey = -1, nimages = 0, space = COLORMERGE_OKLAB;
+    uint32_t tw = 0, th = 0;
+    size_t tilebudget = 0;
+    TilePal tiles = TILEPAL_INIT;
+    double mergede = 0;
+    Output binout = { PALETTE_INIT, NULL }, *binp = NULL;
+    char *end;
+    const char *serve = NULL, *palimage = NULL, *badpath = NULL;
+    int watch = 0, debounce = -1, uselibpng = 0;
+    Decoder dec;
+    const char *progname = *argv;
+    static const struct option longopts[] = {
+        { "stats",   optional_argument, NULL, 's' },
+        { "serve",   required_argument, NULL, 'S' },
+        { "threads", required_argument, NULL, 'j' },
+        { "max-colors", required_argument, NULL, 'm' },
+        { "row-stride", required_argument, NULL, 'r' },
+        { "pixel-stride", required_argument, NULL, 'p' },
+        { "pixel-budget", required_argument, NULL, 'b' },
+        { "sort",    required_argument, NULL, 'o' },
+        { "binary",  no_argument,       NULL, 'B' },
+        { "merge",   required_argument, NULL, 'M' },
+        { "merge-space", required_argument, NULL, 'c' },
+        { "tiles",   required_argument, NULL, 't' },
+        { "tile-colors", required_argument, NULL, 'T' },
+        { "watch",   no_argument,       NULL, 'w' },
+        { "debounce", required_argument, NULL, 'd' },
+        { "palette-image", required_argument, NULL, 'P' },
+        { "libpng",  no_argument,       NULL, 'L' },
+        { NULL, 0, NULL, 0 },
+    };
 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s [image files...]\n", *argv);
+    /* parse options */
+    while (opt = getopt_long(argc, argv, "", longopts, NULL), opt != -1) {
+        switch (opt) {
+        case 's':
+            mode = stats_parse_mode(optarg);
+            if (mode == -1) {
+                error("invalid stats format: %s\n", optarg);
+                return 1;
+            }
+            stats_start(mode);
+            break;
+        case 'S':
+            serve = optarg;
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            if (nthreads < 1) {
+                error("invalid number of threads: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'm':
+            maxcolors = strtoul(optarg, &end, 10);
+            if (maxcolors == 0 || *end != '\0') {
+                error("invalid number of colors: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+        case 'p':
+            if (opt == 'r')
+                rowstep = parsestride(optarg);
+            else
+                pixstep = parsestride(optarg);
+            if (rowstep == 0 || pixstep == 0) {
+                error("invalid stride: %s\n", optarg);
+                return 1;
+            }
+            sampling = 1;
+            break;
+        case 'b':
+            budget = strtoull(optarg, &end, 10);
+            if (budget == 0 || *end != '\0') {
+                error("invalid pixel budget: %s\n", optarg);
+                return 1;
+            }
+            sampling = 1;
+            break;
+        case 'o':
+            sortkey = colorsort_parse_key(optarg);
+            if (sortkey == -1) {
+                error("invalid sort key: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'B':
+            binp = &binout;
+            break;
+        case 'M':
+            mergede = strtod(optarg, &end);
+            if (!(mergede > 0) || *end != '\0') {
+                error("invalid ΔE: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            if (tilepal_parse_size(optarg, &tw, &th) != 0) {
+                error("invalid tile size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'T':
+            tilebudget = strtoul(optarg, &end, 10);
+            if (tilebudget == 0 || *end != '\0') {
+                error("invalid number of colors: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w':
+            watch = 1;
+            break;
+        case 'd':
+            debounce = strtol(optarg, &end, 10);
+            if (debounce < 0 || *end != '\0' || end == optarg) {
+                error("invalid debounce time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'P':
+            palimage = optarg;
+            break;
+        case 'L':
+            uselibpng = 1;
+            break;
+        case 'c':
+            space = colormerge_parse_space(optarg);
+            if (space == -1) {
+                error("invalid color space: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(progname);
+            return 1;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (serve) {
+#ifdef _WIN32
+        error("server mode is not supported on this system\n");
+        return 1;
+#else
+        if (stats_mode != STATS_OFF) {
+            error("--stats can't be used with --serve\n");
+            return 1;
+        }
+        if (strcmp(serve, "-") == 0)
+            err = palserver_run_stream(stdin, stdout);
+        else {
+            if (nthreads == 0)
+                nthreads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+            err = palserver_run_socket(serve, nthreads);
+        }
+        switch (err) {
+        case PALSERVER_ERR_NOMEM:  error("out of memory\n"); break;
+        case PALSERVER_ERR_SOCKET: error("%s: can't listen on socket\n", serve); break;
+        case PALSERVER_ERR_THREAD: error("can't start worker threads\n"); break;
+        case PALSERVER_ERR_IO:     error("error reading request or writing reply\n"); break;
+        case PALSERVER_ERR_TOOBIG: error("DATA request larger than %u bytes\n", PALSERVER_MAXDATA); break;
+        }
+        return err != 0;
+#endif
+    }
+
+    if ((debounce != -1 || palimage) && !watch) {
+        error("--debounce and --palette-image need --watch\n");
+        return 1;
+    }
+    if (watch) {
+#ifndef __linux__
+        error("watch mode is not supported on this system\n");
+        return 1;
+#else
+        if (argc < 1) {
+            usage(progname);
+            return 1;
+        }
+        if (stats_mode != STATS_OFF || maxcolors || sampling || binp || mergede != 0 || tw != 0
+         || sortkey != -1) {
+            error("--watch can only be used with --debounce and --palette-image\n");
+            return 1;
+        }
+        err = palwatch_run(argv, argc, debounce == -1 ? PALWATCH_DEBOUNCE : debounce, palimage,
+                           &badpath);
+        switch (err) {
+        case PALWATCH_ERR_NOMEM:   error("out of memory\n"); break;
+        case PALWATCH_ERR_INOTIFY: error("can't set up inotify\n"); break;
+        case PALWATCH_ERR_PATH:    error("can't watch %s\n", badpath); break;
+        }
+        return err != 0;
+#endif
+    }
+
+    if (argc < 1) {
+        usage(progname);
+        return 1;
+    }
+    if (binp && maxcolors) {
+        error("--binary can't be used with --max-colors\n");
+        return 1;
+    }
+    if (mergede != 0 && maxcolors) {
+        error("--merge can't be used with --max-colors\n");
+        return 1;
+    }
+    if (tilebudget != 0 && tw == 0) {
+        error("--tile-colors needs --tiles\n");
+        return 1;
+    }
+    if (tw != 0 && (maxcolors || sampling || binp || mergede != 0)) {
+        error("--tiles can't be used with --max-colors, sampling, --binary or --merge\n");
+        return 1;
+    }
+    if (sampling && maxcolors) {
+        error("--max-colors can't be used when sampling\n");
+        return 1;
+    }
+    if (budget != 0 && (rowstep != 1 || pixstep != 1)) {
+        error("--pixel-budget can't be used with --row-stride or --pixel-stride\n");
         return 1;
     }
 
-    /* parse arguments */
-    while (++argv, --argc > 0) {
-        img = pngimage_default;
-        infile = fopen(*argv, "rb");
-        if (!infile) {
+    /* parse arguments. the same decoder is used for every image, so that
+     * its buffers are reused */
+    decoder_init(&dec);
+#ifndef _WIN32
+    if (nthreads == 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+#endif
+    dec.pipeline = nthreads > 1;
+    dec.usedirect = !uselibpng;
+    for ( ; argc > 0; argv++, argc--) {
+        STATS_ENTER(STATS_IO);
+        err = membuf_open(&infile, *argv);
+        if (err == MEMBUF_ERR_NOMEM) {
+            error("out of memory\n");
+            return 1;
+        } else if (err != 0) {
             error("couldn't open %s\n", *argv);
             continue;
         }
 
-        err = pngimage_read_image(&img, infile);
+        STATS_ENTER(STATS_DECODE);
+        if (tw != 0)
+            err = decoder_read_image(&dec, infile.data, infile.len);
+        else if (maxcolors)
+            err = checkcolors(&dec, &infile, maxcolors, &over);
+        else if (sampling)
+            err = samplecolors(&dec, &infile, rowstep, pixstep, budget, &sampled);
+        else
+            err = decoder_read_mem(&dec, infile.data, infile.len);
         switch (err) {
         case IMAGE_ERR_NOTIMAGE:
             error("%s: not an image file\n", *argv);
-            fclose(infile);
+            membuf_close(&infile);
+            continue;
+        case IMAGE_ERR_BADDATA:
+            error("%s: malformed or unsupported image\n", *argv);
+            membuf_close(&infile);
             continue;
         case IMAGE_ERR_NOMEM:
             error("out of memory\n");
@@ -102,15 +542,61 @@ int main(int argc, char **argv)
             return 1;
         }
 
-        err = printcolors(&img);
+        if (tw != 0) {
+            STATS_ENTER(STATS_DEDUP);
+            over = 0;
+            err = tilepal_scan(&tiles, dec.img.data, dec.img.w, dec.img.h, dec.img.ch,
+                               dec.img.rowbytes, tw, th, nthreads);
+            if (err != 0 || printtiles(*argv, &tiles, sortkey, tilebudget, &over) != 0) {
+                error("out of memory\n");
+                return 1;
+            }
+            anyover |= over;
+        } else if (maxcolors) {
+            STATS_ENTER(STATS_OUTPUT);
+            printf("%s: %s %zu colors\n", *argv, over ? "more than" : "at most", maxcolors);
+            anyover |= over;
+        } else if (sampling) {
+            fprintf(stderr, "%s: sampled %llu of %llu pixels\n", *argv, sampled,
+                    (unsigned long long) dec.img.w * dec.img.h);
+            if (printcolors(&dec.pal, sortkey, mergede, space, binp) != 0) {
+                error("out of memory\n");
+                return 1;
+            }
+        } else {
+            STATS_ENTER(STATS_DEDUP);
+            if (decoder_palette(&dec) != 0 || printcolors(&dec.pal, sortkey, mergede, space, binp) != 0) {
+                error("out of memory\n");
+                return 1;
+            }
+        }
+        nimages++;
+
+        STATS_ENTER(STATS_IO);
+        membuf_close(&infile);
+        STATS_ENTER(STATS_OTHER);
+    }
+
+    decoder_free(&dec);
+    tilepal_free(&tiles);
+    if (binp) {
+        /* a single image's colors are known to be unique */
+        STATS_ENTER(STATS_OUTPUT);
+        err = palfile_write(stdout, binout.pal.colors, binout.counts, binout.pal.len,
+                            nimages == 1 ? PALFILE_UNIQUE : 0);
+        palette_free(&binout.pal);
+        free(binout.counts);
         if (err != 0) {
-            error("out of memory\n");
+            error("can't write palette file\n");
             return 1;
         }
-        
-        free(img.data);
-        fclose(infile);
     }
-    return 0;
+    if (stats_mode != STATS_OFF) {
+        STATS_ENTER(STATS_OUTPUT);
+        fflush(stdout);
+        stats_print(stderr);
+    }
+    /* for --max-colors and --tile-colors, the exit status is the verdict */
+    return anyover ? 2 : 0;
 }
 
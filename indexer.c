@@ -0,0 +1,365 @@
+/* *******************************************************************
+ *                          indexer.c
+ * Truecolor to indexed PNG conversion.
+ *
+ * *******************************************************************/
+
+#include "indexer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <png.h>
+#include <zlib.h>
+#include "membuf.h"
+#include "replfile.h"
+
+#define MAXCOLORS 256
+#define MAXHASHBITS 16
+
+/* A perfect hash of the palette: (value * mul) >> shift is a different
+ * slot for every color, and the slot holds the color's index. */
+typedef struct {
+    uint32_t mul;
+    int shift;
+    uint8_t slots[1 << MAXHASHBITS];
+} IndexHash;
+
+static uint32_t be32(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+/* Returns 1 if the chunk named type can be copied as it is to the
+ * indexed image. */
+static int keep_chunk(const unsigned char *type)
+{
+    static const char *known[] = {
+        "gAMA", "cHRM", "sRGB", "iCCP", "pHYs", "sPLT", "tEXt", "zTXt", "iTXt",
+        "tIME", "eXIf", "oFFs", "pCAL", "sCAL", "sTER",
+    };
+
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++)
+        if (memcmp(type, known[i], 4) == 0)
+            return 1;
+    /* unknown ones: only if ancillary and safe to copy (lowercase first
+     * and last letters) */
+    return (type[0] & 0x20) && (type[3] & 0x20);
+}
+
+/* Calls fn on every chunk of the PNG in buf after the signature, with
+ * after set for those after the image data, and stops at IEND or when fn
+ * returns non-zero. Returns what fn returned, or 0. */
+static int walk_chunks(const unsigned char *buf, size_t len,
+                       int (*fn)(void *arg, const unsigned char *type, const unsigned char *data,
+                                 uint32_t n, int after), void *arg)
+{
+    size_t off = 8;
+    uint32_t n;
+    int after = 0, ret;
+
+    while (off + 12 <= len) {
+        n = be32(buf + off);
+        if (n > len - off - 12)
+            break;
+        if (memcmp(buf + off + 4, "IEND", 4) == 0)
+            break;
+        if (memcmp(buf + off + 4, "IDAT", 4) == 0)
+            after = 1;
+        else if ((ret = fn(arg, buf + off + 4, buf + off + 8, n, after)) != 0)
+            return ret;
+        off += 12 + (size_t) n;
+    }
+    return 0;
+}
+
+static int is_animated(void *arg, const unsigned char *type, const unsigned char *data,
+                       uint32_t n, int after)
+{
+    (void) arg, (void) data, (void) n, (void) after;
+    return memcmp(type, "acTL", 4) == 0;
+}
+
+typedef struct {
+    png_structp png;
+    int after;
+} ChunkCopy;
+
+static int copy_chunk(void *arg, const unsigned char *type, const unsigned char *data,
+                      uint32_t n, int after)
+{
+    ChunkCopy *cc = arg;
+
+    if (after == cc->after && keep_chunk(type))
+        png_write_chunk(cc->png, type, data, n);
+    return 0;
+}
+
+/* Finds a multiplier that hashes the n colors of pal to different slots,
+ * in the smallest table that allows one. */
+static void index_hash_build(IndexHash *h, const Palette *pal)
+{
+    uint32_t seed = 0x9E3779B9u, slot;
+    uint64_t used[(1 << MAXHASHBITS) / 64];
+    int bits, try;
+    size_t i;
+
+    /* with n^2 slots a random multiplier works about half of the time */
+    for (bits = 4; bits < MAXHASHBITS && (1u << bits) < pal->len * pal->len; bits++)
+        ;
+    for ( ; ; bits += bits < MAXHASHBITS) {
+        for (try = 0; try < 64; try++) {
+            /* xorshift, made odd */
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            h->mul = seed | 1;
+            h->shift = 32 - bits;
+            memset(used, 0, ((1u << bits) + 63) / 64 * sizeof(uint64_t));
+            for (i = 0; i < pal->len; i++) {
+                slot = (uint32_t) (pal->colors[i].value * h->mul) >> h->shift;
+                if (used[slot / 64] >> (slot % 64) & 1)
+                    break;
+                used[slot / 64] |= (uint64_t) 1 << (slot % 64);
+                h->slots[slot] = i;
+            }
+            if (i == pal->len)
+                return;
+        }
+    }
+}
+
+/* Collects the colors of ix->img into ix->pal, giving up as soon as
+ * there are more than MAXCOLORS. Sets *fits to whether they fit.
+ * Returns INDEXER_ERR_NOMEM. */
+static int collect_colors(Indexer *ix, int *fits)
+{
+    const Image *img = &ix->img;
+    uint32_t y;
+
+    *fits = 0;
+    ix->pal.len = 0;
+    colorset_clear(&ix->set);
+    for (y = 0; y < img->h; y++) {
+        if (palette_add_pixels(&ix->pal, &ix->set, img->data + (size_t) y * img->rowbytes,
+                               img->w, img->ch, 1) != 0)
+            return INDEXER_ERR_NOMEM;
+        if (ix->pal.len > MAXCOLORS)
+            return 0;
+    }
+    *fits = 1;
+    return 0;
+}
+
+/* Puts the colors with alpha first, keeping the order otherwise.
+ * Returns how many there are. */
+static int sort_alpha_first(Palette *pal)
+{
+    Color tmp[MAXCOLORS];
+    size_t i, n = 0, k;
+
+    for (i = 0; i < pal->len; i++)
+        if (pal->colors[i].alpha != 0xFF)
+            tmp[n++] = pal->colors[i];
+    k = n;
+    for (i = 0; i < pal->len; i++)
+        if (pal->colors[i].alpha == 0xFF)
+            tmp[k++] = pal->colors[i];
+    memcpy(pal->colors, tmp, pal->len * sizeof(Color));
+    return n;
+}
+
+/* Replaces the pixels of img with depth-bit indices, packed in rows of
+ * stride bytes from the start of img->data. Nothing is written before
+ * it's been read. */
+static void pack_image(Image *img, const IndexHash *h, int depth, size_t stride)
+{
+    const unsigned char *p;
+    unsigned char *out;
+    unsigned idx, acc, fill;
+    uint32_t x, y;
+    Color c;
+
+    c.alpha = 0xFF;
+    for (y = 0; y < img->h; y++) {
+        p = img->data + (size_t) y * img->rowbytes;
+        out = img->data + (size_t) y * stride;
+        acc = fill = 0;
+        for (x = 0; x < img->w; x++, p += img->ch) {
+            if (img->ch == 4)
+                memcpy(&c, p, 4);
+            else {
+                c.red = p[0];
+                c.green = p[1];
+                c.blue = p[2];
+            }
+            idx = h->slots[(uint32_t) (c.value * h->mul) >> h->shift];
+            if (depth == 8) {
+                *out++ = idx;
+                continue;
+            }
+            acc = acc << depth | idx;
+            fill += depth;
+            if (fill == 8) {
+                *out++ = acc;
+                acc = fill = 0;
+            }
+        }
+        if (fill != 0)
+            *out = acc << (8 - fill);
+    }
+}
+
+/* Writes the image, packed by pack_image, to f. orig is the original
+ * file, for its ancillary chunks. */
+static int write_indexed(Indexer *ix, FILE *f, int depth, size_t stride, int ntrans,
+                         const MemBuf *orig)
+{
+    const Image *img = &ix->img;
+    png_color plte[MAXCOLORS];
+    png_byte trns[MAXCOLORS];
+    png_structp png;
+    png_infop info;
+    ChunkCopy cc;
+    uint32_t y;
+    size_t i;
+
+    for (i = 0; i < ix->pal.len; i++) {
+        plte[i].red   = ix->pal.colors[i].red;
+        plte[i].green = ix->pal.colors[i].green;
+        plte[i].blue  = ix->pal.colors[i].blue;
+        trns[i]       = ix->pal.colors[i].alpha;
+    }
+
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png)
+        return INDEXER_ERR_NOMEM;
+    info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_write_struct(&png, NULL);
+        return INDEXER_ERR_NOMEM;
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        return INDEXER_ERR_WRITE;
+    }
+
+    png_init_io(png, f);
+    png_set_compression_level(png, Z_BEST_COMPRESSION);
+    png_set_IHDR(png, info, img->w, img->h, depth, PNG_COLOR_TYPE_PALETTE,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_set_PLTE(png, info, plte, ix->pal.len);
+    if (ntrans > 0)
+        png_set_tRNS(png, info, trns, ntrans, NULL);
+    /* color space chunks must come before PLTE, and the others may */
+    png_write_info_before_PLTE(png, info);
+    cc.png = png;
+    cc.after = 0;
+    walk_chunks(orig->data, orig->len, copy_chunk, &cc);
+    png_write_info(png, info);
+    for (y = 0; y < img->h; y++)
+        png_write_row(png, img->data + (size_t) y * stride);
+    cc.after = 1;
+    walk_chunks(orig->data, orig->len, copy_chunk, &cc);
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    return 0;
+}
+
+void indexer_init(Indexer *ix)
+{
+    Palette pal = PALETTE_INIT;
+    ColorSet set = COLORSET_INIT;
+
+    memset(&ix->arena, 0, sizeof(ix->arena));
+    ix->img = pngimage_default;
+    ix->img.arena = &ix->arena;
+    ix->set = set;
+    ix->pal = pal;
+}
+
+/* Converts the PNG at path to an indexed PNG, in place, if it has at most
+ * 256 colors and the result is smaller; res tells what happened. If path
+ * is a symbolic link, the file it points to is replaced.
+ * Returns INDEXER_ERR_NOMEM, INDEXER_ERR_OPEN, INDEXER_ERR_NOTPNG,
+ * INDEXER_ERR_BADDATA, INDEXER_ERR_WRITE. */
+int indexer_convert(Indexer *ix, const char *path, IndexerResult *res)
+{
+    MemBuf in;
+    IndexHash *h = NULL;
+    ReplFile out;
+    long size;
+    size_t stride;
+    int err, fits, ntrans, depth;
+
+    res->outcome = INDEXER_SKIPPED;
+    res->colors = res->oldsize = res->newsize = 0;
+    err = membuf_open(&in, path);
+    if (err != 0)
+        return err == MEMBUF_ERR_NOMEM ? INDEXER_ERR_NOMEM : INDEXER_ERR_OPEN;
+    res->oldsize = in.len;
+
+    err = pngimage_read_image_mem(&ix->img, in.data, in.len);
+    switch (err) {
+    case 0:                 break;
+    case IMAGE_ERR_NOMEM:   err = INDEXER_ERR_NOMEM; goto done;
+    case IMAGE_ERR_NOTIMAGE: err = INDEXER_ERR_NOTPNG; goto done;
+    default:                err = INDEXER_ERR_BADDATA; goto done;
+    }
+    if (ix->img.bitdepth != 8
+     || (ix->img.colortype != PNG_COLOR_TYPE_RGB && ix->img.colortype != PNG_COLOR_TYPE_RGBA)
+     || walk_chunks(in.data, in.len, is_animated, NULL))
+        goto done;
+
+    err = collect_colors(ix, &fits);
+    if (err != 0)
+        goto done;
+    if (!fits) {
+        res->outcome = INDEXER_TOO_MANY_COLORS;
+        goto done;
+    }
+    res->colors = ix->pal.len;
+    ntrans = sort_alpha_first(&ix->pal);
+
+    h = malloc(sizeof(IndexHash));
+    if (!h) {
+        err = INDEXER_ERR_NOMEM;
+        goto done;
+    }
+    index_hash_build(h, &ix->pal);
+    depth = ix->pal.len <= 2 ? 1 : ix->pal.len <= 4 ? 2 : ix->pal.len <= 16 ? 4 : 8;
+    stride = ((size_t) ix->img.w * depth + 7) / 8;
+    pack_image(&ix->img, h, depth, stride);
+
+    if (replfile_open(&out, path) != 0) {
+        err = INDEXER_ERR_WRITE;
+        goto done;
+    }
+    err = write_indexed(ix, out.f, depth, stride, ntrans, &in);
+    if (err == 0 && (fflush(out.f) != 0 || (size = ftell(out.f)) < 0))
+        err = INDEXER_ERR_WRITE;
+    if (err == 0) {
+        res->newsize = size;
+        res->outcome = res->newsize < res->oldsize ? INDEXER_CONVERTED : INDEXER_NOT_SMALLER;
+    }
+    if (err == 0 && res->outcome == INDEXER_CONVERTED)
+        err = replfile_commit(&out) != 0 ? INDEXER_ERR_WRITE : 0;
+    else
+        replfile_discard(&out);
+    if (err != 0)
+        res->outcome = INDEXER_SKIPPED;
+
+done:
+    free(h);
+    membuf_close(&in);
+    return err;
+}
+
+void indexer_free(Indexer *ix)
+{
+    pngimage_free(&ix->img);
+    pngimage_arena_free(&ix->arena);
+    colorset_free(&ix->set);
+    palette_free(&ix->pal);
+}
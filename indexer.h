@@ -0,0 +1,63 @@
+/* *******************************************************************
+ *                          indexer.h
+ * Turns truecolor PNGs that use at most 256 colors into indexed ones.
+ * The image is decoded with pngimage and its colors collected like
+ * getpal does, stopping as soon as there are more than 256. If they fit,
+ * the colors become a PLTE (those with alpha first, so that tRNS is as
+ * short as can be), the smallest bit depth that holds them is picked,
+ * and every pixel is mapped to its index through a perfect hash of the
+ * palette: one probe per pixel, and no compare. Indices are packed over
+ * the decoded pixels, so no other buffer is needed.
+ * The new file is written next to the old one and renamed over it only
+ * if it's smaller; otherwise the old file is left alone. Ancillary
+ * chunks that still apply to the new image (gAMA, iCCP, pHYs, text...)
+ * are copied over; bKGD, sBIT and hIST, which would have to be
+ * translated, are dropped. 16-bit, grayscale, already indexed and
+ * animated PNGs are skipped.
+ * An Indexer keeps its buffers from one image to the next.
+ *
+ * *******************************************************************/
+
+#ifndef INDEXER_H_INCLUDED
+#define INDEXER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pngimage.h"
+#include "colorset.h"
+#include "palette.h"
+
+typedef struct _indexer {
+    Image img;
+    PngArena arena;
+    ColorSet set;
+    Palette pal;
+} Indexer;
+
+/* what indexer_convert did with the file */
+enum {
+    INDEXER_CONVERTED,
+    INDEXER_TOO_MANY_COLORS,
+    INDEXER_NOT_SMALLER,
+    INDEXER_SKIPPED,        /* not an 8-bit truecolor still image */
+};
+
+typedef struct {
+    int outcome;            /* INDEXER_* */
+    size_t colors;          /* 0 if there are too many, or if skipped */
+    size_t oldsize, newsize;
+} IndexerResult;
+
+enum {
+    INDEXER_ERR_NOMEM = 1,
+    INDEXER_ERR_OPEN,
+    INDEXER_ERR_NOTPNG,
+    INDEXER_ERR_BADDATA,
+    INDEXER_ERR_WRITE,
+};
+
+void    indexer_init(Indexer *ix);
+int     indexer_convert(Indexer *ix, const char *path, IndexerResult *res);
+void    indexer_free(Indexer *ix);
+
+#endif
@@ -1,7 +1,8 @@
 /* *****************************************************************
  *                      makepal.c
  * A very simple program which takes a list of colors (from file or
- * standard input) and creates an image with those colors.
+ * standard input) and creates an image with those colors. The list
+ * can also be a binary palette file, as written by getpal --binary.
  * Only PNG images are supported.
  *
  * *****************************************************************/
@@ -9,9 +10,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <getopt.h>
 #include "pngimage.h"
 #include "color.h"
-#include "autoarray.h"
+#include "colorio.h"
+#include "colorset.h"
+#include "palette.h"
+#include "palfile.h"
+#include "membuf.h"
+#include "stats.h"
 
 #define DEBUG
 #define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
@@ -24,88 +31,18 @@ enum {
     ERR_LIBPNG,
 };
 
-int readcolor(FILE *stream, Color *c);
-int writeimage(const char *fname, AutoArray *arr);
-int process(FILE *infile, const char *name);
-void free_color_arr(AutoArray *autarr);
+int writeimage(const char *fname, const Color *colors, size_t n);
+int addcolor(Palette *pal, ColorSet *set, Color c);
+int process(const MemBuf *in, const char *name);
 void die(int err);
-
-#ifdef _WIN32   /* Windows doesn't have a getline function. */
-typedef intptr_t ssize_t;
-
-ssize_t getline(char **lineptr, size_t *n, FILE *stream)
-{
-    size_t pos;
-    int c;
-
-    if (lineptr == NULL || stream == NULL || n == NULL)
-        return -1;
-    if ((c = getc(stream)) == EOF)
-        return -1;
-    if (*lineptr == NULL) {
-        *lineptr = malloc(128);
-        if (*lineptr == NULL) {
-            return -1;
-        }
-        *n = 128;
-    }
-
-    pos = 0;
-    while(c != EOF) {
-        if (pos + 1 >= *n) {
-            size_t new_size = *n + (*n >> 2);
-            if (new_size < 128) {
-                new_size = 128;
-            }
-            char *new_ptr = realloc(*lineptr, new_size);
-            if (new_ptr == NULL)
-                return -1;
-            *n = new_size;
-            *lineptr = new_ptr;
-        }
-
-        (*lineptr)[pos++] = c;
-        if (c == '\n')
-            break;
-        c = getc(stream);
-    }
-
-    (*lineptr)[pos] = '\0';
-    return pos;
-}
-#endif
-
-/* Gets the next color from stream.
- * Stream is a file containing a list which should be formatted like this:
- * 0CFA2E25
- * 09BC6751
- * ...
- * Blank lines are skipped. */
-int readcolor(FILE *stream, Color *cptr)
-{
-    ssize_t llen;
-    char *line = NULL;
-    size_t n = 0;
-
-    llen = getline(&line, &n, stream);  /* get next line and examine it */
-    if (llen == -1)
-        return 2;
-    if (line[llen-1] == '\n')   /* remove newline */
-        line[llen-1] = '\0';
-    if (color_strtocolor(line, cptr) != 0) {
-        free(line);
-        return 1;
-    }
-    free(line);
-    return 0;
-}
+void usage(const char *progname);
 
 /* returns ERR_FILE, ERR_NOMEM, ERR_LIBPNG */
-int writeimage(const char *fname, AutoArray *arr)
+int writeimage(const char *fname, const Color *colors, size_t n)
 {
     int err;
     size_t i, j;
-    Image img = { .w = AUTOARR_SIZE(arr), .h = 1, .ch = 4};
+    Image img = { .w = n, .h = 1, .ch = 4};
     FILE *outfile;
 
     /* set up output file */
@@ -114,18 +51,17 @@ int writeimage(const char *fname, AutoArray *arr)
         return ERR_FILE;
 
     /* set up image data */
-    img.data = malloc(AUTOARR_SIZE(arr)*4*sizeof(char));
+    img.data = malloc(n*4*sizeof(char));
     if (!img.data) {
         fclose(outfile);
         return ERR_NOMEM;
     }
 
-    for (i = 0, j = 0; i < AUTOARR_SIZE(arr); i++) {
-        Color *tmp = (Color *) AUTOARR_GET(arr, i);
-        img.data[j++] = tmp->red;
-        img.data[j++] = tmp->green;
-        img.data[j++] = tmp->blue;
-        img.data[j++] = tmp->alpha;
+    for (i = 0, j = 0; i < n; i++) {
+        img.data[j++] = colors[i].red;
+        img.data[j++] = colors[i].green;
+        img.data[j++] = colors[i].blue;
+        img.data[j++] = colors[i].alpha;
     }
 
     /* write image */
@@ -144,94 +80,145 @@ int writeimage(const char *fname, AutoArray *arr)
     return 0;
 }
 
-/* returns non-zero for any important error */
-int process(FILE *infile, const char *name)
+/* Adds c to pal, unless it's already there. Returns ERR_NOMEM. */
+int addcolor(Palette *pal, ColorSet *set, Color c)
 {
-    size_t linen = 0;
-    int err = 0;
-    Color c;
-    AutoArray *autarr;
-
-    /* init auto array */
-    autarr = autoarr_make();
-    if (!autarr)
-        return 1;
-
-    /* read file and get color */
-    while (err = readcolor(infile, &c), err == 0) {
-        if (autoarr_find(autarr, &c, color_compare) != NULL)
-            continue;
-        if (autoarr_append(autarr, color_dup(c)) == AUTOARR_ERR_NOMEM) {
-            free_color_arr(autarr);
-            return ERR_NOMEM;
-        }
-    }
-    if (err == 1) {
-        error("%ld: format error\n", linen);
-        free_color_arr(autarr);
-        return 0;
-    }
-
-    /* write resulting image */
-    err = writeimage(name, autarr);
-    if (err != 0) {
-        free_color_arr(autarr);
-        return err;
-    }
+    int added;
 
-    fprintf(stderr, "wrote list to %s file\n", IMGNAME);
-    free_color_arr(autarr);
+    STATS_ENTER(STATS_DEDUP);
+    added = colorset_add(set, c);
+    if (added == COLORSET_ERR_NOMEM || (added == 1 && palette_append(pal, c) != 0))
+        return ERR_NOMEM;
     return 0;
 }
 
-void free_color_arr(AutoArray *autarr)
+/* Reads a color list, or a binary palette file (see palfile.h), from in
+ * and writes the image. The colors of a palette file that says they're
+ * unique are used as they are, straight from in.
+ * returns non-zero for any important error */
+int process(const MemBuf *in, const char *name)
 {
-    Color *tmp;
-    for (size_t i = 0; i < AUTOARR_SIZE(autarr); i++) {
-        tmp = (Color *) AUTOARR_GET(autarr, i);
-        free(tmp);
+    size_t linen = 0, i;
+    int err = 0;
+    Color c;
+    Palette pal = PALETTE_INIT;
+    ColorSet set = COLORSET_INIT;
+    PalFile pf;
+    const char *p = (const char *) in->data, *end = p + in->len;
+
+    if (palfile_check(in->data, in->len)) {
+        err = palfile_parse(&pf, in->data, in->len);
+        if (err == PALFILE_ERR_NOMEM)
+            return ERR_NOMEM;
+        if (err != 0) {
+            error("%s\n", err == PALFILE_ERR_VERSION ? "unsupported palette file version"
+                                                      : "malformed palette file");
+            return 0;
+        }
+        if (pf.flags & PALFILE_UNIQUE) {
+            STATS_ADD(STATS_COLORS, pf.len);
+            STATS_ENTER(STATS_OUTPUT);
+            err = writeimage(name, pf.colors, pf.len);
+        } else {
+            for (i = 0; i < pf.len && err == 0; i++)
+                err = addcolor(&pal, &set, pf.colors[i]);
+            STATS_ADD(STATS_COLORS, pal.len);
+            STATS_ENTER(STATS_OUTPUT);
+            if (err == 0)
+                err = writeimage(name, pal.colors, pal.len);
+        }
+        palfile_free(&pf);
+    } else {
+        /* read file and get color */
+        while (err = colorio_readcolor_mem(&p, end, &c, &linen), err == 0)
+            if (addcolor(&pal, &set, c) != 0) {
+                err = ERR_NOMEM;
+                break;
+            }
+        STATS_ADD(STATS_COLORS, pal.len);
+        if (err == 1) {
+            error("%zu: format error\n", linen);
+            err = 0;
+            goto cleanup;
+        }
+
+        /* write resulting image */
+        STATS_ENTER(STATS_OUTPUT);
+        err = err == ERR_NOMEM ? err : writeimage(name, pal.colors, pal.len);
     }
-    autoarr_free(autarr);
+    if (err == 0)
+        fprintf(stderr, "wrote list to %s file\n", IMGNAME);
+
+cleanup:
+    palette_free(&pal);
+    colorset_free(&set);
+    STATS_ENTER(STATS_OTHER);
+    return err;
 }
 
 void die(int err)
 {
     switch (err) {
-    case 1: error("can't open %s for writing\n", IMGNAME); break;
-    case 2: error("out of memory\n"); break;
-    case 3: error("libpng error\n"); break;
+    case ERR_FILE:   error("can't open %s for writing\n", IMGNAME); break;
+    case ERR_NOMEM:  error("out of memory\n"); break;
+    case ERR_LIBPNG: error("libpng error\n"); break;
     }
     // remember: exit flushes and closes all open files
     exit(1);
 }
 
-int main(int argc, char **argv)
+void usage(const char *progname)
 {
-    FILE *infile = NULL;
-    int err = 0;
+    fprintf(stderr, "Usage: %s [--stats[=text|json]] [LIST FILE|PALETTE FILE]\n", progname);
+}
 
+int main(int argc, char **argv)
+{
+    MemBuf infile;
+    const char *fname;
+    int err = 0, opt, mode;
+    const char *progname = *argv;
+    static const struct option longopts[] = {
+        { "stats", optional_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while (opt = getopt_long(argc, argv, "", longopts, NULL), opt != -1) {
+        switch (opt) {
+        case 's':
+            mode = stats_parse_mode(optarg);
+            if (mode == -1) {
+                error("invalid stats format: %s\n", optarg);
+                return 1;
+            }
+            stats_start(mode);
+            break;
+        default:
+            usage(progname);
+            return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
     if (argc > 2) {
-        fprintf(stderr, "Usage: %s [LIST FILE]\n", *argv);
+        usage(progname);
         return 1;
     }
 
-    if (argc == 1) {
-        err = process(stdin, IMGNAME);
-        if (err != 0)
-            die(err);
-    } else {
-        while (++argv, --argc > 0) {
-            infile = fopen(*argv, "r");
-            if (!infile) {
-                error("%s: no such file or directory", argv[1]);
-                return 1;
-            }
-            err = process(infile, IMGNAME);
-            if (err != 0)
-                die(err);
-            fclose(infile);
-        }
+    /* no file: read from stdin */
+    fname = argc == 2 ? argv[1] : "-";
+    err = membuf_open(&infile, fname);
+    if (err == MEMBUF_ERR_NOMEM)
+        die(ERR_NOMEM);
+    if (err != 0) {
+        error("%s: no such file or directory\n", fname);
+        return 1;
     }
+    err = process(&infile, IMGNAME);
+    membuf_close(&infile);
+    if (err != 0)
+        die(err);
+    stats_print(stderr);
     return 0;
 }
 
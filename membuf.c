@@ -0,0 +1,146 @@
+/* *******************************************************************
+ *                          membuf.c
+ * Whole files in memory: mapped, or read into a buffer.
+ *
+ * *******************************************************************/
+
+#include "membuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "stats.h"
+
+#define INIT_SIZ (64 * 1024)
+
+static int read_stream(MemBuf *buf, FILE *f, size_t cap);
+
+/* Opens fname and makes its content available in buf. "-" means stdin.
+ * Returns MEMBUF_ERR_OPEN, MEMBUF_ERR_READ, MEMBUF_ERR_NOMEM. */
+int membuf_open(MemBuf *buf, const char *fname)
+{
+    FILE *f;
+    int err;
+
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+    if (strcmp(fname, "-") == 0)
+        return membuf_read(buf, stdin);
+
+#ifndef _WIN32
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+
+    if (fd == -1)
+        return MEMBUF_ERR_OPEN;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+#ifdef MADV_SEQUENTIAL
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+#endif
+            buf->data = p;
+            buf->len = st.st_size;
+            STATS_ADD(STATS_BYTES_READ, buf->len);
+            return 0;
+        }
+    }
+    /* not a regular file or mmap failed: read it normally */
+    f = fdopen(fd, "rb");
+    if (!f) {
+        close(fd);
+        return MEMBUF_ERR_OPEN;
+    }
+#else
+    f = fopen(fname, "rb");
+    if (!f)
+        return MEMBUF_ERR_OPEN;
+#endif
+    err = membuf_read(buf, f);
+    fclose(f);
+    return err;
+}
+
+/* Like membuf_open, but never maps the file: what's in buf stays valid
+ * whatever happens to the file afterwards. Regular files are read in one
+ * go into a buffer of their size.
+ * Returns MEMBUF_ERR_OPEN, MEMBUF_ERR_READ, MEMBUF_ERR_NOMEM. */
+int membuf_load(MemBuf *buf, const char *fname)
+{
+    size_t cap = INIT_SIZ;
+    FILE *f;
+    int err;
+
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+    if (strcmp(fname, "-") == 0)
+        return membuf_read(buf, stdin);
+    f = fopen(fname, "rb");
+    if (!f)
+        return MEMBUF_ERR_OPEN;
+#ifndef _WIN32
+    struct stat st;
+
+    /* one more byte, so that the first read already sees the end */
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+     && (uint64_t) st.st_size < SIZE_MAX)
+        cap = st.st_size + 1;
+#endif
+    err = read_stream(buf, f, cap);
+    fclose(f);
+    return err;
+}
+
+/* Reads f until end of file into a growing buffer. */
+int membuf_read(MemBuf *buf, FILE *f)
+{
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+    return read_stream(buf, f, INIT_SIZ);
+}
+
+/* Reads f into buf, which is empty, starting with cap bytes. */
+static int read_stream(MemBuf *buf, FILE *f, size_t cap)
+{
+    unsigned char *tmp;
+    size_t n;
+
+    do {
+        if (buf->len == buf->cap) {
+            buf->cap = buf->cap ? buf->cap * 2 : cap;
+            tmp = realloc(buf->data, buf->cap);
+            if (!tmp) {
+                membuf_close(buf);
+                return MEMBUF_ERR_NOMEM;
+            }
+            buf->data = tmp;
+        }
+        n = fread(buf->data + buf->len, 1, buf->cap - buf->len, f);
+        buf->len += n;
+    } while (n != 0);
+    if (ferror(f)) {
+        membuf_close(buf);
+        return MEMBUF_ERR_READ;
+    }
+    STATS_ADD(STATS_BYTES_READ, buf->len);
+    return 0;
+}
+
+void membuf_close(MemBuf *buf)
+{
+#ifndef _WIN32
+    if (buf->data && buf->cap == 0)
+        munmap(buf->data, buf->len);
+    else
+#endif
+        free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
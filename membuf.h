@@ -0,0 +1,38 @@
+/* *******************************************************************
+ *                          membuf.h
+ * The whole content of a file in memory, read-only.
+ * membuf_open maps regular files with mmap, so nothing is copied;
+ * anything else (pipes, terminals, or systems without mmap) is read into
+ * a buffer that grows as needed.
+ * A mapping is only safe while nobody truncates the file: touching a page
+ * past the new end raises SIGBUS, which kills the process. That's fine
+ * for a tool that reads its arguments once. Anything long-lived, or
+ * reading files that may be rewritten in place (a library, a server, a
+ * watcher), must use membuf_load, which always reads into a buffer.
+ *
+ * *******************************************************************/
+
+#ifndef MEMBUF_H_INCLUDED
+#define MEMBUF_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+
+typedef struct _membuf {
+    unsigned char *data;
+    size_t len;
+    size_t cap;     /* 0 if data is mapped */
+} MemBuf;
+
+enum {
+    MEMBUF_ERR_OPEN = 1,
+    MEMBUF_ERR_READ,
+    MEMBUF_ERR_NOMEM,
+};
+
+int     membuf_open(MemBuf *buf, const char *fname);
+int     membuf_load(MemBuf *buf, const char *fname);
+int     membuf_read(MemBuf *buf, FILE *f);
+void    membuf_close(MemBuf *buf);
+
+#endif
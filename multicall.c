@@ -0,0 +1,452 @@
+/* *****************************************************************
+ *                      multicall.c
+ * palutils: the common jobs of getpal, getcolorvals and makepal in a
+ * single binary, as stages that can be chained in one process:
+ *
+ *     palutils extract sprite.png : sort luma : make palette.png
+ *
+ * does what "getpal --sort=luma sprite.png | makepal" does, but the
+ * colors go from one stage to the next as an array of Color, with no
+ * printing, parsing or second process. Stages are separated by a ":"
+ * on its own. Stages that find colors (extract, scan, read) add the
+ * ones that aren't there yet, in the order they're found; the others
+ * work on what's there. If the last stage doesn't write the colors
+ * anywhere, they're printed.
+ * When the binary is called through a link named after a stage (say,
+ * "extract"), the arguments are that stage's.
+ *
+ * *****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "color.h"
+#include "colorio.h"
+#include "colorscan.h"
+#include "colorset.h"
+#include "colorsort.h"
+#include "colormerge.h"
+#include "palette.h"
+#include "palfile.h"
+#include "palutils.h"
+#include "membuf.h"
+
+#define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
+#define IMGNAME "palette.png"
+
+/* what goes from stage to stage */
+typedef struct {
+    Palette pal;
+    ColorSet set;
+    int setvalid;       /* set has the colors of pal; not after a merge */
+    uint32_t *counts;   /* after a merge, one for each color of pal */
+    size_t countcap;
+    PalUtils *ctx;
+    int written;        /* the last stage wrote the colors out */
+} Chain;
+
+typedef struct {
+    const char *name;
+    int (*run)(Chain *ch, int argc, char **argv);
+    const char *args;
+} Stage;
+
+int addcolor(Chain *ch, Color c);
+int addpalfile(Chain *ch, const MemBuf *in, const char *fname);
+int extract(Chain *ch, int argc, char **argv);
+int scan(Chain *ch, int argc, char **argv);
+int readlists(Chain *ch, int argc, char **argv);
+int sortcolors(Chain *ch, int argc, char **argv);
+int merge(Chain *ch, int argc, char **argv);
+int make(Chain *ch, int argc, char **argv);
+int print(Chain *ch, int argc, char **argv);
+const Stage *findstage(const char *name);
+void usage(const char *progname);
+
+static const Stage stages[] = {
+    { "extract", extract,    "IMAGES...            colors of images (PNG, PPM/PAM, QOI, BMP)" },
+    { "scan",    scan,       "FILES...             colors written in text, in any notation" },
+    { "read",    readlists,  "FILES...             color lists, one per line, or palette files" },
+    { "sort",    sortcolors, "KEY                  sort the colors" },
+    { "merge",   merge,      "DE [--space=SPACE]   merge colors closer than DE" },
+    { "make",    make,       "[IMAGE]              write a palette image, " IMGNAME " by default" },
+    { "print",   print,      "[--binary]           print the colors, or write a palette file" },
+};
+
+/* Adds c, unless it's already there. Returns 1 for memory error. */
+int addcolor(Chain *ch, Color c)
+{
+    uint32_t *tmp;
+    int added;
+
+    /* a merge leaves colors out of the set: start it again */
+    if (!ch->setvalid) {
+        colorset_clear(&ch->set);
+        for (size_t i = 0; i < ch->pal.len; i++)
+            if (colorset_add(&ch->set, ch->pal.colors[i]) == COLORSET_ERR_NOMEM)
+                return 1;
+        ch->setvalid = 1;
+    }
+    added = colorset_add(&ch->set, c);
+    if (added != 1)
+        return added == COLORSET_ERR_NOMEM;
+    if (palette_append(&ch->pal, c) != 0)
+        return 1;
+    if (ch->counts) {
+        if (ch->pal.len > ch->countcap) {
+            tmp = realloc(ch->counts, ch->pal.cap * sizeof(uint32_t));
+            if (!tmp)
+                return 1;
+            ch->counts = tmp;
+            ch->countcap = ch->pal.cap;
+        }
+        ch->counts[ch->pal.len - 1] = 1;
+    }
+    return 0;
+}
+
+/* Adds the colors of the palette file in in. Returns 1 for memory
+ * error, 2 for a bad file. */
+int addpalfile(Chain *ch, const MemBuf *in, const char *fname)
+{
+    PalFile pf;
+    int err;
+
+    err = palfile_parse(&pf, in->data, in->len);
+    if (err == PALFILE_ERR_NOMEM)
+        return 1;
+    if (err != 0) {
+        error("%s: %s\n", fname, err == PALFILE_ERR_VERSION ? "unsupported palette file version"
+                                                           : "malformed palette file");
+        return 2;
+    }
+    for (size_t i = 0; i < pf.len && err == 0; i++)
+        err = addcolor(ch, pf.colors[i]);
+    palfile_free(&pf);
+    return err;
+}
+
+/* The stages that read files go through all of them, and fail at the
+ * end if any one couldn't be read; out of memory stops them right
+ * away. */
+int extract(Chain *ch, int argc, char **argv)
+{
+    const Color *colors;
+    size_t n;
+    int err, failed = 0;
+
+    if (argc < 2) {
+        error("extract: no images\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        err = palutils_extract_file(ch->ctx, argv[i]);
+        if (err == PALUTILS_ERR_NOMEM) {
+            error("out of memory\n");
+            return 1;
+        }
+        if (err != 0) {
+            error("%s: %s\n", argv[i], palutils_strerror(err));
+            failed = 1;
+            continue;
+        }
+        colors = palutils_colors(ch->ctx, &n);
+        for (size_t j = 0; j < n; j++)
+            if (addcolor(ch, colors[j]) != 0) {
+                error("out of memory\n");
+                return 1;
+            }
+    }
+    return failed;
+}
+
+int scan(Chain *ch, int argc, char **argv)
+{
+    MemBuf in;
+    const char *p, *end;
+    Color c;
+    int err, failed = 0;
+
+    if (argc < 2) {
+        error("scan: no files\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        err = membuf_open(&in, argv[i]);
+        if (err != 0) {
+            error("%s: %s\n", argv[i], err == MEMBUF_ERR_NOMEM ? "out of memory" : "can't read file");
+            if (err == MEMBUF_ERR_NOMEM)
+                return 1;
+            failed = 1;
+            continue;
+        }
+        if (palfile_check(in.data, in.len))
+            err = addpalfile(ch, &in, argv[i]);
+        else {
+            p = (const char *) in.data;
+            end = p + in.len;
+            while (err == 0 && colorscan_next(&p, end, &c) != EOF)
+                err = addcolor(ch, c);
+        }
+        membuf_close(&in);
+        if (err == 1) {
+            error("out of memory\n");
+            return 1;
+        }
+        if (err)
+            failed = 1;
+    }
+    return failed;
+}
+
+int readlists(Chain *ch, int argc, char **argv)
+{
+    MemBuf in;
+    const char *p, *end;
+    size_t line;
+    Color c;
+    int err, failed = 0;
+
+    if (argc < 2) {
+        error("read: no files\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        err = membuf_open(&in, argv[i]);
+        if (err != 0) {
+            error("%s: %s\n", argv[i], err == MEMBUF_ERR_NOMEM ? "out of memory" : "can't read file");
+            if (err == MEMBUF_ERR_NOMEM)
+                return 1;
+            failed = 1;
+            continue;
+        }
+        if (palfile_check(in.data, in.len))
+            err = addpalfile(ch, &in, argv[i]);
+        else {
+            p = (const char *) in.data;
+            end = p + in.len;
+            line = 0;
+            while (err = colorio_readcolor_mem(&p, end, &c, &line), err == 0)
+                if (addcolor(ch, c) != 0) {
+                    err = 3;
+                    break;
+                }
+            if (err == 1) {
+                error("%s:%zu: format error\n", argv[i], line);
+                err = 2;
+            } else
+                err = err == 3;
+        }
+        membuf_close(&in);
+        if (err == 1) {
+            error("out of memory\n");
+            return 1;
+        }
+        if (err)
+            failed = 1;
+    }
+    return failed;
+}
+
+static int compare_value(const void *a, const void *b)
+{
+    uint32_t x = *(const uint64_t *) a >> 32, y = *(const uint64_t *) b >> 32;
+
+    return (x > y) - (x < y);
+}
+
+/* After a merge, counts are carried along: each one is paired with its
+ * color before sorting and found again by value after. */
+int sortcolors(Chain *ch, int argc, char **argv)
+{
+    uint64_t *pairs = NULL, key, *found;
+    size_t i, n = ch->pal.len;
+    int sortkey;
+
+    if (argc != 2 || (sortkey = colorsort_parse_key(argv[1])) == -1) {
+        error("sort: expected one of value, red, green, blue, alpha, luma, hue, lightness\n");
+        return 1;
+    }
+    if (ch->counts) {
+        pairs = malloc((n ? n : 1) * sizeof(uint64_t));
+        if (!pairs) {
+            error("out of memory\n");
+            return 1;
+        }
+        for (i = 0; i < n; i++)
+            pairs[i] = (uint64_t) ch->pal.colors[i].value << 32 | ch->counts[i];
+        qsort(pairs, n, sizeof(uint64_t), compare_value);
+    }
+    if (colorsort_sort(ch->pal.colors, n, sortkey) != 0) {
+        free(pairs);
+        error("out of memory\n");
+        return 1;
+    }
+    for (i = 0; pairs && i < n; i++) {
+        key = (uint64_t) ch->pal.colors[i].value << 32;
+        found = bsearch(&key, pairs, n, sizeof(uint64_t), compare_value);
+        /* colorsort_sort only moves colors around: every one is there */
+        ch->counts[i] = found ? (uint32_t) *found : 1;
+    }
+    free(pairs);
+    return 0;
+}
+
+int merge(Chain *ch, int argc, char **argv)
+{
+    static const struct option longopts[] = {
+        { "space", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt, space = COLORMERGE_OKLAB;
+    uint32_t *counts;
+    double de;
+    char *end;
+
+    while (opt = getopt_long(argc, argv, "", longopts, NULL), opt != -1) {
+        if (opt != 's' || (space = colormerge_parse_space(optarg)) == -1) {
+            error("merge: expected --space=oklab or --space=lab\n");
+            return 1;
+        }
+    }
+    if (argc - optind != 1 || (de = strtod(argv[optind], &end), *end != '\0' || de <= 0)) {
+        error("merge: expected a delta E greater than 0\n");
+        return 1;
+    }
+    /* before the first merge, each color stands for itself; after, the
+     * counts of earlier merges add up */
+    if (!ch->counts || ch->pal.cap > ch->countcap) {
+        counts = realloc(ch->counts, (ch->pal.cap ? ch->pal.cap : 1) * sizeof(uint32_t));
+        if (!counts) {
+            error("out of memory\n");
+            return 1;
+        }
+        if (!ch->counts)
+            for (size_t i = 0; i < ch->pal.len; i++)
+                counts[i] = 1;
+        ch->counts = counts;
+        ch->countcap = ch->pal.cap;
+    }
+    if (ch->pal.len > 0
+     && colormerge_merge(ch->pal.colors, ch->counts, &ch->pal.len, de, space) != 0) {
+        error("out of memory\n");
+        return 1;
+    }
+    ch->setvalid = 0;
+    return 0;
+}
+
+int make(Chain *ch, int argc, char **argv)
+{
+    const char *fname = argc > 1 ? argv[1] : IMGNAME;
+    int err;
+
+    if (argc > 2) {
+        error("make: expected one image name at most\n");
+        return 1;
+    }
+    if (ch->pal.len == 0) {
+        error("make: no colors\n");
+        return 1;
+    }
+    err = palutils_write_png(ch->ctx, ch->pal.colors, ch->pal.len, fname);
+    if (err != 0) {
+        error("%s: %s\n", fname, palutils_strerror(err));
+        return 1;
+    }
+    ch->written = 1;
+    return 0;
+}
+
+int print(Chain *ch, int argc, char **argv)
+{
+    int binary = argc == 2 && strcmp(argv[1], "--binary") == 0;
+
+    if (argc > 2 || (argc == 2 && !binary)) {
+        error("print: expected --binary or nothing\n");
+        return 1;
+    }
+    if (binary) {
+        if (palfile_write(stdout, ch->pal.colors, ch->counts, ch->pal.len, PALFILE_UNIQUE) != 0) {
+            error("can't write palette file\n");
+            return 1;
+        }
+    } else {
+        for (size_t i = 0; i < ch->pal.len; i++) {
+            if (ch->counts)
+                printf("%08X %lu\n", ch->pal.colors[i].value, (unsigned long) ch->counts[i]);
+            else
+                printf("%08X\n", ch->pal.colors[i].value);
+        }
+    }
+    ch->written = 1;
+    return 0;
+}
+
+const Stage *findstage(const char *name)
+{
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++)
+        if (strcmp(stages[i].name, name) == 0)
+            return &stages[i];
+    return NULL;
+}
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s STAGE [ARGS...] [: STAGE [ARGS...]]...\n"
+                    "Stages:\n", progname);
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++)
+        fprintf(stderr, "    %-8s %s\n", stages[i].name, stages[i].args);
+    fprintf(stderr, "KEY is one of value, red, green, blue, alpha, luma, hue, lightness\n"
+                    "SPACE is one of oklab, lab\n");
+}
+
+int main(int argc, char **argv)
+{
+    Chain ch = { PALETTE_INIT, COLORSET_INIT, 1, NULL, 0, NULL, 0 };
+    const char *progname = *argv, *base = strrchr(*argv, '/');
+    const Stage *stage;
+    int first, last, err = 0;
+
+    /* called as a stage: the arguments start right away */
+    base = base ? base + 1 : *argv;
+    first = findstage(base) ? 0 : 1;
+    if (argc - first < 1 || (first == 1 && strcmp(argv[1], "--help") == 0)) {
+        usage(progname);
+        return 1;
+    }
+    if (first == 0)
+        argv[0] = (char *) base;
+    ch.ctx = palutils_new();
+    if (!ch.ctx) {
+        error("out of memory\n");
+        return 1;
+    }
+
+    while (first < argc && err == 0) {
+        for (last = first; last < argc && strcmp(argv[last], ":") != 0; last++)
+            ;
+        stage = first < last ? findstage(argv[first]) : NULL;
+        if (!stage) {
+            if (first < last)
+                error("unknown stage: %s\n", argv[first]);
+            usage(progname);
+            err = 1;
+            break;
+        }
+        /* every stage parses its arguments from the start */
+        optind = 0;
+        ch.written = 0;
+        err = stage->run(&ch, last - first, argv + first);
+        first = last + 1;
+    }
+    if (err == 0 && !ch.written)
+        err = print(&ch, 1, NULL);
+
+    palutils_free(ch.ctx);
+    palette_free(&ch.pal);
+    colorset_free(&ch.set);
+    free(ch.counts);
+    return err;
+}
@@ -0,0 +1,133 @@
+/* generated by scangen from the rules in scangen.c: don't edit */
+
+#define SCAN_NSTATES 87
+#define SCAN_NCLASSES 18
+#define SCAN_DEAD 0
+#define SCAN_START 1
+
+enum {
+    SCAN_HASH = 1,
+    SCAN_HEX0X = 2,
+    SCAN_RGB = 3,
+    SCAN_WORD = 4,
+    SCAN_OTHER = 5,
+};
+
+static const unsigned char scan_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 0, 0, 2, 0, 3, 0, 0, 4, 5, 0, 0, 6, 0, 7, 8,
+    9, 10, 10, 10, 10, 10, 10, 10, 10, 10, 0, 0, 0, 0, 0, 0,
+    0, 11, 12, 13, 13, 13, 13, 14, 15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 16, 15, 15, 15, 15, 15, 17, 15, 15, 0, 0, 0, 0, 15,
+    0, 11, 12, 13, 13, 13, 13, 14, 15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 16, 15, 15, 15, 15, 15, 17, 15, 15, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static const unsigned char scan_next[SCAN_NSTATES][SCAN_NCLASSES] = {
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 2, 2, 3, 2, 2, 2, 2, 2, 2, 4, 5, 5, 5, 5, 5, 5, 6, 5 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, 8, 10 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 11, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 12, 12, 12, 12, 12, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, 8, 8 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 13, 13, 13, 13, 13, 13, 13, 13, 13 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 14, 14, 14, 14, 14, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 8, 8, 8, 15, 8, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 16, 16, 16, 16, 16, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 13, 13, 13, 13, 13, 13, 13, 13, 13 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 17, 17, 17, 17, 17, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 18, 0, 0, 0, 0, 8, 8, 19, 8, 8, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 20, 20, 20, 20, 20, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 21, 21, 21, 21, 21, 8, 8, 8, 8 },
+    { 0, 22, 0, 0, 0, 0, 0, 23, 0, 24, 24, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 9, 0, 18, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 25, 25, 25, 25, 25, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 26, 26, 26, 26, 26, 8, 8, 8, 8 },
+    { 0, 22, 0, 0, 0, 0, 0, 23, 0, 24, 24, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 27, 27, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 28, 0, 29, 0, 0, 30, 31, 0, 24, 24, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 32, 32, 32, 32, 32, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 33, 33, 33, 33, 33, 8, 8, 8, 8 },
+    { 0, 28, 0, 29, 0, 0, 30, 0, 0, 27, 27, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 28, 0, 0, 0, 0, 30, 34, 0, 35, 35, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 28, 0, 0, 0, 0, 30, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 36, 0, 0, 0, 0, 0, 37, 0, 38, 38, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 28, 0, 29, 0, 0, 30, 0, 0, 39, 39, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 40, 40, 40, 40, 40, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 41, 41, 41, 41, 41, 8, 8, 8, 8 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 42, 42, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 43, 0, 44, 0, 0, 0, 45, 0, 35, 35, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 36, 0, 0, 0, 0, 0, 37, 0, 38, 38, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 46, 46, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 47, 0, 48, 0, 0, 49, 50, 0, 38, 38, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 28, 0, 29, 0, 0, 30, 0, 0, 39, 39, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 51, 51, 51, 51, 51, 8, 8, 8, 8 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, 8, 8 },
+    { 0, 43, 0, 44, 0, 0, 0, 0, 0, 42, 42, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 43, 0, 0, 0, 0, 0, 52, 0, 53, 53, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 43, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 43, 0, 44, 0, 0, 0, 0, 0, 54, 54, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 47, 0, 48, 0, 0, 49, 0, 0, 46, 46, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 47, 0, 0, 0, 0, 49, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 47, 0, 0, 0, 0, 49, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 55, 0, 0, 0, 0, 0, 56, 0, 57, 57, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 47, 0, 48, 0, 0, 49, 0, 0, 58, 58, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 9, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, 8, 8 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 59, 59, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 60, 0, 61, 0, 62, 0, 63, 64, 53, 53, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 43, 0, 44, 0, 0, 0, 0, 0, 54, 54, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 55, 0, 0, 0, 0, 0, 56, 0, 57, 57, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 65, 65, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 66, 0, 67, 0, 62, 68, 69, 0, 57, 57, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 47, 0, 48, 0, 0, 49, 0, 0, 58, 58, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 60, 0, 61, 0, 62, 0, 0, 64, 59, 59, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 60, 0, 0, 0, 62, 0, 0, 64, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 60, 0, 0, 0, 62, 0, 0, 64, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 60, 0, 61, 0, 62, 0, 0, 64, 70, 70, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 71, 0, 0, 0, 0, 0, 72, 0, 73, 73, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 66, 0, 67, 0, 62, 68, 0, 0, 65, 65, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 66, 0, 0, 0, 62, 68, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 66, 0, 0, 0, 62, 68, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 74, 0, 0, 0, 0, 0, 75, 0, 76, 76, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 66, 0, 67, 0, 62, 68, 0, 0, 77, 77, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 60, 0, 61, 0, 62, 0, 0, 64, 70, 70, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 71, 0, 0, 0, 0, 0, 72, 0, 73, 73, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 78, 78, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 80, 0, 62, 0, 81, 0, 73, 73, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 74, 0, 0, 0, 0, 0, 75, 0, 76, 76, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 82, 82, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 83, 0, 62, 0, 84, 0, 76, 76, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 66, 0, 67, 0, 62, 68, 0, 0, 77, 77, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 80, 0, 62, 0, 0, 0, 78, 78, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 0, 0, 62, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 0, 0, 62, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 80, 0, 62, 0, 0, 0, 85, 85, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 83, 0, 62, 0, 0, 0, 82, 82, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 0, 0, 62, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 83, 0, 62, 0, 0, 0, 86, 86, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 80, 0, 62, 0, 0, 0, 85, 85, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 79, 0, 83, 0, 62, 0, 0, 0, 86, 86, 0, 0, 0, 0, 0, 0, 0 },
+};
+
+/* the rule a state accepts, 0 if none */
+static const unsigned char scan_rule[SCAN_NSTATES] = {
+    0, 0, 5, 5, 4, 4, 4, 4, 4, 0, 4, 4, 4, 4, 4, 4,
+    1, 4, 0, 4, 1, 4, 0, 0, 0, 4, 4, 0, 0, 0, 0, 0,
+    1, 4, 0, 0, 0, 0, 0, 0, 4, 2, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0,
+};
@@ -0,0 +1,247 @@
+/* *****************************************************************
+ *                      palconv.c
+ * Converts palettes between the text format (one color per line, as
+ * getpal prints and makepal reads) and the binary palette format
+ * described in palfile.h. By default, the input is converted to the
+ * other format. In text, counts go after the color:
+ * 0CFA2E25 1234
+ *
+ * *****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+#include "color.h"
+#include "colorset.h"
+#include "palette.h"
+#include "palfile.h"
+#include "membuf.h"
+
+#define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
+
+enum {
+    FMT_TEXT,
+    FMT_BINARY,
+};
+
+typedef struct {
+    Palette pal;
+    uint32_t *counts;
+    size_t countcap;
+} Counted;
+
+int readtext(const MemBuf *in, Counted *out, int *hascounts);
+int writetext(FILE *f, const Color *colors, const uint32_t *counts, size_t n);
+int unique(const Color *colors, size_t n);
+void usage(const char *progname);
+
+/* Reads a text palette into out. Either every line has a count or none
+ * has. Returns 1 for memory errors and the (1-based) number of the bad
+ * line + 1 for format errors. */
+int readtext(const MemBuf *in, Counted *out, int *hascounts)
+{
+    const char *p = (const char *) in->data, *end = p + in->len, *nl, *sp;
+    char colstr[16], *cend;
+    unsigned long count;
+    size_t line = 0, len;
+    Color c;
+    uint32_t *tmp;
+
+    *hascounts = -1;
+    for ( ; p < end; p = nl ? nl + 1 : end) {
+        line++;
+        nl = memchr(p, '\n', end - p);
+        len = (nl ? nl : end) - p;
+        if (len > 0 && p[len-1] == '\r')
+            len--;
+        for (sp = p; sp < p + len && !isspace(*sp); sp++)
+            ;
+        if ((size_t) (sp - p) >= sizeof(colstr))
+            return line + 1;
+        memcpy(colstr, p, sp - p);
+        colstr[sp - p] = '\0';
+        if (color_strtocolor(colstr, &c) != 0)
+            return line + 1;
+
+        /* optional count */
+        while (sp < p + len && isspace(*sp))
+            sp++;
+        if (*hascounts == -1)
+            *hascounts = sp < p + len;
+        if (*hascounts != (sp < p + len))
+            return line + 1;
+        if (*hascounts) {
+            count = strtoul(sp, &cend, 10);
+            if (cend != p + len || !isdigit(*sp))
+                return line + 1;
+            if (out->pal.len == out->countcap) {
+                out->countcap = out->countcap ? out->countcap * 2 : 256;
+                tmp = realloc(out->counts, out->countcap * sizeof(uint32_t));
+                if (!tmp)
+                    return 1;
+                out->counts = tmp;
+            }
+            out->counts[out->pal.len] = count > UINT32_MAX ? UINT32_MAX : count;
+        }
+        if (palette_append(&out->pal, c) != 0)
+            return 1;
+    }
+    if (*hascounts == -1)
+        *hascounts = 0;
+    return 0;
+}
+
+int writetext(FILE *f, const Color *colors, const uint32_t *counts, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (counts)
+            fprintf(f, "%08X %lu\n", colors[i].value, (unsigned long) counts[i]);
+        else
+            fprintf(f, "%08X\n", colors[i].value);
+    }
+    return ferror(f) ? 1 : 0;
+}
+
+/* Returns 1 if no color in colors appears twice, 0 if one does, -1 for
+ * memory errors. */
+int unique(const Color *colors, size_t n)
+{
+    ColorSet set = COLORSET_INIT;
+    int ret = 1, added;
+
+    for (size_t i = 0; i < n && ret == 1; i++) {
+        added = colorset_add(&set, colors[i]);
+        if (added == COLORSET_ERR_NOMEM)
+            ret = -1;
+        else if (added == 0)
+            ret = 0;
+    }
+    colorset_free(&set);
+    return ret;
+}
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [--to=text|binary] [INPUT|- [OUTPUT]]\n", progname);
+}
+
+int main(int argc, char **argv)
+{
+    MemBuf in;
+    PalFile pf;
+    Counted text = { PALETTE_INIT, NULL, 0 };
+    const Color *colors;
+    const uint32_t *counts;
+    size_t n;
+    int opt, err, from, to = -1, hascounts, uniq;
+    const char *progname = *argv, *inname = "-", *outname = NULL;
+    FILE *out = stdout;
+    static const struct option longopts[] = {
+        { "to", required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while (opt = getopt_long(argc, argv, "", longopts, NULL), opt != -1) {
+        switch (opt) {
+        case 't':
+            if (strcmp(optarg, "text") == 0)
+                to = FMT_TEXT;
+            else if (strcmp(optarg, "binary") == 0)
+                to = FMT_BINARY;
+            else {
+                error("unknown format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(progname);
+            return 1;
+        }
+    }
+    if (argc - optind > 2) {
+        usage(progname);
+        return 1;
+    }
+    if (argc - optind >= 1)
+        inname = argv[optind];
+    if (argc - optind == 2)
+        outname = argv[optind + 1];
+
+    err = membuf_open(&in, inname);
+    if (err == MEMBUF_ERR_NOMEM) {
+        error("out of memory\n");
+        return 1;
+    } else if (err != 0) {
+        error("couldn't open %s\n", inname);
+        return 1;
+    }
+
+    /* read */
+    from = palfile_check(in.data, in.len) ? FMT_BINARY : FMT_TEXT;
+    if (from == FMT_BINARY) {
+        err = palfile_parse(&pf, in.data, in.len);
+        if (err != 0) {
+            error("%s: %s\n", inname, err == PALFILE_ERR_NOMEM   ? "out of memory"
+                                    : err == PALFILE_ERR_VERSION ? "unsupported version"
+                                                                 : "malformed palette file");
+            membuf_close(&in);
+            return 1;
+        }
+        colors = pf.colors;
+        counts = pf.counts;
+        n = pf.len;
+        uniq = pf.flags & PALFILE_UNIQUE;
+    } else {
+        err = readtext(&in, &text, &hascounts);
+        if (err != 0) {
+            if (err == 1)
+                error("out of memory\n");
+            else
+                error("%s:%d: malformed line\n", inname, err - 1);
+            membuf_close(&in);
+            return 1;
+        }
+        colors = text.pal.colors;
+        counts = hascounts ? text.counts : NULL;
+        n = text.pal.len;
+        uniq = -1;
+    }
+
+    /* write */
+    if (to == -1)
+        to = from == FMT_TEXT ? FMT_BINARY : FMT_TEXT;
+    if (outname) {
+        out = fopen(outname, to == FMT_BINARY ? "wb" : "w");
+        if (!out) {
+            error("can't open %s for writing\n", outname);
+            err = 1;
+            goto cleanup;
+        }
+    }
+    if (to == FMT_TEXT)
+        err = writetext(out, colors, counts, n);
+    else {
+        if (uniq == -1)
+            uniq = unique(colors, n);
+        if (uniq == -1) {
+            error("out of memory\n");
+            err = 1;
+            goto cleanup;
+        }
+        err = palfile_write(out, colors, counts, n, uniq ? PALFILE_UNIQUE : 0);
+    }
+    if (out != stdout && fclose(out) != 0)
+        err = 1;
+    if (err != 0)
+        error("can't write %s\n", outname ? outname : "to stdout");
+
+cleanup:
+    if (from == FMT_BINARY)
+        palfile_free(&pf);
+    palette_free(&text.pal);
+    free(text.counts);
+    membuf_close(&in);
+    return err != 0;
+}
@@ -0,0 +1,262 @@
+/* *******************************************************************
+ *                          palette.c
+ * Palette extraction from decoded images, and set operations on
+ * sorted palettes.
+ *
+ * *******************************************************************/
+
+#include "palette.h"
+
+#include <stdlib.h>
+#include "stats.h"
+
+#define INIT_CAP 256
+
+/* Makes room for at least n colors in pal. */
+static int palette_reserve(Palette *pal, size_t n)
+{
+    size_t newcap = pal->cap ? pal->cap : INIT_CAP;
+    Color *tmp;
+
+    if (n <= pal->cap)
+        return 0;
+    while (newcap < n)
+        newcap *= 2;
+    tmp = realloc(pal->colors, newcap * sizeof(Color));
+    if (!tmp)
+        return PALETTE_ERR_NOMEM;
+    pal->colors = tmp;
+    pal->cap = newcap;
+    return 0;
+}
+
+/* Adds c at the end of pal, growing it if needed. */
+int palette_append(Palette *pal, Color c)
+{
+    if (pal->len == pal->cap && palette_reserve(pal, pal->len + 1) != 0)
+        return PALETTE_ERR_NOMEM;
+    pal->colors[pal->len++] = c;
+    return 0;
+}
+
+/* Adds the colors of n pixels at data which aren't in set yet, to both
+ * set and pal. data is 8-bit RGB (ch = 3) or RGBA (ch = 4). Only every
+ * step-th pixel is looked at, starting from the first one: a step of 1
+ * adds them all.
+ * Returns PALETTE_ERR_NOMEM. */
+int palette_add_pixels(Palette *pal, ColorSet *set, const unsigned char *data, size_t n, int ch,
+                       size_t step)
+{
+    const unsigned char *p;
+    Color col;
+    int added;
+
+    /* The image data is composed of bytes representing every pixel in the image.
+     * The pixels in turn are represented of red, green and blue values. If there are
+     * 4 channels, there's an alpha value too and must be taken in consideration. */
+    STATS_ADD(STATS_PIXELS, (n + step - 1) / step);
+    col.alpha = 0xFF;
+    for (size_t i = 0; i < n; i += step) {     /* read data and get color values */
+        p = data + i * ch;
+        col.red = p[0];
+        col.green = p[1];
+        col.blue = p[2];
+        if (ch == 4)
+            col.alpha = p[3];
+        added = colorset_add(set, col);
+        if (added == 0)
+            continue;
+        if (added == COLORSET_ERR_NOMEM || palette_append(pal, col) != 0)
+            return PALETTE_ERR_NOMEM;
+    }
+    return 0;
+}
+
+/* Adds c to set and pal if key, which stands for it, isn't in set's
+ * small table yet. */
+static inline int add_small(Palette *pal, ColorSet *set, uint32_t key, Color c)
+{
+    int added = colorset_add_small(set, key);
+
+    if (added == 0)
+        return 0;
+    if (added == COLORSET_ERR_NOMEM || palette_append(pal, c) != 0)
+        return PALETTE_ERR_NOMEM;
+    return 0;
+}
+
+/* Packed gray of 1, 2 or 4 bits, all the pixels of the row. Few byte
+ * values ever show up, so the small table first tells whether a whole
+ * byte was seen before (as key 256 + the byte; levels are keys 0-255),
+ * and only new bytes are split into pixels. The last byte may be only
+ * partly pixels. */
+static int add_gray_packed(Palette *pal, ColorSet *set, const unsigned char *row, size_t n,
+                           int depth)
+{
+    /* what a sample is multiplied by to make it 8-bit, as libpng does */
+    static const unsigned char scale[5] = { 0, 0xFF, 0x55, 0, 0x11 };
+    unsigned mask = (1u << depth) - 1, per = 8 / depth, level;
+    size_t full = n / per, i, j;
+    Color col;
+    int added;
+
+    col.alpha = 0xFF;
+    for (i = 0; i <= full; i++) {
+        if (i < full) {
+            added = colorset_add_small(set, 256 + row[i]);
+            if (added == COLORSET_ERR_NOMEM)
+                return PALETTE_ERR_NOMEM;
+            if (added == 0)
+                continue;
+        }
+        for (j = 0; j < per && i * per + j < n; j++) {
+            level = (row[i] >> (8 - depth * (j + 1)) & mask) * scale[depth];
+            col.red = col.green = col.blue = level;
+            if (add_small(pal, set, level, col) != 0)
+                return PALETTE_ERR_NOMEM;
+        }
+    }
+    return 0;
+}
+
+/* Like palette_add_pixels, but for rows in any of the formats pngimage
+ * leaves alone when asked to (see pngimage.h): ch is 1 (gray), 2 (gray
+ * and alpha), 3 or 4, and depth is the bits per sample, 8 or 16, or 1,
+ * 2 or 4 for gray. 16-bit samples are cut to their high byte, as libpng
+ * would. Gray and gray+alpha pixels are looked up in the set's small
+ * table, by level or by level and alpha, and only the ones that weren't
+ * there become a Color.
+ * Returns PALETTE_ERR_NOMEM. */
+int palette_add_row(Palette *pal, ColorSet *set, const unsigned char *row, size_t n, int ch,
+                    int depth, size_t step)
+{
+    size_t bytes = depth / 8, i;
+    const unsigned char *p;
+    Color col;
+    int added;
+
+    if (depth == 8 && ch >= 3)
+        return palette_add_pixels(pal, set, row, n, ch, step);
+    STATS_ADD(STATS_PIXELS, (n + step - 1) / step);
+    if (depth < 8 && step == 1)
+        return add_gray_packed(pal, set, row, n, depth);
+    col.alpha = 0xFF;
+    if (depth < 8) {
+        for (i = 0; i < n; i += step) {
+            p = row + i * depth / 8;
+            col.red = (*p >> (8 - depth - i * depth % 8) & ((1u << depth) - 1))
+                    * (depth == 1 ? 0xFF : depth == 2 ? 0x55 : 0x11);
+            col.green = col.blue = col.red;
+            if (add_small(pal, set, col.red, col) != 0)
+                return PALETTE_ERR_NOMEM;
+        }
+        return 0;
+    }
+    if (ch >= 3) {
+        for (i = 0; i < n; i += step) {
+            p = row + i * ch * 2;
+            col.red = p[0];
+            col.green = p[2];
+            col.blue = p[4];
+            if (ch == 4)
+                col.alpha = p[6];
+            added = colorset_add(set, col);
+            if (added == 0)
+                continue;
+            if (added == COLORSET_ERR_NOMEM || palette_append(pal, col) != 0)
+                return PALETTE_ERR_NOMEM;
+        }
+        return 0;
+    }
+    for (i = 0; i < n; i += step) {
+        p = row + i * ch * bytes;
+        if (ch == 2)
+            col.alpha = p[bytes];
+        col.red = col.green = col.blue = p[0];
+        if (add_small(pal, set, (uint32_t) p[0] << 8 | col.alpha, col) != 0)
+            return PALETTE_ERR_NOMEM;
+    }
+    return 0;
+}
+
+/* Fills pal with every unique color in img, in the order they're first
+ * found. img can have rows in any format palette_add_row reads, as
+ * returned by pngimage.
+ * set is used for deduplication; it's cleared first, and at the end it
+ * holds the same colors as pal (gray images in its small table). Neither
+ * is shrunk, so passing the same
+ * ones image after image doesn't allocate anything once they're big
+ * enough.
+ * Returns PALETTE_ERR_BADPARAM, PALETTE_ERR_NOMEM. */
+int palette_from_image(Palette *pal, const Image *img, ColorSet *set)
+{
+    if (!pal || !img || !set || !img->data || img->ch < 1 || img->ch > 4
+     || (img->depth != 8 && img->depth != 16 && (img->ch != 1 || img->depth > 4)))
+        return PALETTE_ERR_BADPARAM;
+    pal->len = 0;
+    colorset_clear(set);
+    if (img->depth == 8 && img->ch >= 3) {
+        /* no padding between rows: it's all one run of pixels */
+        if (palette_add_pixels(pal, set, img->data, (size_t) img->w * img->h, img->ch, 1) != 0)
+            return PALETTE_ERR_NOMEM;
+    } else {
+        for (uint32_t y = 0; y < img->h; y++)
+            if (palette_add_row(pal, set, img->data + (size_t) y * img->rowbytes, img->w, img->ch,
+                                img->depth, 1) != 0)
+                return PALETTE_ERR_NOMEM;
+    }
+    STATS_ADD(STATS_COLORS, pal->len);
+    return 0;
+}
+
+/* Puts in dst the union, intersection or difference (op is one of
+ * PALETTE_UNION, PALETTE_INTERSECTION, PALETTE_DIFFERENCE) of a and b,
+ * which must be sorted by value without duplicates; so is dst. It's a
+ * single linear merge, so it costs a->len + b->len. dst can't be a or b.
+ * Returns PALETTE_ERR_BADPARAM, PALETTE_ERR_NOMEM. */
+int palette_combine(Palette *dst, const Palette *a, const Palette *b, int op)
+{
+    size_t i = 0, j = 0, n = 0;
+    Color *out;
+
+    if (!dst || !a || !b || dst == a || dst == b
+     || op < PALETTE_UNION || op > PALETTE_DIFFERENCE)
+        return PALETTE_ERR_BADPARAM;
+    if (palette_reserve(dst, op == PALETTE_UNION ? a->len + b->len : a->len) != 0)
+        return PALETTE_ERR_NOMEM;
+    out = dst->colors;
+    while (i < a->len && j < b->len) {
+        uint32_t x = a->colors[i].value, y = b->colors[j].value;
+
+        if (x < y) {
+            if (op != PALETTE_INTERSECTION)
+                out[n++] = a->colors[i];
+            i++;
+        } else if (x > y) {
+            if (op == PALETTE_UNION)
+                out[n++] = b->colors[j];
+            j++;
+        } else {
+            if (op != PALETTE_DIFFERENCE)
+                out[n++] = a->colors[i];
+            i++;
+            j++;
+        }
+    }
+    /* whatever is left of a or b */
+    if (op != PALETTE_INTERSECTION)
+        for ( ; i < a->len; i++)
+            out[n++] = a->colors[i];
+    if (op == PALETTE_UNION)
+        for ( ; j < b->len; j++)
+            out[n++] = b->colors[j];
+    dst->len = n;
+    return 0;
+}
+
+void palette_free(Palette *pal)
+{
+    free(pal->colors);
+    pal->colors = NULL;
+    pal->len = pal->cap = 0;
+}
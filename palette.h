@@ -0,0 +1,47 @@
+/* *******************************************************************
+ *                          palette.h
+ * Palettes: lists of unique colors, extracted from decoded images.
+ * A Palette can be reused: its array is kept and only grown when an
+ * image needs more room than the last one.
+ * Palettes sorted by value (see colorsort.h) can be combined with set
+ * operations.
+ *
+ * *******************************************************************/
+
+#ifndef PALETTE_H_INCLUDED
+#define PALETTE_H_INCLUDED
+
+#include <stddef.h>
+#include "color.h"
+#include "colorset.h"
+#include "pngimage.h"
+
+typedef struct _palette {
+    Color *colors;
+    size_t len;
+    size_t cap;
+} Palette;
+
+enum {
+    PALETTE_ERR_BADPARAM = 1,
+    PALETTE_ERR_NOMEM,
+};
+
+enum {
+    PALETTE_UNION,
+    PALETTE_INTERSECTION,
+    PALETTE_DIFFERENCE,
+};
+
+#define PALETTE_INIT { NULL, 0, 0 }
+
+int     palette_append(Palette *pal, Color c);
+int     palette_add_pixels(Palette *pal, ColorSet *set, const unsigned char *data,
+                           size_t n, int ch, size_t step);
+int     palette_add_row(Palette *pal, ColorSet *set, const unsigned char *row, size_t n, int ch,
+                        int depth, size_t step);
+int     palette_from_image(Palette *pal, const Image *img, ColorSet *set);
+int     palette_combine(Palette *dst, const Palette *a, const Palette *b, int op);
+void    palette_free(Palette *pal);
+
+#endif
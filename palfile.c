@@ -0,0 +1,121 @@
+/* *******************************************************************
+ *                          palfile.c
+ * Reading and writing binary palette files.
+ *
+ * *******************************************************************/
+
+#include "palfile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WRITE_CHUNK 4096
+
+static int little_endian(void)
+{
+    const uint32_t one = 1;
+    return *(const unsigned char *) &one == 1;
+}
+
+static uint32_t get_le16(const unsigned char *p) { return p[0] | p[1] << 8; }
+static uint32_t get_le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24; }
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* Returns 1 if buf starts like a palette file. */
+int palfile_check(const unsigned char *buf, size_t len)
+{
+    return len >= 4 && memcmp(buf, PALFILE_MAGIC, 4) == 0;
+}
+
+/* Reads the palette file in buf, which must stay around for as long as
+ * pf is used. Nothing is copied, except on big-endian machines.
+ * Returns PALFILE_ERR_FORMAT, PALFILE_ERR_VERSION, PALFILE_ERR_NOMEM. */
+int palfile_parse(PalFile *pf, const unsigned char *buf, size_t len)
+{
+    size_t n, hsize, arrays, i;
+    uint32_t *copy;
+
+    pf->copy = NULL;
+    if (len < PALFILE_HEADER_SIZE || !palfile_check(buf, len))
+        return PALFILE_ERR_FORMAT;
+    if (get_le16(buf + 4) != PALFILE_VERSION)
+        return PALFILE_ERR_VERSION;
+    pf->flags = get_le16(buf + 6);
+    n = get_le32(buf + 8);
+    hsize = get_le32(buf + 12);
+    arrays = pf->flags & PALFILE_COUNTS ? 2 : 1;
+    if (hsize < PALFILE_HEADER_SIZE || hsize % 4 != 0 || hsize > len
+     || (len - hsize) / 4 / arrays < n)
+        return PALFILE_ERR_FORMAT;
+
+    pf->len = n;
+    pf->colors = (const Color *) (buf + hsize);
+    pf->counts = pf->flags & PALFILE_COUNTS ? (const uint32_t *) (buf + hsize) + n : NULL;
+    if (little_endian())
+        return 0;
+
+    copy = malloc(n * arrays * sizeof(uint32_t));
+    if (!copy && n != 0)
+        return PALFILE_ERR_NOMEM;
+    for (i = 0; i < n * arrays; i++)
+        copy[i] = get_le32(buf + hsize + i*4);
+    pf->copy = copy;
+    pf->colors = (const Color *) copy;
+    pf->counts = pf->flags & PALFILE_COUNTS ? copy + n : NULL;
+    return 0;
+}
+
+void palfile_free(PalFile *pf)
+{
+    free(pf->copy);
+    pf->copy = NULL;
+}
+
+/* Writes n colors, and their counts if counts isn't NULL, as a palette
+ * file. flags can have PALFILE_UNIQUE; PALFILE_COUNTS is set from counts.
+ * Returns PALFILE_ERR_FORMAT (more than 2^32-1 colors), PALFILE_ERR_WRITE. */
+int palfile_write(FILE *f, const Color *colors, const uint32_t *counts, size_t n,
+                  unsigned flags)
+{
+    unsigned char hdr[PALFILE_HEADER_SIZE], chunk[WRITE_CHUNK];
+    const uint32_t *arr;
+    size_t i, j, len;
+    int a;
+
+    if (n > UINT32_MAX)
+        return PALFILE_ERR_FORMAT;
+    flags = counts ? flags | PALFILE_COUNTS : flags & ~PALFILE_COUNTS;
+    memcpy(hdr, PALFILE_MAGIC, 4);
+    hdr[4] = PALFILE_VERSION;
+    hdr[5] = 0;
+    hdr[6] = flags;
+    hdr[7] = flags >> 8;
+    put_le32(hdr + 8, n);
+    put_le32(hdr + 12, PALFILE_HEADER_SIZE);
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+        return PALFILE_ERR_WRITE;
+
+    for (a = 0; a < (counts ? 2 : 1); a++) {
+        arr = a == 0 ? (const uint32_t *) colors : counts;
+        if (little_endian()) {
+            if (fwrite(arr, sizeof(uint32_t), n, f) != n)
+                return PALFILE_ERR_WRITE;
+            continue;
+        }
+        for (i = 0; i < n; i += len) {
+            len = n - i < WRITE_CHUNK / 4 ? n - i : WRITE_CHUNK / 4;
+            for (j = 0; j < len; j++)
+                put_le32(chunk + j*4, arr[i + j]);
+            if (fwrite(chunk, 4, len, f) != len)
+                return PALFILE_ERR_WRITE;
+        }
+    }
+    return 0;
+}
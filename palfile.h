@@ -0,0 +1,61 @@
+/* *******************************************************************
+ *                          palfile.h
+ * A binary palette format, to pass palettes between the tools without
+ * printing and parsing hex. All numbers are little-endian.
+ *
+ *   offset  size
+ *   0       4      magic, "PALU"
+ *   4       2      version, 1
+ *   6       2      flags, PALFILE_*
+ *   8       4      number of colors, n
+ *   12      4      size of the header, 16: the colors start here
+ *   16      4n     colors, as the 32-bit value of Color
+ *   16+4n   4n     if PALFILE_COUNTS: how many pixels had each color,
+ *                  or how many colors it stands for (getpal --merge),
+ *                  stopping at 0xFFFFFFFF
+ *
+ * Colors are 4-byte aligned in the file, so a mapped palette file can
+ * be used in place on little-endian machines: palfile_parse only checks
+ * the header and points into the buffer.
+ *
+ * *******************************************************************/
+
+#ifndef PALFILE_H_INCLUDED
+#define PALFILE_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+#define PALFILE_MAGIC "PALU"
+#define PALFILE_VERSION 1
+#define PALFILE_HEADER_SIZE 16
+
+enum {
+    PALFILE_COUNTS = 1 << 0,    /* there's a count for every color */
+    PALFILE_UNIQUE = 1 << 1,    /* no color appears twice */
+};
+
+enum {
+    PALFILE_ERR_FORMAT = 1,
+    PALFILE_ERR_VERSION,
+    PALFILE_ERR_NOMEM,
+    PALFILE_ERR_WRITE,
+};
+
+typedef struct _palfile {
+    const Color *colors;
+    const uint32_t *counts;     /* NULL without PALFILE_COUNTS */
+    size_t len;
+    unsigned flags;
+    void *copy;                 /* byte swapped data, on big-endian machines */
+} PalFile;
+
+int     palfile_check(const unsigned char *buf, size_t len);
+int     palfile_parse(PalFile *pf, const unsigned char *buf, size_t len);
+void    palfile_free(PalFile *pf);
+int     palfile_write(FILE *f, const Color *colors, const uint32_t *counts, size_t n,
+                      unsigned flags);
+
+#endif
@@ -0,0 +1,228 @@
+/* *****************************************************************
+ *                      palindex.c
+ * Converts truecolor PNGs with at most 256 colors to indexed PNGs, in
+ * place (see indexer.h). Arguments can be files or directories, which
+ * are searched for *.png files, subdirectories included. Files are
+ * converted in parallel, and those that wouldn't get any smaller are
+ * left untouched.
+ * For each file, prints what was done with it; at the end, prints on
+ * stderr how many files were converted and how many bytes were saved.
+ *
+ * *****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "indexer.h"
+
+#define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
+#define MAXTHREADS 64
+
+typedef struct {
+    char **paths;
+    size_t len, cap;
+} FileList;
+
+typedef struct {
+    const FileList *files;
+    IndexerResult *res;
+    int *err;
+    size_t next;
+    pthread_mutex_t lock;
+} Job;
+
+int addfile(FileList *list, const char *path);
+int adddir(FileList *list, const char *path);
+void *worker(void *arg);
+void usage(const char *progname);
+
+/* Returns 1 for memory error. */
+int addfile(FileList *list, const char *path)
+{
+    char **tmp;
+
+    if (list->len == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 64;
+        tmp = realloc(list->paths, list->cap * sizeof(char *));
+        if (!tmp)
+            return 1;
+        list->paths = tmp;
+    }
+    list->paths[list->len] = strdup(path);
+    return list->paths[list->len++] == NULL;
+}
+
+/* Adds every *.png under the directory path. Symbolic links to
+ * directories aren't followed. Returns 1 for memory error. */
+int adddir(FileList *list, const char *path)
+{
+    DIR *dir = opendir(path);
+    struct dirent *ent;
+    struct stat st;
+    char *sub;
+    size_t len;
+    int err = 0;
+
+    if (!dir) {
+        error("can't open directory %s\n", path);
+        return 0;
+    }
+    while (err == 0 && (ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        sub = malloc(strlen(path) + strlen(ent->d_name) + 2);
+        if (!sub) {
+            err = 1;
+            break;
+        }
+        sprintf(sub, "%s/%s", path, ent->d_name);
+        len = strlen(ent->d_name);
+        if (lstat(sub, &st) == 0 && S_ISDIR(st.st_mode))
+            err = adddir(list, sub);
+        else if (len > 4 && strcasecmp(ent->d_name + len - 4, ".png") == 0
+              && stat(sub, &st) == 0 && S_ISREG(st.st_mode))
+            err = addfile(list, sub);
+        free(sub);
+    }
+    closedir(dir);
+    return err;
+}
+
+void *worker(void *arg)
+{
+    Job *job = arg;
+    Indexer ix;
+    size_t i;
+
+    indexer_init(&ix);
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->files->len)
+            break;
+        job->err[i] = indexer_convert(&ix, job->files->paths[i], &job->res[i]);
+    }
+    indexer_free(&ix);
+    return NULL;
+}
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [--threads=N] files or directories...\n", progname);
+}
+
+int main(int argc, char **argv)
+{
+    FileList files = { NULL, 0, 0 };
+    Job job;
+    pthread_t threads[MAXTHREADS];
+    struct stat st;
+    const char *progname = *argv, *path;
+    long nthreads = 0;
+    int opt, i, started = 0, retval = 0;
+    size_t f, converted = 0;
+    unsigned long long saved = 0;
+    static const struct option longopts[] = {
+        { "threads", required_argument, NULL, 'j' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while (opt = getopt_long(argc, argv, "", longopts, NULL), opt != -1) {
+        switch (opt) {
+        case 'j':
+            nthreads = atoi(optarg);
+            if (nthreads < 1) {
+                error("invalid number of threads: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(progname);
+            return 1;
+        }
+    }
+    if (optind == argc) {
+        usage(progname);
+        return 1;
+    }
+
+    for (i = optind; i < argc; i++) {
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode) ? adddir(&files, argv[i])
+                                                           : addfile(&files, argv[i])) {
+            error("out of memory\n");
+            return 1;
+        }
+    }
+
+    job.files = &files;
+    job.res = malloc((files.len ? files.len : 1) * sizeof(IndexerResult));
+    job.err = malloc((files.len ? files.len : 1) * sizeof(int));
+    job.next = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    if (!job.res || !job.err) {
+        error("out of memory\n");
+        return 1;
+    }
+    if (nthreads == 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    if (nthreads > MAXTHREADS)
+        nthreads = MAXTHREADS;
+    if ((size_t) nthreads > files.len)
+        nthreads = files.len;
+    /* the main thread is a worker too */
+    for (i = 1; i < nthreads; i++)
+        if (pthread_create(&threads[started], NULL, worker, &job) == 0)
+            started++;
+    worker(&job);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (f = 0; f < files.len; f++) {
+        path = files.paths[f];
+        switch (job.err[f]) {
+        case 0:
+            break;
+        case INDEXER_ERR_NOMEM:   error("%s: out of memory\n", path); retval = 1; continue;
+        case INDEXER_ERR_OPEN:    error("couldn't open %s\n", path); retval = 1; continue;
+        case INDEXER_ERR_NOTPNG:  error("%s: not a PNG file\n", path); retval = 1; continue;
+        case INDEXER_ERR_BADDATA: error("%s: malformed PNG\n", path); retval = 1; continue;
+        default:                  error("%s: can't write file, left as it was\n", path);
+                                  retval = 1; continue;
+        }
+        switch (job.res[f].outcome) {
+        case INDEXER_CONVERTED:
+            printf("%s: %zu color%s, %zu -> %zu bytes\n", path, job.res[f].colors,
+                   job.res[f].colors == 1 ? "" : "s", job.res[f].oldsize, job.res[f].newsize);
+            converted++;
+            saved += job.res[f].oldsize - job.res[f].newsize;
+            break;
+        case INDEXER_NOT_SMALLER:
+            printf("%s: %zu color%s, not smaller as indexed\n", path, job.res[f].colors,
+                   job.res[f].colors == 1 ? "" : "s");
+            break;
+        case INDEXER_TOO_MANY_COLORS:
+            printf("%s: more than 256 colors\n", path);
+            break;
+        default:
+            printf("%s: not 8-bit truecolor, skipped\n", path);
+            break;
+        }
+    }
+    fflush(stdout);
+    fprintf(stderr, "%zu of %zu file%s converted, %llu byte%s saved\n", converted, files.len,
+            files.len == 1 ? "" : "s", saved, saved == 1 ? "" : "s");
+
+    for (f = 0; f < files.len; f++)
+        free(files.paths[f]);
+    free(files.paths);
+    free(job.res);
+    free(job.err);
+    return retval;
+}
@@ -0,0 +1,296 @@
+/* *******************************************************************
+ *                          palserver.c
+ * getpal's server mode. Every worker owns a libpalutils context, so the
+ * decode and palette buffers are reused from one request to the next.
+ * In socket mode a pool of workers serves connections concurrently;
+ * requests on the same connection are served in order.
+ *
+ * *******************************************************************/
+
+#include "palserver.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "palutils.h"
+
+#define MAXLINE 4096
+#define QUEUE_SIZ 64
+
+typedef struct {
+    pthread_t thread;
+    PalUtils *ctx;
+    unsigned char *data;    /* inline PNG bytes of DATA requests */
+    size_t cap;
+} Worker;
+
+/* connections accepted but not yet picked up by a worker */
+static struct {
+    int fds[QUEUE_SIZ];
+    size_t head, len;
+    pthread_mutex_t lock;
+    pthread_cond_t notempty, notfull;
+} queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .notempty = PTHREAD_COND_INITIALIZER,
+    .notfull = PTHREAD_COND_INITIALIZER,
+};
+
+static volatile sig_atomic_t stop;
+
+static int worker_init(Worker *w)
+{
+    w->ctx = palutils_new();
+    w->data = NULL;
+    w->cap = 0;
+    return w->ctx == NULL;
+}
+
+static void worker_free(Worker *w)
+{
+    palutils_free(w->ctx);
+    free(w->data);
+}
+
+static void reply(FILE *out, Worker *w, int err)
+{
+    const Color *colors;
+    size_t n;
+
+    if (err != 0) {
+        fprintf(out, "ERR %s\n", palutils_strerror(err));
+        return;
+    }
+    colors = palutils_colors(w->ctx, &n);
+    fprintf(out, "OK %zu\n", n);
+    for (size_t i = 0; i < n; i++)
+        fprintf(out, "%08X\n", colors[i].value);
+}
+
+/* Reads nbytes of inline data into the worker's buffer. */
+static int read_data(FILE *in, Worker *w, size_t nbytes)
+{
+    if (w->cap < nbytes) {
+        unsigned char *tmp = realloc(w->data, nbytes);
+        if (!tmp)
+            return PALUTILS_ERR_NOMEM;
+        w->data = tmp;
+        w->cap = nbytes;
+    }
+    if (fread(w->data, 1, nbytes, in) != nbytes)
+        return PALUTILS_ERR_READ;
+    return 0;
+}
+
+/* Serves requests from in until end of file or QUIT. Returns non-zero
+ * (a PALSERVER_ERR_*) only when the stream can't be used anymore. */
+static int serve(FILE *in, FILE *out, Worker *w)
+{
+    char line[MAXLINE];
+    size_t len;
+    unsigned long long nbytes;
+    int err;
+
+    while (fgets(line, sizeof(line), in)) {
+        len = strlen(line);
+        if (len > 0 && line[len-1] == '\n')
+            line[--len] = '\0';
+        if (len > 0 && line[len-1] == '\r')
+            line[--len] = '\0';
+
+        /* "-" would be the server's own stdin */
+        if (strcmp(line, "FILE -") == 0)
+            fprintf(out, "ERR bad request\n");
+        else if (strncmp(line, "FILE ", 5) == 0)
+            reply(out, w, palutils_extract_file(w->ctx, line + 5));
+        else if (sscanf(line, "DATA %llu", &nbytes) == 1) {
+            /* the data can't be skipped reliably: drop the connection */
+            if (nbytes > PALSERVER_MAXDATA) {
+                fprintf(out, "ERR data too large\n");
+                fflush(out);
+                return PALSERVER_ERR_TOOBIG;
+            }
+            err = read_data(in, w, nbytes);
+            if (err != 0) {
+                fprintf(out, "ERR %s\n", palutils_strerror(err));
+                fflush(out);
+                return err == PALUTILS_ERR_NOMEM ? PALSERVER_ERR_NOMEM : PALSERVER_ERR_IO;
+            }
+            reply(out, w, palutils_extract_mem(w->ctx, w->data, nbytes));
+        } else if (strcmp(line, "QUIT") == 0)
+            break;
+        else if (len > 0)
+            fprintf(out, "ERR bad request\n");
+        if (fflush(out) == EOF)
+            return PALSERVER_ERR_IO;
+    }
+    return ferror(in) ? PALSERVER_ERR_IO : 0;
+}
+
+int palserver_run_stream(FILE *in, FILE *out)
+{
+    Worker w;
+    int err;
+
+    if (worker_init(&w) != 0)
+        return PALSERVER_ERR_NOMEM;
+    err = serve(in, out, &w);
+    worker_free(&w);
+    return err;
+}
+
+static void queue_push(int fd)
+{
+    pthread_mutex_lock(&queue.lock);
+    while (queue.len == QUEUE_SIZ)
+        pthread_cond_wait(&queue.notfull, &queue.lock);
+    queue.fds[(queue.head + queue.len++) % QUEUE_SIZ] = fd;
+    pthread_cond_signal(&queue.notempty);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+static int queue_pop(void)
+{
+    int fd;
+
+    pthread_mutex_lock(&queue.lock);
+    while (queue.len == 0)
+        pthread_cond_wait(&queue.notempty, &queue.lock);
+    fd = queue.fds[queue.head];
+    queue.head = (queue.head + 1) % QUEUE_SIZ;
+    queue.len--;
+    pthread_cond_signal(&queue.notfull);
+    pthread_mutex_unlock(&queue.lock);
+    return fd;
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *w = arg;
+    FILE *in, *out;
+    int fd, fd2;
+
+    /* -1 is queued to stop the worker */
+    while ((fd = queue_pop()) != -1) {
+        fd2 = dup(fd);
+        in = fdopen(fd, "r");
+        out = fd2 != -1 ? fdopen(fd2, "w") : NULL;
+        if (!in || !out) {
+            if (in)
+                fclose(in);
+            else
+                close(fd);
+            if (fd2 != -1 && !out)
+                close(fd2);
+            continue;
+        }
+        serve(in, out, w);
+        fclose(in);
+        fclose(out);
+    }
+    return NULL;
+}
+
+/* Removes path if it is a socket: --serve may name any file, and only a
+ * socket (most likely left by an earlier server) is ours to remove.
+ * Returns non-zero if something else is there. */
+static int remove_socket(const char *path)
+{
+    struct stat st;
+
+    if (lstat(path, &st) == -1)
+        return errno != ENOENT;
+    if (!S_ISSOCK(st.st_mode))
+        return 1;
+    unlink(path);
+    return 0;
+}
+
+static void onsignal(int sig)
+{
+    (void) sig;
+    stop = 1;
+}
+
+/* Listens on the Unix domain socket at path, serving connections with
+ * nthreads workers, until SIGINT or SIGTERM. */
+int palserver_run_socket(const char *path, int nthreads)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    Worker *workers;
+    int sock, fd, i, err = 0;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return PALSERVER_ERR_SOCKET;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (remove_socket(path) != 0)
+        return PALSERVER_ERR_SOCKET;
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1)
+        return PALSERVER_ERR_SOCKET;
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1
+     || listen(sock, SOMAXCONN) == -1) {
+        close(sock);
+        return PALSERVER_ERR_SOCKET;
+    }
+
+    /* a client going away must not kill the server, and accept() must be
+     * interrupted by SIGINT and SIGTERM so that the socket gets removed */
+    signal(SIGPIPE, SIG_IGN);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onsignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    workers = calloc(nthreads, sizeof(Worker));
+    if (!workers) {
+        close(sock);
+        remove_socket(path);
+        return PALSERVER_ERR_NOMEM;
+    }
+    for (i = 0; i < nthreads && err == 0; i++) {
+        if (worker_init(&workers[i]) != 0)
+            err = PALSERVER_ERR_NOMEM;
+        else if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+            err = PALSERVER_ERR_THREAD;
+    }
+    if (err != 0) {
+        /* i workers were initialized, and all but the last one started */
+        for (int j = 0; j < i - 1; j++)
+            queue_push(-1);
+        for (int j = 0; j < i - 1; j++)
+            pthread_join(workers[j].thread, NULL);
+        for (int j = 0; j < i; j++)
+            worker_free(&workers[j]);
+        free(workers);
+        close(sock);
+        remove_socket(path);
+        return err;
+    }
+
+    while (!stop) {
+        fd = accept(sock, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        queue_push(fd);
+    }
+
+    /* workers may be in the middle of a request: just leave, exit() will
+     * take care of them */
+    close(sock);
+    remove_socket(path);
+    return stop ? 0 : PALSERVER_ERR_SOCKET;
+}
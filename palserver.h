@@ -0,0 +1,42 @@
+/* *******************************************************************
+ *                          palserver.h
+ * getpal's server mode: a resident process answering palette requests,
+ * either on a Unix domain socket or on standard input.
+ *
+ * The protocol is line based. Requests:
+ *     FILE <path>          extract the palette of an image file, read
+ *                          (not mapped) so that it may change meanwhile;
+ *                          "-" is refused
+ *     DATA <nbytes>        extract the palette of the nbytes of PNG data
+ *                          that follow the newline; above
+ *                          PALSERVER_MAXDATA bytes the connection is
+ *                          dropped after the reply
+ *     QUIT                 close the connection
+ * Replies:
+ *     OK <count>           followed by count colors, one per line, in the
+ *                          same format getpal prints
+ *     ERR <message>
+ * Replies come in the same order as requests.
+ *
+ * *******************************************************************/
+
+#ifndef PALSERVER_H_INCLUDED
+#define PALSERVER_H_INCLUDED
+
+#include <stdio.h>
+
+/* largest DATA request */
+#define PALSERVER_MAXDATA (256u << 20)
+
+enum {
+    PALSERVER_ERR_NOMEM = 1,
+    PALSERVER_ERR_SOCKET,
+    PALSERVER_ERR_THREAD,
+    PALSERVER_ERR_IO,
+    PALSERVER_ERR_TOOBIG,
+};
+
+int     palserver_run_stream(FILE *in, FILE *out);
+int     palserver_run_socket(const char *path, int nthreads);
+
+#endif
@@ -0,0 +1,259 @@
+/* *****************************************************************
+ *                      palset.c
+ * Set operations on palettes: prints the colors found in any of the
+ * given files (union), in all of them (intersect), or in the first one
+ * and none of the others (diff). Files can be images, in any format
+ * getpal reads, or color lists, like the ones getpal prints; "-" is
+ * standard input.
+ * Every file's palette is sorted by value and combined with linear
+ * merges, so the cost depends on the number of unique colors in each
+ * file, not on the number of files times the size of the result.
+ *
+ * *****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "color.h"
+#include "colorio.h"
+#include "colorset.h"
+#include "colorsort.h"
+#include "palette.h"
+#include "decoder.h"
+#include "membuf.h"
+
+#define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
+#define MAXLEVELS 64
+
+/* Union of any number of sorted palettes, merged the way a binary
+ * counter counts: level i holds the union of 2^i palettes, and two
+ * palettes are only merged when they're on the same level. Every color
+ * goes through a logarithmic number of merges, instead of one per file
+ * like it would when merging every file into a single result. */
+typedef struct {
+    Palette levels[MAXLEVELS];
+    int used[MAXLEVELS];
+    Palette tmp;
+} Merger;
+
+static const char *op_names[] = { "union", "intersect", "diff" };
+
+void merger_init(Merger *m);
+int merger_add(Merger *m, Palette *pal);
+int merger_finish(Merger *m, Palette *out);
+void merger_free(Merger *m);
+void swap(Palette *a, Palette *b);
+int loadcolors(Decoder *dec, const char *fname);
+void usage(const char *progname);
+
+void swap(Palette *a, Palette *b)
+{
+    Palette t = *a;
+    *a = *b;
+    *b = t;
+}
+
+void merger_init(Merger *m)
+{
+    Palette pal = PALETTE_INIT;
+
+    for (int i = 0; i < MAXLEVELS; i++) {
+        m->levels[i] = pal;
+        m->used[i] = 0;
+    }
+    m->tmp = pal;
+}
+
+/* Adds the colors in pal. pal's content is taken over, and in exchange
+ * pal gets an empty palette whose memory can be reused.
+ * Returns PALETTE_ERR_NOMEM. */
+int merger_add(Merger *m, Palette *pal)
+{
+    int i;
+
+    for (i = 0; m->used[i]; i++) {
+        if (palette_combine(&m->tmp, &m->levels[i], pal, PALETTE_UNION) != 0)
+            return PALETTE_ERR_NOMEM;
+        swap(&m->tmp, pal);
+        m->used[i] = 0;
+    }
+    swap(&m->levels[i], pal);
+    m->used[i] = 1;
+    pal->len = 0;
+    return 0;
+}
+
+/* Puts the union of everything added in out. Returns PALETTE_ERR_NOMEM. */
+int merger_finish(Merger *m, Palette *out)
+{
+    out->len = 0;
+    for (int i = 0; i < MAXLEVELS; i++) {
+        if (!m->used[i])
+            continue;
+        if (palette_combine(&m->tmp, &m->levels[i], out, PALETTE_UNION) != 0)
+            return PALETTE_ERR_NOMEM;
+        swap(&m->tmp, out);
+    }
+    return 0;
+}
+
+void merger_free(Merger *m)
+{
+    for (int i = 0; i < MAXLEVELS; i++)
+        palette_free(&m->levels[i]);
+    palette_free(&m->tmp);
+}
+
+/* Reads the unique colors of the image or color list in fname into
+ * dec->pal, sorted by value.
+ * Returns 1 for memory errors and 2 for anything else (after printing
+ * what's wrong). */
+int loadcolors(Decoder *dec, const char *fname)
+{
+    MemBuf in;
+    const char *p, *end;
+    size_t line = 0;
+    int err, added;
+    Color c;
+
+    err = membuf_open(&in, fname);
+    if (err == MEMBUF_ERR_NOMEM)
+        return 1;
+    if (err != 0) {
+        error("couldn't open %s\n", fname);
+        return 2;
+    }
+
+    if (rawimage_sniff(in.data, in.len) != IMAGE_FORMAT_UNKNOWN) {
+        err = decoder_read_mem(dec, in.data, in.len);
+        if (err == 0)
+            err = decoder_palette(dec) != 0 ? IMAGE_ERR_NOMEM : 0;
+        membuf_close(&in);
+        if (err == IMAGE_ERR_NOMEM)
+            return 1;
+        if (err != 0) {
+            error("%s: %s\n", fname, err == IMAGE_ERR_BADDATA ? "malformed or unsupported image"
+                                                              : "libpng error");
+            return 2;
+        }
+    } else {
+        dec->pal.len = 0;
+        colorset_clear(&dec->set);
+        p = (const char *) in.data;
+        end = p + in.len;
+        while (err = colorio_readcolor_mem(&p, end, &c, &line), err == 0) {
+            added = colorset_add(&dec->set, c);
+            if (added == 0)
+                continue;
+            if (added == COLORSET_ERR_NOMEM || palette_append(&dec->pal, c) != 0) {
+                membuf_close(&in);
+                return 1;
+            }
+        }
+        membuf_close(&in);
+        if (err == 1) {
+            error("%s:%zu: not a color (and %s isn't an image)\n", fname, line, fname);
+            return 2;
+        }
+    }
+    return colorsort_sort(dec->pal.colors, dec->pal.len, COLORSORT_VALUE) != 0;
+}
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [--sort=KEY] union|intersect|diff FILE...\n"
+                    "FILE is a PNG image or a list of colors, or - for standard input\n"
+                    "KEY is one of value, red, green, blue, alpha, luma, hue, lightness\n", progname);
+}
+
+int main(int argc, char **argv)
+{
+    int err = 0, opt, op, sortkey = COLORSORT_VALUE, i;
+    const char *progname = *argv;
+    Decoder dec;
+    Merger merger;
+    Palette result = PALETTE_INIT, tmp = PALETTE_INIT;
+    static const struct option longopts[] = {
+        { "sort", required_argument, NULL, 'o' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while (opt = getopt_long(argc, argv, "", longopts, NULL), opt != -1) {
+        switch (opt) {
+        case 'o':
+            sortkey = colorsort_parse_key(optarg);
+            if (sortkey == -1) {
+                error("invalid sort key: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(progname);
+            return 1;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 2) {
+        usage(progname);
+        return 1;
+    }
+    for (op = 0; op < 3 && strcmp(argv[0], op_names[op]) != 0; op++)
+        ;
+    if (op == 3) {
+        error("unknown operation: %s\n", argv[0]);
+        usage(progname);
+        return 1;
+    }
+    /* op_names follows PALETTE_UNION, PALETTE_INTERSECTION, PALETTE_DIFFERENCE */
+    argc--;
+    argv++;
+
+    decoder_init(&dec);
+    merger_init(&merger);
+
+    /* union: everything goes in the merger. intersect: the result only
+     * shrinks, so each merge costs about as much as the file's palette.
+     * diff: the first file minus the union of the others. */
+    err = loadcolors(&dec, argv[0]);
+    if (err == 0 && op == PALETTE_UNION)
+        err = merger_add(&merger, &dec.pal) != 0;
+    else if (err == 0)
+        swap(&result, &dec.pal);
+    for (i = 1; err == 0 && i < argc; i++) {
+        if (op == PALETTE_INTERSECTION && result.len == 0)
+            break;      /* nothing left to intersect */
+        err = loadcolors(&dec, argv[i]);
+        if (err != 0)
+            break;
+        if (op == PALETTE_INTERSECTION) {
+            err = palette_combine(&tmp, &result, &dec.pal, PALETTE_INTERSECTION) != 0;
+            swap(&tmp, &result);
+        } else
+            err = merger_add(&merger, &dec.pal) != 0;
+    }
+    if (err == 0 && op == PALETTE_UNION)
+        err = merger_finish(&merger, &result) != 0;
+    else if (err == 0 && op == PALETTE_DIFFERENCE) {
+        err = merger_finish(&merger, &tmp) != 0;
+        if (err == 0) {
+            swap(&result, &dec.pal);
+            err = palette_combine(&result, &dec.pal, &tmp, PALETTE_DIFFERENCE) != 0;
+        }
+    }
+    if (err == 0 && sortkey != COLORSORT_VALUE)
+        err = colorsort_sort(result.colors, result.len, sortkey) != 0;
+
+    if (err == 1)
+        error("out of memory\n");
+    else if (err == 0)
+        for (size_t j = 0; j < result.len; j++)
+            printf("%08X\n", result.colors[j].value);
+
+    decoder_free(&dec);
+    merger_free(&merger);
+    palette_free(&result);
+    palette_free(&tmp);
+    return err != 0;
+}
@@ -0,0 +1,161 @@
+/* *******************************************************************
+ *                          palutils.c
+ * libpalutils: the in-process interface to palette extraction.
+ *
+ * *******************************************************************/
+
+#include "palutils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "pngimage.h"
+#include "membuf.h"
+#include "decoder.h"
+
+struct _palutils {
+    Decoder dec;
+    unsigned char *rowbuf;  /* pixels for palutils_write_png */
+    size_t rowcap;
+};
+
+static const char *errstrs[] = {
+    "no error",
+    "bad parameter",
+    "out of memory",
+    "couldn't open file",
+    "read error",
+    "write error",
+    "not an image file",
+    "libpng error",
+    "malformed or unsupported image",
+};
+
+static int image_err(int err)
+{
+    switch (err) {
+    case 0:                  return 0;
+    case IMAGE_ERR_BADPARAM: return PALUTILS_ERR_BADPARAM;
+    case IMAGE_ERR_NOMEM:    return PALUTILS_ERR_NOMEM;
+    case IMAGE_ERR_NOTIMAGE: return PALUTILS_ERR_NOTIMAGE;
+    case IMAGE_ERR_BADDATA:  return PALUTILS_ERR_BADDATA;
+    default:                 return PALUTILS_ERR_LIBPNG;
+    }
+}
+
+int palutils_api_version(void)
+{
+    return PALUTILS_API_VERSION;
+}
+
+PalUtils *palutils_new(void)
+{
+    PalUtils *ctx = calloc(1, sizeof(PalUtils));
+
+    if (!ctx)
+        return NULL;
+    decoder_init(&ctx->dec);
+    return ctx;
+}
+
+void palutils_free(PalUtils *ctx)
+{
+    if (!ctx)
+        return;
+    decoder_free(&ctx->dec);
+    free(ctx->rowbuf);
+    free(ctx);
+}
+
+/* Extracts the palette of the image at buf. The result is available
+ * through palutils_colors until the next call on the same context. */
+int palutils_extract_mem(PalUtils *ctx, const void *buf, size_t len)
+{
+    int err;
+
+    if (!ctx || !buf)
+        return PALUTILS_ERR_BADPARAM;
+    err = decoder_read_mem(&ctx->dec, buf, len);
+    if (err != 0)
+        return image_err(err);
+    if (decoder_palette(&ctx->dec) != 0)
+        return PALUTILS_ERR_NOMEM;
+    return 0;
+}
+
+/* The file is read, not mapped: the caller's process mustn't get SIGBUS
+ * because somebody truncated the file meanwhile (see membuf.h). */
+int palutils_extract_file(PalUtils *ctx, const char *fname)
+{
+    MemBuf buf;
+    int err;
+
+    if (!ctx || !fname)
+        return PALUTILS_ERR_BADPARAM;
+    err = membuf_load(&buf, fname);
+    switch (err) {
+    case MEMBUF_ERR_OPEN:  return PALUTILS_ERR_OPEN;
+    case MEMBUF_ERR_READ:  return PALUTILS_ERR_READ;
+    case MEMBUF_ERR_NOMEM: return PALUTILS_ERR_NOMEM;
+    }
+    err = palutils_extract_mem(ctx, buf.data, buf.len);
+    membuf_close(&buf);
+    return err;
+}
+
+/* Returns the colors found by the last extraction. They belong to ctx. */
+const Color *palutils_colors(const PalUtils *ctx, size_t *count)
+{
+    if (!ctx) {
+        if (count)
+            *count = 0;
+        return NULL;
+    }
+    if (count)
+        *count = ctx->dec.pal.len;
+    return ctx->dec.pal.colors;
+}
+
+/* Writes colors as a palette image: one pixel per color, in a single row,
+ * which is what makepal does. */
+int palutils_write_png(PalUtils *ctx, const Color *colors, size_t count, const char *fname)
+{
+    Image img = pngimage_default;
+    FILE *outfile;
+    size_t i;
+    int err;
+
+    if (!ctx || !colors || count == 0 || !fname)
+        return PALUTILS_ERR_BADPARAM;
+    if (ctx->rowcap < count * 4) {
+        unsigned char *tmp = realloc(ctx->rowbuf, count * 4);
+        if (!tmp)
+            return PALUTILS_ERR_NOMEM;
+        ctx->rowbuf = tmp;
+        ctx->rowcap = count * 4;
+    }
+    for (i = 0; i < count; i++) {
+        ctx->rowbuf[i*4 + 0] = colors[i].red;
+        ctx->rowbuf[i*4 + 1] = colors[i].green;
+        ctx->rowbuf[i*4 + 2] = colors[i].blue;
+        ctx->rowbuf[i*4 + 3] = colors[i].alpha;
+    }
+    img.data = ctx->rowbuf;
+    img.w = count;
+    img.h = 1;
+    img.ch = 4;
+
+    outfile = fopen(fname, "wb");
+    if (!outfile)
+        return PALUTILS_ERR_OPEN;
+    err = pngimage_write_image_rgba(&img, outfile);
+    if (fclose(outfile) != 0 && err == 0)
+        return PALUTILS_ERR_WRITE;
+    return image_err(err);
+}
+
+const char *palutils_strerror(int err)
+{
+    if (err < 0 || (size_t) err >= sizeof(errstrs) / sizeof(errstrs[0]))
+        return "unknown error";
+    return errstrs[err];
+}
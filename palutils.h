@@ -0,0 +1,60 @@
+/* *******************************************************************
+ *                          palutils.h
+ * The public interface of libpalutils: palette extraction and palette
+ * images, callable in-process instead of running getpal and makepal.
+ * Besides PNG, images can be PPM/PAM, QOI or uncompressed BMP (since
+ * version 2).
+ *
+ * Every function takes an explicit context. A context is not shared
+ * between threads, but any number of contexts can be used at once, one
+ * per thread. The buffers a context owns are kept between calls, so
+ * reusing one context for many images avoids most allocations.
+ *
+ * This interface is stable: functions are only ever added, and the
+ * layout of Color never changes. PALUTILS_API_VERSION is bumped when
+ * something is added.
+ * The shared library is built with hidden visibility: only what is
+ * declared here is exported.
+ *
+ * *******************************************************************/
+
+#ifndef PALUTILS_H_INCLUDED
+#define PALUTILS_H_INCLUDED
+
+#include <stddef.h>
+#include "color.h"
+
+#define PALUTILS_API_VERSION 2
+
+typedef struct _palutils PalUtils;
+
+enum {
+    PALUTILS_ERR_BADPARAM = 1,
+    PALUTILS_ERR_NOMEM,
+    PALUTILS_ERR_OPEN,
+    PALUTILS_ERR_READ,
+    PALUTILS_ERR_WRITE,
+    PALUTILS_ERR_NOTIMAGE,
+    PALUTILS_ERR_LIBPNG,
+    PALUTILS_ERR_BADDATA,       /* since version 2 */
+};
+
+#if defined(__GNUC__) && !defined(_WIN32)
+#pragma GCC visibility push(default)
+#endif
+
+int          palutils_api_version(void);
+PalUtils    *palutils_new(void);
+void         palutils_free(PalUtils *ctx);
+int          palutils_extract_file(PalUtils *ctx, const char *fname);
+int          palutils_extract_mem(PalUtils *ctx, const void *buf, size_t len);
+const Color *palutils_colors(const PalUtils *ctx, size_t *count);
+int          palutils_write_png(PalUtils *ctx, const Color *colors, size_t count,
+                                const char *fname);
+const char  *palutils_strerror(int err);
+
+#if defined(__GNUC__) && !defined(_WIN32)
+#pragma GCC visibility pop
+#endif
+
+#endif
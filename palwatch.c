@@ -0,0 +1,617 @@
+/* *******************************************************************
+ *                          palwatch.c
+ * getpal's watch mode.
+ *
+ * *******************************************************************/
+
+#include "palwatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "decoder.h"
+#include "membuf.h"
+#include "palette.h"
+#include "colorsort.h"
+
+#define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
+#define EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM)
+
+typedef struct {
+    int wd;
+    char *path;
+    int whole;          /* every file in it is watched, not just some */
+    dev_t dev;
+    ino_t ino;
+} Dir;
+
+typedef struct {
+    char *path;
+    const char *name;   /* the last part of path */
+    int wd;             /* of its directory */
+    int given;          /* named on the command line: complain if it isn't an image */
+    Palette pal;        /* last palette, sorted by value */
+    long long due;      /* when to look at it again, -1 if there's no need */
+} Entry;
+
+/* how many of the files have each color */
+typedef struct {
+    uint64_t *keys;     /* 1 << 32 | color value, 0 if free */
+    uint32_t *counts;
+    size_t len, cap;
+} Counts;
+
+typedef struct {
+    Dir *dirs;
+    size_t ndirs, dircap;
+    Entry *entries;
+    size_t nentries, entcap;
+    int fd, debounce;
+    const char *image;
+    const char *imagename;  /* the last part of image */
+    int imagedir;           /* imagedev and imageino are known */
+    dev_t imagedev;         /* of image's directory */
+    ino_t imageino;
+    Counts counts;
+    int unionchanged;
+    Decoder dec;
+    Palette added, removed, fresh;
+} Watch;
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline size_t count_hash(uint32_t value, size_t mask)
+{
+    return (size_t) ((value * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+/* Moves the counts to a table of cap slots. Returns 1 for memory
+ * error. */
+static int count_resize(Counts *cn, size_t cap)
+{
+    size_t i, j, mask = cap - 1;
+    uint64_t *keys = calloc(cap, sizeof(uint64_t));
+    uint32_t *counts = malloc(cap * sizeof(uint32_t));
+
+    if (!keys || !counts) {
+        free(keys);
+        free(counts);
+        return 1;
+    }
+    for (i = 0; i < cn->cap; i++) {
+        if (cn->keys[i] == 0)
+            continue;
+        for (j = count_hash(cn->keys[i], mask); keys[j] != 0; j = (j + 1) & mask)
+            ;
+        keys[j] = cn->keys[i];
+        counts[j] = cn->counts[i];
+    }
+    free(cn->keys);
+    free(cn->counts);
+    cn->keys = keys;
+    cn->counts = counts;
+    cn->cap = cap;
+    return 0;
+}
+
+/* Empties slot i, moving back the colors after it that would no longer
+ * be found (linear probing has no tombstones). */
+static void count_remove(Counts *cn, size_t i)
+{
+    size_t j, home, mask = cn->cap - 1;
+
+    for (j = (i + 1) & mask; cn->keys[j] != 0; j = (j + 1) & mask) {
+        home = count_hash(cn->keys[j], mask);
+        /* j stays if its home is cyclically in (i, j] */
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        cn->keys[i] = cn->keys[j];
+        cn->counts[i] = cn->counts[j];
+        i = j;
+    }
+    cn->keys[i] = 0;
+    cn->len--;
+}
+
+/* Adds delta (1 or -1) to the count of c. A color whose count goes to 0
+ * is taken out of the table, which shrinks when it's mostly empty, so
+ * that write_image only walks about as many slots as there are colors.
+ * Returns 1 for memory error. */
+static int count_add(Watch *w, Color c, int delta)
+{
+    Counts *cn = &w->counts;
+    uint64_t key = 1ull << 32 | c.value;
+    size_t i, mask;
+
+    if (2 * (cn->len + 1) > cn->cap && count_resize(cn, cn->cap ? cn->cap * 2 : 1024) != 0)
+        return 1;
+    mask = cn->cap - 1;
+    for (i = count_hash(c.value, mask); cn->keys[i] != 0 && cn->keys[i] != key; i = (i + 1) & mask)
+        ;
+    if (cn->keys[i] == 0) {
+        cn->keys[i] = key;
+        cn->counts[i] = 0;
+        cn->len++;
+    }
+    cn->counts[i] += delta;
+    /* the set of colors changes when a count goes from 0 to 1 or back */
+    if (delta > 0 && cn->counts[i] == 1)
+        w->unionchanged = 1;
+    else if (delta < 0 && cn->counts[i] == 0) {
+        w->unionchanged = 1;
+        count_remove(cn, i);
+        /* failing to shrink is harmless */
+        if (cn->cap > 1024 && 8 * cn->len < cn->cap)
+            count_resize(cn, cn->cap / 2);
+    }
+    return 0;
+}
+
+/* Returns the directory watched as wd, or NULL. */
+static Dir *find_dir(Watch *w, int wd)
+{
+    for (size_t i = 0; i < w->ndirs; i++)
+        if (w->dirs[i].wd == wd)
+            return &w->dirs[i];
+    return NULL;
+}
+
+static Entry *find_entry(Watch *w, int wd, const char *name)
+{
+    for (size_t i = 0; i < w->nentries; i++)
+        if (w->entries[i].wd == wd && strcmp(w->entries[i].name, name) == 0)
+            return &w->entries[i];
+    return NULL;
+}
+
+/* Tells if name in d is the palette image or the file it's written to
+ * before being renamed: changing them is what the watch does itself, so
+ * they must not be watched. */
+static int is_image(const Watch *w, const Dir *d, const char *name)
+{
+    size_t len;
+
+    if (!w->imagedir || d->dev != w->imagedev || d->ino != w->imageino)
+        return 0;
+    len = strlen(w->imagename);
+    return strncmp(name, w->imagename, len) == 0
+        && (name[len] == '\0' || strcmp(name + len, ".new") == 0);
+}
+
+/* Starts watching the directory at path, if it isn't already. Returns
+ * it, or NULL for errors (errno says which). */
+static Dir *add_dir(Watch *w, const char *path, int whole)
+{
+    struct stat st;
+    Dir *d, *tmp;
+    int wd = inotify_add_watch(w->fd, path, EVENTS | IN_ONLYDIR);
+
+    if (wd == -1 || stat(path, &st) == -1)
+        return NULL;
+    d = find_dir(w, wd);
+    if (d) {
+        d->whole |= whole;
+        return d;
+    }
+    if (w->ndirs == w->dircap) {
+        w->dircap = w->dircap ? w->dircap * 2 : 16;
+        tmp = realloc(w->dirs, w->dircap * sizeof(Dir));
+        if (!tmp) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        w->dirs = tmp;
+    }
+    d = &w->dirs[w->ndirs];
+    d->path = strdup(path);
+    if (!d->path) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    d->wd = wd;
+    d->whole = whole;
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    w->ndirs++;
+    return d;
+}
+
+/* Adds the file name in d, to be looked at right away. Returns 1 for
+ * memory error. */
+static int add_entry(Watch *w, const Dir *d, const char *name, int given)
+{
+    Entry *e, *tmp;
+
+    if (w->nentries == w->entcap) {
+        w->entcap = w->entcap ? w->entcap * 2 : 64;
+        tmp = realloc(w->entries, w->entcap * sizeof(Entry));
+        if (!tmp)
+            return 1;
+        w->entries = tmp;
+    }
+    e = &w->entries[w->nentries];
+    e->path = malloc(strlen(d->path) + strlen(name) + 2);
+    if (!e->path)
+        return 1;
+    if (strcmp(d->path, ".") == 0)
+        strcpy(e->path, name);
+    else
+        sprintf(e->path, "%s%s%s", d->path, d->path[strlen(d->path) - 1] == '/' ? "" : "/", name);
+    e->name = e->path + strlen(e->path) - strlen(name);
+    e->wd = d->wd;
+    e->given = given;
+    e->pal = (Palette) PALETTE_INIT;
+    e->due = 0;
+    w->nentries++;
+    return 0;
+}
+
+/* Adds the files of the directory d that aren't watched yet. Returns
+ * PALWATCH_ERR_NOMEM, PALWATCH_ERR_PATH. */
+static int scan_dir(Watch *w, Dir *d)
+{
+    struct dirent *ent;
+    DIR *dir = opendir(d->path);
+    int err = 0;
+
+    if (!dir)
+        return errno == ENOMEM ? PALWATCH_ERR_NOMEM : PALWATCH_ERR_PATH;
+    while (err == 0 && (ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.' || ent->d_type == DT_DIR || is_image(w, d, ent->d_name)
+         || find_entry(w, d->wd, ent->d_name))
+            continue;
+        err = add_entry(w, d, ent->d_name, 0);
+    }
+    closedir(dir);
+    return err ? PALWATCH_ERR_NOMEM : 0;
+}
+
+/* Watches what path names: all the files of a directory, or a file in
+ * its directory. Returns PALWATCH_ERR_NOMEM, PALWATCH_ERR_PATH. */
+static int add_path(Watch *w, const char *path)
+{
+    struct stat st;
+    Dir *d;
+    char *copy, *slash;
+    int err = 0;
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        d = add_dir(w, path, 1);
+        if (!d)
+            return errno == ENOMEM ? PALWATCH_ERR_NOMEM : PALWATCH_ERR_PATH;
+        return scan_dir(w, d);
+    }
+
+    copy = strdup(path);
+    if (!copy)
+        return PALWATCH_ERR_NOMEM;
+    slash = strrchr(copy, '/');
+    if (slash == copy)
+        d = add_dir(w, "/", 0);
+    else if (slash) {
+        *slash = '\0';
+        d = add_dir(w, copy, 0);
+    } else
+        d = add_dir(w, ".", 0);
+    if (!d)
+        err = errno == ENOMEM ? PALWATCH_ERR_NOMEM : PALWATCH_ERR_PATH;
+    else if (!find_entry(w, d->wd, slash ? slash + 1 : copy))
+        err = add_entry(w, d, slash ? slash + 1 : copy, 1) ? PALWATCH_ERR_NOMEM : 0;
+    free(copy);
+    return err;
+}
+
+/* Decodes e's file into w->fresh, sorted by value. A file that's gone,
+ * or isn't an image, has no colors. Returns 1 for memory error. */
+static int extract(Watch *w, Entry *e)
+{
+    MemBuf in;
+    int err;
+
+    w->fresh.len = 0;
+    /* read, not mapped: the file may be truncated while it's decoded */
+    err = membuf_load(&in, e->path);
+    if (err == MEMBUF_ERR_NOMEM)
+        return 1;
+    if (err != 0)
+        return 0;
+    err = decoder_read_mem(&w->dec, in.data, in.len);
+    if (err == 0)
+        err = decoder_palette(&w->dec);
+    membuf_close(&in);
+    if (err == IMAGE_ERR_NOMEM || err == PALETTE_ERR_NOMEM)
+        return 1;
+    if (err != 0) {
+        if (e->given)
+            error("%s: %s\n", e->path, err == IMAGE_ERR_NOTIMAGE ? "not an image file"
+                                     : err == IMAGE_ERR_BADDATA  ? "malformed or unsupported image"
+                                                                 : "libpng error");
+        return 0;
+    }
+    for (size_t i = 0; i < w->dec.pal.len; i++)
+        if (palette_append(&w->fresh, w->dec.pal.colors[i]) != 0)
+            return 1;
+    return colorsort_sort(w->fresh.colors, w->fresh.len, COLORSORT_VALUE) != 0;
+}
+
+/* Looks at e's file again and prints what changed. Returns 1 for memory
+ * error. */
+static int update(Watch *w, Entry *e)
+{
+    Palette tmp;
+    size_t i;
+
+    if (extract(w, e) != 0
+     || palette_combine(&w->added, &w->fresh, &e->pal, PALETTE_DIFFERENCE) != 0
+     || palette_combine(&w->removed, &e->pal, &w->fresh, PALETTE_DIFFERENCE) != 0)
+        return 1;
+    for (i = 0; i < w->removed.len; i++)
+        printf("%s -%08X\n", e->path, w->removed.colors[i].value);
+    for (i = 0; i < w->added.len; i++)
+        printf("%s +%08X\n", e->path, w->added.colors[i].value);
+    if (w->image) {
+        for (i = 0; i < w->removed.len; i++)
+            if (count_add(w, w->removed.colors[i], -1) != 0)
+                return 1;
+        for (i = 0; i < w->added.len; i++)
+            if (count_add(w, w->added.colors[i], 1) != 0)
+                return 1;
+    }
+    /* the fresh palette becomes the file's, and its old array is reused */
+    tmp = e->pal;
+    e->pal = w->fresh;
+    w->fresh = tmp;
+    return 0;
+}
+
+/* Writes the palette image of every color some file has, sorted by
+ * value, the way makepal does. The image is written next to the old
+ * one and renamed over it, so readers never see half of it. Returns 1
+ * for memory error. */
+static int write_image(Watch *w)
+{
+    Image img = { .h = 1, .ch = 4 };
+    Counts *cn = &w->counts;
+    Palette all = PALETTE_INIT;
+    char *tmpname;
+    FILE *f;
+    size_t i;
+    int err = 0;
+
+    for (i = 0; i < cn->cap; i++) {
+        if (cn->keys[i] != 0 && cn->counts[i] != 0
+         && palette_append(&all, (Color) { .value = (uint32_t) cn->keys[i] }) != 0) {
+            palette_free(&all);
+            return 1;
+        }
+    }
+    /* there's no image with no pixels: keep the old one */
+    if (all.len == 0)
+        return 0;
+    if (colorsort_sort(all.colors, all.len, COLORSORT_VALUE) != 0) {
+        palette_free(&all);
+        return 1;
+    }
+    img.w = all.len;
+    img.data = malloc(all.len * 4);
+    tmpname = malloc(strlen(w->image) + 5);
+    if (!img.data || !tmpname) {
+        free(img.data);
+        free(tmpname);
+        palette_free(&all);
+        return 1;
+    }
+    for (i = 0; i < all.len; i++) {
+        img.data[i*4 + 0] = all.colors[i].red;
+        img.data[i*4 + 1] = all.colors[i].green;
+        img.data[i*4 + 2] = all.colors[i].blue;
+        img.data[i*4 + 3] = all.colors[i].alpha;
+    }
+    sprintf(tmpname, "%s.new", w->image);
+    f = fopen(tmpname, "wb");
+    if (!f)
+        error("couldn't open %s\n", tmpname);
+    else {
+        err = pngimage_write_image_rgba(&img, f);
+        if (fclose(f) != 0 || err != 0 || rename(tmpname, w->image) != 0) {
+            error("couldn't write %s\n", w->image);
+            remove(tmpname);
+        }
+        err = err == IMAGE_ERR_NOMEM;
+    }
+    free(img.data);
+    free(tmpname);
+    palette_free(&all);
+    return err;
+}
+
+/* Events were lost: looks for new files in the directories watched
+ * whole, and schedules every file to be looked at again, gone ones
+ * included. Returns 1 for memory error. */
+static int rescan(Watch *w, long long due)
+{
+    size_t i;
+
+    for (i = 0; i < w->ndirs; i++)
+        if (w->dirs[i].whole && scan_dir(w, &w->dirs[i]) == PALWATCH_ERR_NOMEM)
+            return 1;
+    for (i = 0; i < w->nentries; i++)
+        w->entries[i].due = due;
+    return 0;
+}
+
+/* Reads the events waiting on the inotify descriptor and schedules the
+ * files they're about. Returns 1 for memory error. */
+static int read_events(Watch *w)
+{
+    char buf[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    long long due = now_ms() + w->debounce;
+    ssize_t n;
+    char *p;
+    Entry *e;
+    Dir *d;
+
+    while (n = read(w->fd, buf, sizeof(buf)), n > 0) {
+        for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *) p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                if (rescan(w, due) != 0)
+                    return 1;
+                continue;
+            }
+            if (ev->len == 0 || ev->name[0] == '.')
+                continue;
+            d = find_dir(w, ev->wd);
+            if (!d || is_image(w, d, ev->name))
+                continue;
+            e = find_entry(w, ev->wd, ev->name);
+            if (!e) {
+                /* a new file, in a directory that's watched whole */
+                if (!d->whole || (ev->mask & IN_ISDIR))
+                    continue;
+                if (add_entry(w, d, ev->name, 0) != 0)
+                    return 1;
+                e = &w->entries[w->nentries - 1];
+            }
+            e->due = due;
+        }
+    }
+    return 0;
+}
+
+/* Looks at the files whose time has come. Returns 1 for memory error;
+ * *next is set to when the next one is due, or -1. */
+static int run_due(Watch *w, long long *next)
+{
+    long long now = now_ms();
+    Entry *e;
+
+    *next = -1;
+    w->unionchanged = 0;
+    for (size_t i = 0; i < w->nentries; i++) {
+        e = &w->entries[i];
+        if (e->due < 0)
+            continue;
+        if (e->due > now) {
+            if (*next < 0 || e->due < *next)
+                *next = e->due;
+            continue;
+        }
+        e->due = -1;
+        if (update(w, e) != 0)
+            return 1;
+    }
+    fflush(stdout);
+    return w->image && w->unionchanged ? write_image(w) : 0;
+}
+
+/* Finds out which directory the palette image is in, so that is_image
+ * can recognize it. A directory that can't be looked at can't be
+ * watched either. */
+static void find_image_dir(Watch *w)
+{
+    struct stat st;
+    const char *slash = strrchr(w->image, '/');
+    char *dir;
+
+    w->imagename = slash ? slash + 1 : w->image;
+    if (!slash)
+        w->imagedir = stat(".", &st) == 0;
+    else if (slash == w->image)
+        w->imagedir = stat("/", &st) == 0;
+    else {
+        dir = strndup(w->image, slash - w->image);
+        w->imagedir = dir && stat(dir, &st) == 0;
+        free(dir);
+    }
+    if (w->imagedir) {
+        w->imagedev = st.st_dev;
+        w->imageino = st.st_ino;
+    }
+}
+
+static void watch_free(Watch *w)
+{
+    for (size_t i = 0; i < w->ndirs; i++)
+        free(w->dirs[i].path);
+    for (size_t i = 0; i < w->nentries; i++) {
+        free(w->entries[i].path);
+        palette_free(&w->entries[i].pal);
+    }
+    free(w->dirs);
+    free(w->entries);
+    free(w->counts.keys);
+    free(w->counts.counts);
+    palette_free(&w->added);
+    palette_free(&w->removed);
+    palette_free(&w->fresh);
+    decoder_free(&w->dec);
+    if (w->fd != -1)
+        close(w->fd);
+}
+
+/* Watches the npaths files and directories in paths until killed,
+ * waiting debounce milliseconds after the last change to a file before
+ * looking at it. If image isn't NULL, the palette image of all the
+ * files is kept there.
+ * Returns PALWATCH_ERR_NOMEM, PALWATCH_ERR_INOTIFY, PALWATCH_ERR_PATH
+ * with *badpath set to the path that can't be watched. */
+int palwatch_run(char **paths, int npaths, int debounce, const char *image,
+                 const char **badpath)
+{
+    Watch w = {
+        .fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC),
+        .debounce = debounce,
+        .image = image,
+        .added = PALETTE_INIT, .removed = PALETTE_INIT, .fresh = PALETTE_INIT,
+    };
+    struct pollfd pfd;
+    long long next;
+    int err = 0, i, timeout;
+
+    decoder_init(&w.dec);
+    if (w.fd == -1) {
+        watch_free(&w);
+        return PALWATCH_ERR_INOTIFY;
+    }
+    if (image)
+        find_image_dir(&w);
+    for (i = 0; i < npaths && err == 0; i++) {
+        err = add_path(&w, paths[i]);
+        if (err == PALWATCH_ERR_PATH)
+            *badpath = paths[i];
+    }
+
+    pfd.fd = w.fd;
+    pfd.events = POLLIN;
+    while (err == 0) {
+        if (run_due(&w, &next) != 0) {
+            err = PALWATCH_ERR_NOMEM;
+            break;
+        }
+        timeout = next < 0 ? -1 : (int) (next - now_ms() > 0 ? next - now_ms() : 0);
+        if (poll(&pfd, 1, timeout) == -1) {
+            if (errno == EINTR)
+                continue;
+            err = PALWATCH_ERR_INOTIFY;
+        } else if ((pfd.revents & POLLIN) && read_events(&w) != 0)
+            err = PALWATCH_ERR_NOMEM;
+    }
+    watch_free(&w);
+    return err;
+}
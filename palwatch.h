@@ -0,0 +1,38 @@
+/* *******************************************************************
+ *                          palwatch.h
+ * getpal's watch mode: keeps the palettes of a set of images up to date
+ * as they're saved, on Linux, through inotify.
+ * The directories of the given files, and the given directories, are
+ * watched; files written, moved in, removed or moved out are looked at
+ * again once they've been quiet for the debounce time, so the many
+ * writes of a single save only cost one decode. The last palette of
+ * every file is kept, and only what changed is printed:
+ *     <path> +<color>      a color the file didn't have before
+ *     <path> -<color>      a color the file doesn't have anymore
+ * with colors in the format getpal prints, sorted by value. On start,
+ * every color of every file is printed as new.
+ * With an image file, the palette image makepal would build from all
+ * the colors of all the files is written there whenever that set of
+ * colors changes, and only then. Each color has a count of the files
+ * that have it, so that a save costs as much as the colors of that
+ * file, not those of all the others.
+ * Nothing runs while nothing changes: the process sleeps in poll().
+ *
+ * *******************************************************************/
+
+#ifndef PALWATCH_H_INCLUDED
+#define PALWATCH_H_INCLUDED
+
+enum {
+    PALWATCH_ERR_NOMEM = 1,
+    PALWATCH_ERR_INOTIFY,
+    PALWATCH_ERR_PATH,
+};
+
+/* in milliseconds */
+#define PALWATCH_DEBOUNCE 5
+
+int     palwatch_run(char **paths, int npaths, int debounce, const char *image,
+                     const char **badpath);
+
+#endif
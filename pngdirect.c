@@ -0,0 +1,432 @@
+/* *******************************************************************
+ *                          pngdirect.c
+ * 8-bit RGB(A) PNG decoding with zlib alone.
+ * Every function returns the same IMAGE_ERR_* codes as pngimage. Images
+ * that are broken past the header give IMAGE_ERR_GENERIC, like they do
+ * when libpng finds it out.
+ *
+ * *******************************************************************/
+
+#include "pngdirect.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+/* the SSSE3 and AVX2 kernels are compiled for those with target
+ * attributes, whatever the flags, and pngdirect_open picks them if the
+ * CPU has them */
+#if defined(__SSE2__) && defined(__GNUC__)
+#define CPU_DISPATCH
+#include <immintrin.h>
+#endif
+#include "pngimage.h"
+
+/* libpng's default limit on either side; anything bigger is left to it */
+#define MAXDIM 1000000u
+
+/* bytes before each row, so that the filter byte has a row of its own
+ * to go in, and after it, so that the kernels below can read and write
+ * whole vectors past the end of the row */
+#define ROWHEAD 16
+#define ROWPAD  64
+
+static uint32_t get_be32(const unsigned char *p) { return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+/* Gets the length of the chunk at p. Returns 0 if all of it is there. */
+static int chunk_len(const unsigned char *p, const unsigned char *end, uint32_t *len)
+{
+    if (end - p < 12)
+        return 1;
+    *len = get_be32(p);
+    if (*len > 0x7FFFFFFFu || (size_t) (end - p) - 12 < *len)
+        return 1;
+    return 0;
+}
+
+static int chunk_is(const unsigned char *p, const char *type)
+{
+    return memcmp(p + 4, type, 4) == 0;
+}
+
+/* Critical chunks are the ones whose type starts with a capital. */
+static int chunk_critical(const unsigned char *p)
+{
+    return (p[4] & 0x20) == 0;
+}
+
+static int chunk_crc_ok(const unsigned char *p, uint32_t len)
+{
+    return crc32(0, p + 4, len + 4) == get_be32(p + 8 + len);
+}
+
+/* Points zs at the data of the next IDAT. Returns 1 if there's no
+ * such chunk, or if its CRC is wrong. */
+static int next_idat(PngDirect *png)
+{
+    const unsigned char *p = png->next;
+    uint32_t len;
+
+    if (chunk_len(p, png->end, &len) != 0 || !chunk_is(p, "IDAT") || !chunk_crc_ok(p, len))
+        return 1;
+    png->zs.next_in = (unsigned char *) p + 8;
+    png->zs.avail_in = len;
+    png->next = p + 12 + len;
+    return 0;
+}
+
+/* The reconstruction filters. Each one gets the current row, after its
+ * filter byte, the previous one (all zeros for the first row), the
+ * length of the row and the bytes per pixel, 3 or 4. */
+
+#ifdef __SSE2__
+static inline __m128i load4(const unsigned char *p)
+{
+    int32_t x;
+
+    memcpy(&x, p, 4);
+    return _mm_cvtsi32_si128(x);
+}
+
+static inline void store4(unsigned char *p, __m128i v)
+{
+    int32_t x = _mm_cvtsi128_si32(v);
+
+    memcpy(p, &x, 4);
+}
+
+/* mask ? x : y */
+static inline __m128i blend(__m128i mask, __m128i x, __m128i y)
+{
+    return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+static __m128i abs16_sse2(__m128i x)
+{
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+#endif
+
+#ifdef CPU_DISPATCH
+__attribute__((target("ssse3")))
+static __m128i abs16_ssse3(__m128i x)
+{
+    return _mm_abs_epi16(x);
+}
+#endif
+
+/* Each byte plus the one bpp bytes before. Within a vector, that's a
+ * prefix sum over its pixels: 4 of them for bpp 4, in 16 bytes, or 4
+ * for bpp 3, in 12 of them. */
+static void unfilter_sub(unsigned char *cur, size_t n, int bpp)
+{
+#ifdef __SSE2__
+    __m128i x, orig, last = _mm_setzero_si128();
+    const __m128i low12 = _mm_setr_epi32(-1, -1, -1, 0);
+    const __m128i low3 = _mm_setr_epi32(0xFFFFFF, 0, 0, 0);
+    size_t i;
+
+    if (bpp == 4) {
+        for (i = 0; i < n; i += 16) {
+            x = _mm_loadu_si128((const __m128i *) (cur + i));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi8(x, last);
+            _mm_storeu_si128((__m128i *) (cur + i), x);
+            last = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+    } else {
+        for (i = 0; i < n; i += 12) {
+            orig = _mm_loadu_si128((const __m128i *) (cur + i));
+            x = _mm_add_epi8(orig, _mm_slli_si128(orig, 3));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+            last = _mm_or_si128(last, _mm_slli_si128(last, 3));
+            last = _mm_or_si128(last, _mm_slli_si128(last, 6));
+            x = _mm_add_epi8(x, last);
+            /* the last 4 bytes belong to the next pixels, still filtered */
+            _mm_storeu_si128((__m128i *) (cur + i), blend(low12, x, orig));
+            last = _mm_and_si128(_mm_srli_si128(x, 9), low3);
+        }
+    }
+#else
+    for (size_t i = bpp; i < n; i++)
+        cur[i] += cur[i - bpp];
+#endif
+}
+
+static void unfilter_up(unsigned char *cur, const unsigned char *prev, size_t n)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for ( ; i < n; i += 16)
+        _mm_storeu_si128((__m128i *) (cur + i),
+                         _mm_add_epi8(_mm_loadu_si128((const __m128i *) (cur + i)),
+                                      _mm_loadu_si128((const __m128i *) (prev + i))));
+#else
+    for ( ; i < n; i++)
+        cur[i] += prev[i];
+#endif
+}
+
+#ifdef CPU_DISPATCH
+/* the only filter that's wider with AVX2: the others are a pixel at a
+ * time, or a prefix sum that doesn't cross 128-bit lanes */
+__attribute__((target("avx2")))
+static void unfilter_up_avx2(unsigned char *cur, const unsigned char *prev, size_t n)
+{
+    for (size_t i = 0; i < n; i += 32)
+        _mm256_storeu_si256((__m256i *) (cur + i),
+                            _mm256_add_epi8(_mm256_loadu_si256((const __m256i *) (cur + i)),
+                                            _mm256_loadu_si256((const __m256i *) (prev + i))));
+}
+#endif
+
+/* Avg and Paeth depend on the pixel just decoded, so they go one pixel
+ * at a time, with the whole pixel in one register. For bpp 3, a pixel
+ * is written as 4 bytes, the last of which belongs to the next one: it's
+ * read before that, and written again with the next pixel. */
+static void unfilter_avg(unsigned char *cur, const unsigned char *prev, size_t n, int bpp)
+{
+#ifdef __SSE2__
+    __m128i a = _mm_setzero_si128(), b, x = load4(cur), next;
+    const __m128i one = _mm_set1_epi8(1);
+
+    for (size_t i = 0; i < n; i += bpp) {
+        next = load4(cur + i + bpp);
+        b = load4(prev + i);
+        /* _mm_avg_epu8 rounds up, the filter rounds down */
+        a = _mm_add_epi8(x, _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one)));
+        store4(cur + i, a);
+        x = next;
+    }
+#else
+    size_t i;
+
+    for (i = 0; i < (size_t) bpp; i++)
+        cur[i] += prev[i] >> 1;
+    for ( ; i < n; i++)
+        cur[i] += (cur[i - bpp] + prev[i]) >> 1;
+#endif
+}
+
+#ifdef __SSE2__
+/* Paeth with SSE2, or SSSE3 for the absolute values: inlined into each
+ * kernel, where abs16 becomes the instruction it's compiled for. */
+static inline __attribute__((always_inline))
+void paeth_kernel(unsigned char *cur, const unsigned char *prev, size_t n, int bpp,
+                  __m128i (*abs16)(__m128i))
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero, b, c = zero, x = load4(cur), next;
+    __m128i pa, pb, pc, least, pred;
+
+    /* 16 bits a channel, where a + b - 2c fits */
+    for (size_t i = 0; i < n; i += bpp) {
+        next = load4(cur + i + bpp);
+        b = _mm_unpacklo_epi8(load4(prev + i), zero);
+        pa = _mm_sub_epi16(b, c);
+        pb = _mm_sub_epi16(a, c);
+        pc = abs16(_mm_add_epi16(pa, pb));
+        pa = abs16(pa);
+        pb = abs16(pb);
+        least = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+        pred = blend(_mm_cmpeq_epi16(pb, least), b, c);
+        pred = blend(_mm_cmpeq_epi16(pa, least), a, pred);
+        x = _mm_add_epi8(x, _mm_packus_epi16(pred, pred));
+        store4(cur + i, x);
+        a = _mm_unpacklo_epi8(x, zero);
+        c = b;
+        x = next;
+    }
+}
+#endif
+
+#ifdef CPU_DISPATCH
+__attribute__((target("ssse3")))
+static void unfilter_paeth_ssse3(unsigned char *cur, const unsigned char *prev, size_t n, int bpp)
+{
+    paeth_kernel(cur, prev, n, bpp, abs16_ssse3);
+}
+#endif
+
+static void unfilter_paeth(unsigned char *cur, const unsigned char *prev, size_t n, int bpp)
+{
+#ifdef __SSE2__
+    paeth_kernel(cur, prev, n, bpp, abs16_sse2);
+#else
+    int a, b, c, pa, pb, pc;
+    size_t i;
+
+    for (i = 0; i < (size_t) bpp; i++)
+        cur[i] += prev[i];
+    for ( ; i < n; i++) {
+        a = cur[i - bpp];
+        b = prev[i];
+        c = prev[i - bpp];
+        pa = abs(b - c);
+        pb = abs(a - c);
+        pc = abs(a + b - 2 * c);
+        cur[i] += pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+    }
+#endif
+}
+
+/* Opens the PNG image at buf. Returns PNGDIRECT_UNSUPPORTED for images
+ * that must go through pngimage, which includes those with a bad
+ * header, and IMAGE_ERR_NOMEM. */
+int pngdirect_open(PngDirect *png, const unsigned char *buf, size_t len)
+{
+    static const unsigned char sig[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    const unsigned char *p = buf + 8;
+    size_t slot;
+    uint32_t w, h, clen;
+    unsigned char *tmp;
+
+    png->row = png->h = 0;
+    png->end = buf + len;
+    if (len < 8 || memcmp(buf, sig, 8) != 0)
+        return PNGDIRECT_UNSUPPORTED;
+    if (chunk_len(p, png->end, &clen) != 0 || clen != 13 || !chunk_is(p, "IHDR")
+     || !chunk_crc_ok(p, clen))
+        return PNGDIRECT_UNSUPPORTED;
+    w = get_be32(p + 8);
+    h = get_be32(p + 12);
+    if (w == 0 || h == 0 || w > MAXDIM || h > MAXDIM
+     || p[16] != 8 || (p[17] != 2 && p[17] != 6)    /* bit depth, color type */
+     || p[18] != 0 || p[19] != 0 || p[20] != 0)     /* compression, filter, interlace */
+        return PNGDIRECT_UNSUPPORTED;
+    png->ch = p[17] == 2 ? 3 : 4;
+    png->unfilter_up = unfilter_up;
+    png->unfilter_paeth = unfilter_paeth;
+#ifdef CPU_DISPATCH
+    if (__builtin_cpu_supports("avx2"))
+        png->unfilter_up = unfilter_up_avx2;
+    if (__builtin_cpu_supports("ssse3"))
+        png->unfilter_paeth = unfilter_paeth_ssse3;
+#endif
+
+    /* up to the image data: tRNS would have to be made into alpha, and
+     * critical chunks other than a sane PLTE are for libpng to reject */
+    for (p += 12 + clen; ; p += 12 + clen) {
+        if (chunk_len(p, png->end, &clen) != 0 || chunk_is(p, "tRNS"))
+            return PNGDIRECT_UNSUPPORTED;
+        if (chunk_is(p, "IDAT")) {
+            if (!chunk_crc_ok(p, clen))
+                return PNGDIRECT_UNSUPPORTED;
+            break;
+        }
+        if (chunk_critical(p)
+         && (!chunk_is(p, "PLTE") || clen % 3 != 0 || clen > 768 || !chunk_crc_ok(p, clen)))
+            return PNGDIRECT_UNSUPPORTED;
+    }
+
+    png->w = w;
+    png->rowbytes = (size_t) png->w * png->ch;
+    slot = ROWHEAD + png->rowbytes + ROWPAD;
+    if (png->rowcap < 2 * slot) {
+        tmp = realloc(png->rowbuf, 2 * slot);
+        if (!tmp)
+            return IMAGE_ERR_NOMEM;
+        png->rowbuf = tmp;
+        png->rowcap = 2 * slot;
+    }
+    png->prev = png->rowbuf + ROWHEAD;
+    png->cur = png->rowbuf + slot + ROWHEAD;
+    /* the rows are swapped before each one is decoded: this is the
+     * previous row of the first one */
+    memset(png->cur, 0, png->rowbytes + ROWPAD);
+
+    if (!png->zinit) {
+        memset(&png->zs, 0, sizeof(png->zs));
+        if (inflateInit(&png->zs) != Z_OK)
+            return IMAGE_ERR_NOMEM;
+        png->zinit = 1;
+    } else
+        inflateReset(&png->zs);
+    png->next = p;
+    next_idat(png);
+    png->h = h;
+    return 0;
+}
+
+/* Checks the rest of the file after the last row, like png_read_end
+ * does: it must all be there, up to IEND, with the right CRC on every
+ * critical chunk. What's left of the zlib stream (its checksum) isn't
+ * looked at: libpng only warns about it. */
+int pngdirect_finish(PngDirect *png)
+{
+    const unsigned char *p = png->next;
+    uint32_t len;
+
+    if (png->row < png->h)
+        return IMAGE_ERR_BADPARAM;
+    for ( ; ; p += 12 + len) {
+        if (chunk_len(p, png->end, &len) != 0)
+            return IMAGE_ERR_GENERIC;
+        if (chunk_critical(p) && !chunk_crc_ok(p, len))
+            return IMAGE_ERR_GENERIC;
+        if (chunk_is(p, "IEND"))
+            return 0;
+    }
+}
+
+/* Decodes the next row; *row points to it until the next call. */
+int pngdirect_next_row(PngDirect *png, unsigned char **row)
+{
+    unsigned char *tmp;
+    int ret;
+
+    if (png->row >= png->h)
+        return IMAGE_ERR_BADPARAM;
+    tmp = png->prev;
+    png->prev = png->cur;
+    png->cur = tmp;
+    png->zs.next_out = png->cur - 1;
+    png->zs.avail_out = png->rowbytes + 1;
+    while (png->zs.avail_out > 0) {
+        if (png->zs.avail_in == 0 && next_idat(png) != 0)
+            return IMAGE_ERR_GENERIC;
+        ret = inflate(&png->zs, Z_NO_FLUSH);
+        if (ret == Z_MEM_ERROR)
+            return IMAGE_ERR_NOMEM;
+        if ((ret != Z_OK && ret != Z_STREAM_END) || (ret == Z_STREAM_END && png->zs.avail_out > 0))
+            return IMAGE_ERR_GENERIC;
+    }
+
+    switch (png->cur[-1]) {
+    case 0: break;
+    case 1: unfilter_sub(png->cur, png->rowbytes, png->ch); break;
+    case 2: png->unfilter_up(png->cur, png->prev, png->rowbytes); break;
+    case 3: unfilter_avg(png->cur, png->prev, png->rowbytes, png->ch); break;
+    case 4: png->unfilter_paeth(png->cur, png->prev, png->rowbytes, png->ch); break;
+    default: return IMAGE_ERR_GENERIC;
+    }
+    *row = png->cur;
+    png->row++;
+    return 0;
+}
+
+/* Skips n rows. They still need to be decompressed and unfiltered, as
+ * the next ones depend on them. */
+int pngdirect_skip_rows(PngDirect *png, uint32_t n)
+{
+    unsigned char *row;
+    int err;
+
+    if (n > png->h - png->row)
+        n = png->h - png->row;
+    for ( ; n > 0; n--)
+        if (err = pngdirect_next_row(png, &row), err != 0)
+            return err;
+    return 0;
+}
+
+void pngdirect_free(PngDirect *png)
+{
+    if (png->zinit)
+        inflateEnd(&png->zs);
+    free(png->rowbuf);
+    memset(png, 0, sizeof(*png));
+}
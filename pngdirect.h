@@ -0,0 +1,52 @@
+/* *******************************************************************
+ *                          pngdirect.h
+ * A PNG decoder for the most common kind of PNG, 8-bit RGB or RGBA, not
+ * interlaced and without tRNS, that only needs zlib: the data is
+ * inflated a row at a time and unfiltered here, with SSE2 instead of
+ * libpng's generic code, and SSSE3 (Paeth) and AVX2 (Up) on CPUs that
+ * have them. Rows come out as they would from pngimage_next_row, so decoder
+ * can use either one.
+ * The CRCs of the critical chunks are checked, and a broken image fails
+ * where libpng would fail too, with pngdirect_finish standing in for
+ * png_read_end. Images that aren't this simple, or whose header libpng
+ * would complain about, aren't opened at all (PNGDIRECT_UNSUPPORTED),
+ * and go through pngimage as before.
+ *
+ * *******************************************************************/
+
+#ifndef PNGDIRECT_H_INCLUDED
+#define PNGDIRECT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+/* pngdirect_open can't decode the image: use pngimage */
+#define PNGDIRECT_UNSUPPORTED -1
+
+typedef struct _pngdirect {
+    uint32_t w, h;
+    uint32_t row;               /* next row to be read */
+    int ch;                     /* 3 or 4 */
+    size_t rowbytes;
+    const unsigned char *next;  /* the chunk after the current IDAT */
+    const unsigned char *end;
+    z_stream zs;
+    int zinit;                  /* zs has been through inflateInit */
+    unsigned char *rowbuf;      /* two rows and their filter bytes, padded */
+    size_t rowcap;
+    unsigned char *cur, *prev;  /* into rowbuf, each after its filter byte */
+    /* the kernels for this CPU */
+    void (*unfilter_up)(unsigned char *cur, const unsigned char *prev, size_t n);
+    void (*unfilter_paeth)(unsigned char *cur, const unsigned char *prev, size_t n, int bpp);
+} PngDirect;
+
+#define PNGDIRECT_INIT { 0 }
+
+int     pngdirect_open(PngDirect *png, const unsigned char *buf, size_t len);
+int     pngdirect_next_row(PngDirect *png, unsigned char **row);
+int     pngdirect_skip_rows(PngDirect *png, uint32_t n);
+int     pngdirect_finish(PngDirect *png);
+void    pngdirect_free(PngDirect *png);
+
+#endif
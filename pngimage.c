@@ -1,94 +1,402 @@
 #include "pngimage.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <zlib.h>
 #include <setjmp.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "pngwrite.h"
+#include "stats.h"
 
-int pngimage_read_image(Image *img, FILE *infile)
+const Image pngimage_default = { NULL, 0, 0, NULL, NULL, 0, 0, 0, 0, NULL, { NULL, 0 }, 0, 0, 0, 0, 0 };
+
+/* same as libpng's default read function, but counts bytes and time for --stats */
+static void pngimage_read_data(png_structp data, png_bytep buf, png_size_t len)
 {
-    unsigned char sig[8];
-    png_structp data;
-    png_infop info;
-    uint32_t i, rowbytes;
+    FILE *infile = png_get_io_ptr(data);
+    int prev = STATS_ENTER(STATS_IO);
+    size_t n = fread(buf, 1, len, infile);
 
-    if (!img || !infile)
-        return IMAGE_ERR_BADPARAM;
+    STATS_ENTER(prev);
+    STATS_ADD(STATS_BYTES_READ, n);
+    if (n != len)
+        png_error(data, "read error");
+}
 
-    /* read signature */
-    fread(sig, 1, 8, infile);
-    if (!png_check_sig(sig, 8))
-        return IMAGE_ERR_NOTIMAGE;
+/* reads from a memory span: only the copy into libpng's buffer is done */
+static void pngimage_read_mem(png_structp data, png_bytep buf, png_size_t len)
+{
+    PngSource *src = png_get_io_ptr(data);
+
+    if (len > src->left)
+        png_error(data, "unexpected end of data");
+    memcpy(buf, src->p, len);
+    src->p += len;
+    src->left -= len;
+}
+
+#define ARENA_ALIGN 16
+
+static png_voidp pngimage_arena_alloc(png_structp data, png_alloc_size_t size)
+{
+    PngArena *arena = png_get_mem_ptr(data);
+    void *p;
+
+    size = (size + ARENA_ALIGN-1) & ~(png_alloc_size_t) (ARENA_ALIGN-1);
+    arena->want += size;
+    if (arena->cap - arena->used >= size) {
+        p = arena->mem + arena->used;
+        arena->used += size;
+        return p;
+    }
+    return malloc(size);    /* doesn't fit: next image will have room */
+}
+
+static void pngimage_arena_dealloc(png_structp data, png_voidp p)
+{
+    PngArena *arena = png_get_mem_ptr(data);
+    unsigned char *ptr = p;
+
+    if (ptr < arena->mem || ptr >= arena->mem + arena->cap)
+        free(p);
+}
+
+/* Called once libpng is done with the arena. */
+static void pngimage_arena_reset(PngArena *arena)
+{
+    if (arena->want > arena->cap) {
+        free(arena->mem);
+        arena->mem = malloc(arena->want);
+        arena->cap = arena->mem ? arena->want : 0;
+    }
+    arena->used = arena->want = 0;
+}
+
+void pngimage_arena_free(PngArena *arena)
+{
+    free(arena->mem);
+    arena->mem = NULL;
+    arena->cap = arena->used = arena->want = 0;
+}
+
+/* Destroys the png structs of img, if any. */
+static void pngimage_destroy(Image *img)
+{
+    if (!img->pngdata)
+        return;
+    png_destroy_read_struct(&img->pngdata, &img->pnginfo, NULL);
+    img->pngdata = NULL;
+    img->pnginfo = NULL;
+    if (img->arena)
+        pngimage_arena_reset(img->arena);
+}
+
+/* Makes img->data at least size bytes. Its content isn't kept. */
+static int pngimage_reserve(Image *img, size_t size)
+{
+    if (img->datacap >= size)
+        return 0;
+    free(img->data);
+    img->data = malloc(size);
+    img->datacap = img->data ? size : 0;
+    return img->data ? 0 : IMAGE_ERR_NOMEM;
+}
+
+/* Reads everything up to the image data, after the signature, and sets
+ * up the transformations. io and readfn are passed to png_set_read_fn.
+ * On success the png structs are left in img->pngdata and img->pnginfo. */
+static int pngimage_begin(Image *img, void *io, png_rw_ptr readfn)
+{
+    png_structp data;
+    png_infop info;
 
     /* create png data structs */
-    data = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (img->arena)
+        data = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL,
+                    img->arena, pngimage_arena_alloc, pngimage_arena_dealloc);
+    else
+        data = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!data)
         return IMAGE_ERR_NOMEM;
     info = png_create_info_struct(data);
+    img->pngdata = data;
+    img->pnginfo = info;
     if (!info) {
-        png_destroy_read_struct(&data, NULL, NULL);
+        pngimage_destroy(img);
         return IMAGE_ERR_NOMEM;
     }
 
     /* this is libpng's error handling: must be put into each func that calls
      * a libpng func */
     if (setjmp(png_jmpbuf(data))) {
-        png_destroy_read_struct(&data, &info, NULL);
+        pngimage_destroy(img);
         return IMAGE_ERR_GENERIC;
     }
 
     /* initialize and read IHDR chunk: it contains infos such as width and
      * height */
-    png_init_io(data, infile);
+    png_set_read_fn(data, io, readfn);
     png_set_sig_bytes(data, 8);
     png_read_info(data, info);
     png_get_IHDR(data, info, &img->w, &img->h, &img->bitdepth, &img->colortype, NULL, NULL, NULL);
 
-    uint8_t *rowpointers[img->h];
-
-    /* transform the image so that we will always get data in rgba form */
-    if (img->colortype == PNG_COLOR_TYPE_PALETTE)
-        png_set_expand(data);
-    if (img->colortype == PNG_COLOR_TYPE_GRAY && img->bitdepth < 8)
-        png_set_expand(data);
-    if (png_get_valid(data, info, PNG_INFO_tRNS))
-        png_set_expand(data);
-    if (img->bitdepth == 16)
-        png_set_strip_16(data);
-    if (img->colortype == PNG_COLOR_TYPE_GRAY || img->colortype == PNG_COLOR_TYPE_GRAY_ALPHA)
-        png_set_gray_to_rgb(data);
+    /* transform the image so that we will always get data in rgba form.
+     * With img->native, gray, gray+alpha and 16-bit images are left
+     * alone instead: palette_add_row reads their rows as they are, which
+     * is much less work than making them 8-bit RGB(A) first. Palette
+     * images and tRNS still go through libpng */
+    img->depth = 8;
+    if (img->native && img->colortype != PNG_COLOR_TYPE_PALETTE
+     && !png_get_valid(data, info, PNG_INFO_tRNS))
+        img->depth = img->bitdepth;
+    else {
+        if (img->colortype == PNG_COLOR_TYPE_PALETTE)
+            png_set_expand(data);
+        if (img->colortype == PNG_COLOR_TYPE_GRAY && img->bitdepth < 8)
+            png_set_expand(data);
+        if (png_get_valid(data, info, PNG_INFO_tRNS))
+            png_set_expand(data);
+        if (img->bitdepth == 16)
+            png_set_strip_16(data);
+        if (img->colortype == PNG_COLOR_TYPE_GRAY || img->colortype == PNG_COLOR_TYPE_GRAY_ALPHA)
+            png_set_gray_to_rgb(data);
+    }
+    img->npasses = png_set_interlace_handling(data);
     png_read_update_info(data, info);
 
-    /* get channels and alloc raw image data */
-    rowbytes = png_get_rowbytes(data, info);
+    img->rowbytes = png_get_rowbytes(data, info);
     img->ch = (int) png_get_channels(data, info);
-    img->data = malloc(rowbytes*img->h);
-    if (!img->data) {
-        png_destroy_read_struct(&data, &info, NULL);
-        return IMAGE_ERR_NOMEM;
-    }
+    img->row = 0;
 
 #ifdef DEBUG
-    fprintf(stderr, "pngimage_read_fillimgdata: channels = %d, rowbytes = %d, height = %d\n",
-            img->ch, rowbytes, img->h);
+    fprintf(stderr, "pngimage_begin: channels = %d, rowbytes = %zu, height = %d\n",
+            img->ch, img->rowbytes, img->h);
 #endif
+    return 0;
+}
 
-    /* set the individual row_pointers to point at the correct offsets */
-    for (i = 0; i < img->h; i++)
-        rowpointers[i] = img->data + i*rowbytes;
-    /* read whole image and end */
-    png_read_image(data, rowpointers);
-    png_read_end(data, NULL);
-    png_destroy_read_struct(&data, &info, NULL);
+/* Decodes the rest of the image after the signature. io and readfn are
+ * passed to png_set_read_fn.
+ * img->data is reused if img->datacap is big enough, otherwise it's
+ * reallocated; it belongs to img either way, even after an error, and
+ * must be released with pngimage_free. */
+static int pngimage_read(Image *img, void *io, png_rw_ptr readfn)
+{
+    uint32_t i;
+    int err, pass;
+
+    err = pngimage_begin(img, io, readfn);
+    if (err != 0)
+        return err;
+    /* get raw image data, unless the last one fits */
+    if (pngimage_reserve(img, img->rowbytes * img->h) != 0) {
+        pngimage_destroy(img);
+        return IMAGE_ERR_NOMEM;
+    }
+    if (setjmp(png_jmpbuf(img->pngdata))) {
+        pngimage_destroy(img);
+        return IMAGE_ERR_GENERIC;
+    }
 
+    /* read whole image, row by row: this is what png_read_image does, minus
+     * the array of row pointers */
+    for (pass = 0; pass < img->npasses; pass++)
+        for (i = 0; i < img->h; i++)
+            png_read_row(img->pngdata, img->data + i*img->rowbytes, NULL);
+    png_read_end(img->pngdata, NULL);
+    pngimage_destroy(img);
     return 0;
 }
 
+int pngimage_read_image(Image *img, FILE *infile)
+{
+    unsigned char sig[8];
+
+    if (!img || !infile)
+        return IMAGE_ERR_BADPARAM;
+
+    /* read signature */
+    if (fread(sig, 1, 8, infile) != 8)
+        return IMAGE_ERR_NOTIMAGE;
+    STATS_ADD(STATS_BYTES_READ, 8);
+    if (!png_check_sig(sig, 8))
+        return IMAGE_ERR_NOTIMAGE;
+    return pngimage_read(img, infile, pngimage_read_data);
+}
+
+/* Same as pngimage_read_image, but decodes from the len bytes at buf.
+ * The caller keeps ownership of buf, which may be a mapped file. */
+int pngimage_read_image_mem(Image *img, const unsigned char *buf, size_t len)
+{
+    if (!img || !buf)
+        return IMAGE_ERR_BADPARAM;
+    if (len < 8 || !png_check_sig((png_bytep) buf, 8))
+        return IMAGE_ERR_NOTIMAGE;
+    img->src.p = buf + 8;
+    img->src.left = len - 8;
+    return pngimage_read(img, &img->src, pngimage_read_mem);
+}
+
+/* The following functions read an image one row at a time, so that
+ * callers can stop decoding whenever they want:
+ *     pngimage_open_mem(img, buf, len);
+ *     while (img->row < img->h)
+ *         pngimage_next_row(img, &row);    (or pngimage_skip_rows)
+ *     pngimage_close(img);
+ * Rows are 8-bit RGB or RGBA, like with pngimage_read_image, unless
+ * img->native is set (see pngimage_begin). Interlaced
+ * images can't be decoded one row at a time: the first call to
+ * pngimage_next_row decodes the whole image into img->data, and the
+ * following ones point into it. */
+int pngimage_open_mem(Image *img, const unsigned char *buf, size_t len)
+{
+    int err;
+
+    if (!img || !buf)
+        return IMAGE_ERR_BADPARAM;
+    if (len < 8 || !png_check_sig((png_bytep) buf, 8))
+        return IMAGE_ERR_NOTIMAGE;
+    img->src.p = buf + 8;
+    img->src.left = len - 8;
+    err = pngimage_begin(img, &img->src, pngimage_read_mem);
+    if (err != 0)
+        return err;
+    err = pngimage_reserve(img, img->npasses > 1 ? img->rowbytes * img->h : img->rowbytes);
+    if (err != 0)
+        pngimage_destroy(img);
+    return err;
+}
+
+/* Decodes the next row; *row points to it until the next call. */
+int pngimage_next_row(Image *img, unsigned char **row)
+{
+    uint32_t i;
+    int pass;
+
+    if (!img->pngdata || img->row >= img->h)
+        return IMAGE_ERR_BADPARAM;
+    if (setjmp(png_jmpbuf(img->pngdata))) {
+        pngimage_destroy(img);
+        return IMAGE_ERR_GENERIC;
+    }
+    if (img->npasses == 1) {
+        png_read_row(img->pngdata, img->data, NULL);
+        *row = img->data;
+    } else {
+        if (img->row == 0)
+            for (pass = 0; pass < img->npasses; pass++)
+                for (i = 0; i < img->h; i++)
+                    png_read_row(img->pngdata, img->data + i*img->rowbytes, NULL);
+        *row = img->data + img->row * img->rowbytes;
+    }
+    img->row++;
+    return 0;
+}
+
+/* Decodes the next row of a non-interlaced image into dst, which must
+ * have img->rowbytes bytes. After the last row, the rest of the file is
+ * checked and the png structs are released, like pngimage_read_image does.
+ * Unlike the other functions, this only touches img's png structs, so a
+ * thread of its own can call it while another one uses img->data. */
+int pngimage_read_row(Image *img, unsigned char *dst)
+{
+    if (!img->pngdata || img->row >= img->h || img->npasses != 1)
+        return IMAGE_ERR_BADPARAM;
+    if (setjmp(png_jmpbuf(img->pngdata))) {
+        pngimage_destroy(img);
+        return IMAGE_ERR_GENERIC;
+    }
+    png_read_row(img->pngdata, dst, NULL);
+    if (++img->row == img->h) {
+        png_read_end(img->pngdata, NULL);
+        pngimage_destroy(img);
+    }
+    return 0;
+}
+
+/* Skips n rows. They still need to be decompressed and unfiltered, but
+ * they're not copied anywhere. */
+int pngimage_skip_rows(Image *img, uint32_t n)
+{
+    unsigned char *row;
+    int err;
+
+    if (!img->pngdata)
+        return IMAGE_ERR_BADPARAM;
+    if (n > img->h - img->row)
+        n = img->h - img->row;
+    if (img->npasses > 1) {
+        /* the first row decodes everything, the others come for free */
+        if (img->row == 0 && n > 0) {
+            err = pngimage_next_row(img, &row);
+            if (err != 0)
+                return err;
+            n--;
+        }
+        img->row += n;
+        return 0;
+    }
+    if (setjmp(png_jmpbuf(img->pngdata))) {
+        pngimage_destroy(img);
+        return IMAGE_ERR_GENERIC;
+    }
+    for ( ; n > 0; n--, img->row++)
+        png_read_row(img->pngdata, NULL, NULL);
+    return 0;
+}
+
+/* Returns an upper bound on the number of colors in an opened image,
+ * from its header alone. */
+size_t pngimage_max_colors(const Image *img)
+{
+    size_t bound = (size_t) img->w * img->h;
+    png_colorp plte;
+    int nplte;
+
+    if (img->colortype == PNG_COLOR_TYPE_PALETTE
+     && png_get_PLTE(img->pngdata, img->pnginfo, &plte, &nplte) != 0
+     && (size_t) nplte < bound)
+        bound = nplte;
+    /* tRNS on a gray image makes one gray level transparent, it doesn't
+     * add any new color. 16-bit samples are stripped to 8 */
+    if (img->colortype == PNG_COLOR_TYPE_GRAY
+     && ((size_t) 1 << (img->bitdepth > 8 ? 8 : img->bitdepth)) < bound)
+        bound = (size_t) 1 << (img->bitdepth > 8 ? 8 : img->bitdepth);
+    return bound;
+}
+
+/* Ends reading, whether or not every row was read. */
+void pngimage_close(Image *img)
+{
+    pngimage_destroy(img);
+}
+
+/* Releases the pixel data of img. The arena, if any, belongs to the caller. */
+void pngimage_free(Image *img)
+{
+    free(img->data);
+    img->data = NULL;
+    img->datacap = 0;
+}
+
+/* Writes img, which must be 8-bit RGBA, as a PNG. Images big enough to be
+ * split in a few groups of rows are compressed on every core by pngwrite. */
 int pngimage_write_image_rgba(Image *img, FILE *outfile)
 {
     png_structp data;
     png_infop info;
+#ifdef _WIN32
+    long ncpu = 1;
+#else
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    if (ncpu > 1 && pngwrite_groups(img->w, img->h) > 1)
+        return pngwrite_rgba(outfile, img->data, img->w, img->h, Z_BEST_COMPRESSION, ncpu);
 
     data = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!data)
@@ -112,7 +420,7 @@ int pngimage_write_image_rgba(Image *img, FILE *outfile)
     png_set_packing(data);
 
     for (uint32_t i = 0; i < img->h; i++)
-        png_write_row(data, img->data);
+        png_write_row(data, img->data + (size_t) i * img->w * 4);
     png_write_end(data, NULL);
     png_destroy_write_struct(&data, &info);
     return 0;
@@ -4,12 +4,35 @@
 #include <png.h>
 #include <stdint.h>
 
+/* Memory for libpng's own structs and buffers. Allocations are carved
+ * out of one block and never freed individually; the block is reset after
+ * every image and grown to what the image needed. Once it has seen the
+ * largest image of a batch, libpng doesn't call malloc anymore. */
+typedef struct _pngarena {
+    unsigned char *mem;
+    size_t cap, used;
+    size_t want;    /* bytes asked for during the current image */
+} PngArena;
+
+typedef struct _pngsource {
+    const unsigned char *p;
+    size_t left;
+} PngSource;
+
 typedef struct _image {
     unsigned char *data;
     uint32_t w, h;
     png_structp pngdata;
     png_infop   pnginfo;
     int ch, bitdepth, colortype;
+    size_t datacap;     /* size of data: it's reused if big enough */
+    PngArena *arena;    /* if not NULL, libpng allocates from here */
+    PngSource src;      /* what's left to decode, for memory sources */
+    size_t rowbytes;
+    uint32_t row;       /* next row to be read */
+    int npasses;
+    int native;         /* set by the caller: keep gray and 16-bit rows as they are */
+    int depth;          /* bits per channel of the rows: 8, unless native */
 } Image;
 
 enum {
@@ -17,10 +40,22 @@ enum {
     IMAGE_ERR_BADPARAM,
     IMAGE_ERR_NOMEM,
     IMAGE_ERR_NOTIMAGE,
+    IMAGE_ERR_BADDATA,      /* malformed or unsupported, for rawimage */
 };
 
+extern const Image pngimage_default;
+
 int     pngimage_read_image(Image *img, FILE *infile);
+int     pngimage_read_image_mem(Image *img, const unsigned char *buf, size_t len);
 int     pngimage_write_image_rgba(Image *img, FILE *outfile);
+int     pngimage_open_mem(Image *img, const unsigned char *buf, size_t len);
+int     pngimage_next_row(Image *img, unsigned char **row);
+int     pngimage_read_row(Image *img, unsigned char *dst);
+int     pngimage_skip_rows(Image *img, uint32_t n);
+size_t  pngimage_max_colors(const Image *img);
+void    pngimage_close(Image *img);
+void    pngimage_free(Image *img);
+void    pngimage_arena_free(PngArena *arena);
 
 #endif
 
@@ -0,0 +1,310 @@
+/* *******************************************************************
+ *                          pngwrite.c
+ * Parallel PNG writer. Returns the same IMAGE_ERR_* codes as pngimage.
+ *
+ * *******************************************************************/
+
+#include "pngwrite.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "pngimage.h"
+
+#define BPP 4
+#define WINDOW 32768
+#define MAXTHREADS 64
+
+typedef struct {
+    unsigned char *buf;     /* deflated group, with room for the zlib header
+                               (first group) and checksum (last group) */
+    size_t len;             /* deflate data in buf */
+    uLong adler;            /* of the filtered rows */
+    size_t rawlen;
+    int done, err;
+} Group;
+
+typedef struct {
+    const unsigned char *data;
+    unsigned char *zeros;   /* the row before the first */
+    uint32_t w, h;
+    size_t rowbytes;        /* unfiltered */
+    uint32_t grouprows, dictrows;
+    size_t ngroups, next;
+    int level, abort;
+    Group *groups;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} Writer;
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline int paeth(int a, int b, int c)
+{
+    int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2*c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+/* Filters row into out (type byte first), choosing the filter the same
+ * way libpng does: the one with the smallest sum of residuals taken as
+ * signed bytes. prev is a row of zeros for the first row. */
+static void filter_row(unsigned char *out, const unsigned char *row, const unsigned char *prev,
+                       size_t n)
+{
+    unsigned long sums[5] = { 0 };
+    int a, b, c, best = 0, f;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        a = i >= BPP ? row[i - BPP] : 0;
+        b = prev[i];
+        c = i >= BPP ? prev[i - BPP] : 0;
+        sums[0] += abs((signed char) row[i]);
+        sums[1] += abs((signed char) (row[i] - a));
+        sums[2] += abs((signed char) (row[i] - b));
+        sums[3] += abs((signed char) (row[i] - ((a + b) >> 1)));
+        sums[4] += abs((signed char) (row[i] - paeth(a, b, c)));
+    }
+    for (f = 1; f < 5; f++)
+        if (sums[f] < sums[best])
+            best = f;
+
+    out[0] = best;
+    out++;
+    switch (best) {
+    case 0:
+        memcpy(out, row, n);
+        break;
+    case 1:
+        for (i = 0; i < n; i++)
+            out[i] = row[i] - (i >= BPP ? row[i - BPP] : 0);
+        break;
+    case 2:
+        for (i = 0; i < n; i++)
+            out[i] = row[i] - prev[i];
+        break;
+    case 3:
+        for (i = 0; i < n; i++)
+            out[i] = row[i] - (((i >= BPP ? row[i - BPP] : 0) + prev[i]) >> 1);
+        break;
+    case 4:
+        for (i = 0; i < n; i++)
+            out[i] = row[i] - (i >= BPP ? paeth(row[i - BPP], prev[i], prev[i - BPP])
+                                        : paeth(0, prev[i], 0));
+        break;
+    }
+}
+
+/* Filters and deflates group g. fbuf has room for dictrows + grouprows
+ * filtered rows. */
+static int deflate_group(Writer *wr, z_stream *z, unsigned char *fbuf, size_t g)
+{
+    Group *grp = &wr->groups[g];
+    uint32_t first = g * wr->grouprows, nrows, dict, i, r;
+    size_t frow = wr->rowbytes + 1, dictlen, cap, head;
+    int last = g == wr->ngroups - 1, ret;
+
+    nrows = wr->h - first < wr->grouprows ? wr->h - first : wr->grouprows;
+    dict = first < wr->dictrows ? first : wr->dictrows;
+    for (i = 0; i < dict + nrows; i++) {
+        r = first - dict + i;
+        filter_row(fbuf + i*frow, wr->data + r*wr->rowbytes,
+                   r == 0 ? wr->zeros : wr->data + (r-1)*wr->rowbytes, wr->rowbytes);
+    }
+
+    if (deflateReset(z) != Z_OK)
+        return IMAGE_ERR_GENERIC;
+    if (dict > 0) {
+        dictlen = dict*frow < WINDOW ? dict*frow : WINDOW;
+        if (deflateSetDictionary(z, fbuf + dict*frow - dictlen, dictlen) != Z_OK)
+            return IMAGE_ERR_GENERIC;
+    }
+
+    /* the full flush adds a few bytes deflateBound doesn't know about */
+    grp->rawlen = (size_t) nrows * frow;
+    head = g == 0 ? 2 : 0;
+    cap = head + deflateBound(z, grp->rawlen) + 16 + 4;
+    grp->buf = malloc(cap);
+    if (!grp->buf)
+        return IMAGE_ERR_NOMEM;
+    z->next_in = fbuf + dict*frow;
+    z->avail_in = grp->rawlen;
+    z->next_out = grp->buf + head;
+    z->avail_out = cap - head - 4;
+    ret = deflate(z, last ? Z_FINISH : Z_FULL_FLUSH);
+    if (last ? ret != Z_STREAM_END : ret != Z_OK || z->avail_in != 0 || z->avail_out == 0)
+        return IMAGE_ERR_GENERIC;
+    grp->len = z->next_out - grp->buf;
+    grp->adler = adler32(adler32(0, NULL, 0), fbuf + dict*frow, grp->rawlen);
+    return 0;
+}
+
+static void *worker_main(void *arg)
+{
+    Writer *wr = arg;
+    z_stream z;
+    unsigned char *fbuf;
+    size_t g;
+    int err;
+
+    memset(&z, 0, sizeof(z));
+    fbuf = malloc((size_t) (wr->dictrows + wr->grouprows) * (wr->rowbytes + 1));
+    /* raw deflate: the zlib header and checksum are written by hand */
+    err = !fbuf ? IMAGE_ERR_NOMEM
+        : deflateInit2(&z, wr->level, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK ? IMAGE_ERR_NOMEM
+        : 0;
+
+    for (;;) {
+        pthread_mutex_lock(&wr->lock);
+        if (wr->abort || wr->next == wr->ngroups) {
+            pthread_mutex_unlock(&wr->lock);
+            break;
+        }
+        g = wr->next++;
+        pthread_mutex_unlock(&wr->lock);
+
+        wr->groups[g].err = err ? err : deflate_group(wr, &z, fbuf, g);
+
+        pthread_mutex_lock(&wr->lock);
+        wr->groups[g].done = 1;
+        if (wr->groups[g].err)
+            wr->abort = 1;
+        pthread_cond_broadcast(&wr->done);
+        pthread_mutex_unlock(&wr->lock);
+    }
+    if (err == 0)
+        deflateEnd(&z);
+    free(fbuf);
+    return NULL;
+}
+
+static int write_chunk(FILE *f, const char *type, const unsigned char *data, size_t len)
+{
+    unsigned char hdr[8], crc[4];
+    uLong sum;
+
+    put_be32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    sum = crc32(crc32(0, NULL, 0), hdr + 4, 4);
+    if (len > 0)
+        sum = crc32(sum, data, len);
+    put_be32(crc, sum);
+    return fwrite(hdr, 1, 8, f) != 8 || (len > 0 && fwrite(data, 1, len, f) != len)
+        || fwrite(crc, 1, 4, f) != 4;
+}
+
+/* How many groups an image would be split in. */
+size_t pngwrite_groups(uint32_t w, uint32_t h)
+{
+    size_t frow = (size_t) w * BPP + 1;
+    size_t grouprows = frow >= PNGWRITE_GROUP_SIZE ? 1 : PNGWRITE_GROUP_SIZE / frow;
+
+    return (h + grouprows - 1) / grouprows;
+}
+
+/* Writes the 8-bit RGBA image in data, which has no padding between
+ * rows, as a PNG compressed at level with up to nthreads threads. */
+int pngwrite_rgba(FILE *f, const unsigned char *data, uint32_t w, uint32_t h,
+                  int level, int nthreads)
+{
+    static const unsigned char sig[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    Writer wr;
+    pthread_t threads[MAXTHREADS];
+    unsigned char ihdr[13];
+    uLong adler;
+    size_t g;
+    int i, started = 0, err = 0, flevel;
+    Group *grp;
+
+    if (w == 0 || h == 0 || w > 0x7FFFFFFF / BPP || h > 0x7FFFFFFF)
+        return IMAGE_ERR_BADPARAM;
+    wr.data = data;
+    wr.w = w;
+    wr.h = h;
+    wr.rowbytes = (size_t) w * BPP;
+    wr.grouprows = wr.rowbytes + 1 >= PNGWRITE_GROUP_SIZE ? 1 : PNGWRITE_GROUP_SIZE / (wr.rowbytes + 1);
+    wr.dictrows = (WINDOW + wr.rowbytes) / (wr.rowbytes + 1);
+    wr.ngroups = pngwrite_groups(w, h);
+    wr.next = 0;
+    wr.level = level;
+    wr.abort = 0;
+    wr.groups = calloc(wr.ngroups, sizeof(Group));
+    wr.zeros = calloc(wr.rowbytes, 1);
+    if (!wr.groups || !wr.zeros) {
+        free(wr.groups);
+        free(wr.zeros);
+        return IMAGE_ERR_NOMEM;
+    }
+    pthread_mutex_init(&wr.lock, NULL);
+    pthread_cond_init(&wr.done, NULL);
+
+    if (nthreads > MAXTHREADS)
+        nthreads = MAXTHREADS;
+    if ((size_t) nthreads > wr.ngroups)
+        nthreads = wr.ngroups;
+    for (i = 0; i < nthreads; i++)
+        if (pthread_create(&threads[started], NULL, worker_main, &wr) == 0)
+            started++;
+    /* without threads, do everything here before writing */
+    if (started == 0)
+        worker_main(&wr);
+
+    put_be32(ihdr, w);
+    put_be32(ihdr + 4, h);
+    ihdr[8] = 8;        /* bit depth */
+    ihdr[9] = 6;        /* RGBA */
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    if (fwrite(sig, 1, 8, f) != 8 || write_chunk(f, "IHDR", ihdr, sizeof(ihdr)))
+        err = IMAGE_ERR_GENERIC;
+
+    /* write the groups in order as they get done */
+    adler = adler32(0, NULL, 0);
+    for (g = 0; g < wr.ngroups && err == 0; g++) {
+        grp = &wr.groups[g];
+        pthread_mutex_lock(&wr.lock);
+        while (!grp->done)
+            pthread_cond_wait(&wr.done, &wr.lock);
+        pthread_mutex_unlock(&wr.lock);
+        if (grp->err) {
+            err = grp->err;
+            break;
+        }
+        if (g == 0) {
+            flevel = level < 0 || level == 6 ? 2 : level < 2 ? 0 : level < 6 ? 1 : 3;
+            grp->buf[0] = 0x78;
+            grp->buf[1] = flevel << 6;
+            grp->buf[1] += 31 - (0x78 * 256 + grp->buf[1]) % 31;
+        }
+        adler = adler32_combine(adler, grp->adler, grp->rawlen);
+        if (g == wr.ngroups - 1) {
+            put_be32(grp->buf + grp->len, adler);
+            grp->len += 4;
+        }
+        if (write_chunk(f, "IDAT", grp->buf, grp->len))
+            err = IMAGE_ERR_GENERIC;
+        free(grp->buf);
+        grp->buf = NULL;
+    }
+    if (err == 0 && write_chunk(f, "IEND", NULL, 0))
+        err = IMAGE_ERR_GENERIC;
+
+    pthread_mutex_lock(&wr.lock);
+    wr.abort = 1;
+    pthread_mutex_unlock(&wr.lock);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    for (g = 0; g < wr.ngroups; g++)
+        free(wr.groups[g].buf);
+    free(wr.groups);
+    free(wr.zeros);
+    pthread_mutex_destroy(&wr.lock);
+    pthread_cond_destroy(&wr.done);
+    return err;
+}
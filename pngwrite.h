@@ -0,0 +1,26 @@
+/* *******************************************************************
+ *                          pngwrite.h
+ * A PNG writer for big RGBA images that compresses on all cores.
+ * The rows are split in groups; each thread filters a group and
+ * deflates it on its own, starting from the last 32K of the group
+ * before as dictionary, and ends it with a full flush. The pieces put
+ * one after the other are a single zlib stream, which goes out as one
+ * IDAT chunk per group: the file is a plain PNG.
+ *
+ * *******************************************************************/
+
+#ifndef PNGWRITE_H_INCLUDED
+#define PNGWRITE_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* rows are grouped so that a group has about this many bytes */
+#define PNGWRITE_GROUP_SIZE (1u << 20)
+
+size_t  pngwrite_groups(uint32_t w, uint32_t h);
+int     pngwrite_rgba(FILE *f, const unsigned char *data, uint32_t w, uint32_t h,
+                      int level, int nthreads);
+
+#endif
@@ -0,0 +1,560 @@
+/* *******************************************************************
+ *                          rawimage.c
+ * Netpbm, QOI and BMP decoders.
+ * Every function returns the same IMAGE_ERR_* codes as pngimage, with
+ * IMAGE_ERR_BADDATA for anything malformed, truncated or unsupported.
+ *
+ * *******************************************************************/
+
+#include "rawimage.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "pngimage.h"
+
+/* no image is bigger than this on either side; it also keeps every size
+ * computation below from overflowing */
+#define MAXDIM (1u << 24)
+
+static uint32_t get_le16(const unsigned char *p) { return p[0] | p[1] << 8; }
+static uint32_t get_le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24; }
+static uint32_t get_be32(const unsigned char *p) { return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+/* Tells if buf starts like a BMP: "BM" alone could be the start of
+ * anything, so the size of the DIB header must be one of the known ones,
+ * and the file must be long enough for the two headers. */
+static int is_bmp(const unsigned char *buf, size_t len)
+{
+    uint32_t hsize;
+
+    if (len < 26 || buf[0] != 'B' || buf[1] != 'M')
+        return 0;
+    hsize = get_le32(buf + 14);
+    if (hsize == 12)                /* OS/2 BITMAPCOREHEADER */
+        return 1;
+    return len >= 54 && (hsize == 40 || hsize == 52 || hsize == 56 || hsize == 64
+                      || hsize == 108 || hsize == 124);
+}
+
+int rawimage_sniff(const unsigned char *buf, size_t len)
+{
+    static const unsigned char pngsig[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+
+    if (len >= 8 && memcmp(buf, pngsig, 8) == 0)
+        return IMAGE_FORMAT_PNG;
+    if (len >= 3 && buf[0] == 'P' && buf[1] >= '5' && buf[1] <= '7' && isspace(buf[2]))
+        return IMAGE_FORMAT_PNM;
+    if (len >= 4 && memcmp(buf, "qoif", 4) == 0)
+        return IMAGE_FORMAT_QOI;
+    if (is_bmp(buf, len))
+        return IMAGE_FORMAT_BMP;
+    return IMAGE_FORMAT_UNKNOWN;
+}
+
+static int reserve_row(RawImage *img)
+{
+    size_t size = (size_t) img->w * img->ch;
+    unsigned char *tmp;
+
+    if (img->rowcap >= size)
+        return 0;
+    tmp = realloc(img->rowbuf, size);
+    if (!tmp)
+        return IMAGE_ERR_NOMEM;
+    img->rowbuf = tmp;
+    img->rowcap = size;
+    return 0;
+}
+
+/* netpbm */
+
+/* Reads an unsigned decimal number, skipping whitespace and comments
+ * before it. Returns 0 if there's none. */
+static unsigned long pnm_number(const unsigned char **p, const unsigned char *end)
+{
+    unsigned long n = 0;
+
+    while (*p < end && (isspace(**p) || **p == '#')) {
+        if (**p == '#')
+            while (*p < end && **p != '\n')
+                (*p)++;
+        else
+            (*p)++;
+    }
+    while (*p < end && isdigit(**p) && n < MAXDIM * 4ul)
+        n = n * 10 + (*(*p)++ - '0');
+    return n;
+}
+
+/* Reads a PAM header, from after "P7" to after ENDHDR. */
+static int pam_header(RawImage *img, const unsigned char **p, const unsigned char *end)
+{
+    char key[16];
+    int i;
+
+    for (;;) {
+        while (*p < end && isspace(**p))
+            (*p)++;
+        if (*p < end && **p == '#') {
+            while (*p < end && **p != '\n')
+                (*p)++;
+            continue;
+        }
+        for (i = 0; *p < end && !isspace(**p) && i < (int) sizeof(key) - 1; i++)
+            key[i] = *(*p)++;
+        key[i] = '\0';
+        if (strcmp(key, "ENDHDR") == 0)
+            break;
+        else if (strcmp(key, "WIDTH") == 0)
+            img->w = pnm_number(p, end);
+        else if (strcmp(key, "HEIGHT") == 0)
+            img->h = pnm_number(p, end);
+        else if (strcmp(key, "DEPTH") == 0)
+            img->depth = pnm_number(p, end);
+        else if (strcmp(key, "MAXVAL") == 0)
+            img->maxval = pnm_number(p, end);
+        else if (strcmp(key, "TUPLTYPE") == 0) {
+            /* the depth is enough to know what the samples are */
+            while (*p < end && **p != '\n')
+                (*p)++;
+        } else
+            return IMAGE_ERR_BADDATA;
+    }
+    /* ENDHDR is followed by a single newline */
+    if (*p >= end || **p != '\n')
+        return IMAGE_ERR_BADDATA;
+    (*p)++;
+    return 0;
+}
+
+static int pnm_open(RawImage *img, const unsigned char *buf, size_t len)
+{
+    const unsigned char *p = buf + 2, *end = buf + len;
+    int err, bps;
+
+    img->depth = buf[1] == '5' ? 1 : 3;
+    if (buf[1] == '7') {
+        img->w = img->h = img->maxval = img->depth = 0;
+        err = pam_header(img, &p, end);
+        if (err != 0)
+            return err;
+    } else {
+        img->w = pnm_number(&p, end);
+        img->h = pnm_number(&p, end);
+        img->maxval = pnm_number(&p, end);
+        /* a single whitespace character separates the header from the
+         * samples */
+        if (p >= end || !isspace(*p))
+            return IMAGE_ERR_BADDATA;
+        p++;
+    }
+    if (img->w == 0 || img->h == 0 || img->w > MAXDIM || img->h > MAXDIM
+     || img->maxval == 0 || img->maxval > 65535 || img->depth < 1 || img->depth > 4)
+        return IMAGE_ERR_BADDATA;
+
+    bps = img->maxval > 255 ? 2 : 1;
+    img->stride = (size_t) img->w * img->depth * bps;
+    if ((size_t) (end - p) / img->stride < img->h)
+        return IMAGE_ERR_BADDATA;
+    img->data = p;
+    img->end = end;
+    img->ch = img->depth == 2 || img->depth == 4 ? 4 : 3;
+    if (img->maxval < 255)
+        for (unsigned v = 0; v <= img->maxval; v++)
+            img->scale[v] = (v * 255 + img->maxval / 2) / img->maxval;
+    return 0;
+}
+
+static unsigned char pnm_sample(const RawImage *img, const unsigned char *s)
+{
+    unsigned v;
+
+    if (img->maxval > 255) {
+        v = s[0] << 8 | s[1];
+        if (v > img->maxval)
+            v = img->maxval;
+        return (v * 255 + img->maxval / 2) / img->maxval;
+    }
+    if (img->maxval == 255)
+        return s[0];
+    return s[0] > img->maxval ? 255 : img->scale[s[0]];
+}
+
+static int pnm_row(RawImage *img, unsigned char **row)
+{
+    const unsigned char *src = img->data + img->row * img->stride;
+    int bps = img->maxval > 255 ? 2 : 1;
+    unsigned char *dst;
+    uint32_t x;
+
+    /* RGB and RGBA with 8-bit samples are already what's wanted */
+    if (img->maxval == 255 && img->depth >= 3) {
+        *row = (unsigned char *) src;
+        return 0;
+    }
+    if (reserve_row(img) != 0)
+        return IMAGE_ERR_NOMEM;
+    dst = img->rowbuf;
+    for (x = 0; x < img->w; x++) {
+        if (img->depth <= 2) {      /* gray, and maybe alpha */
+            dst[0] = dst[1] = dst[2] = pnm_sample(img, src);
+            if (img->depth == 2)
+                dst[3] = pnm_sample(img, src + bps);
+        } else {
+            dst[0] = pnm_sample(img, src);
+            dst[1] = pnm_sample(img, src + bps);
+            dst[2] = pnm_sample(img, src + 2*bps);
+            if (img->depth == 4)
+                dst[3] = pnm_sample(img, src + 3*bps);
+        }
+        src += img->depth * bps;
+        dst += img->ch;
+    }
+    *row = img->rowbuf;
+    return 0;
+}
+
+/* QOI, see https://qoiformat.org/qoi-specification.pdf */
+
+#define QOI_OP_RGB   0xFE
+#define QOI_OP_RGBA  0xFF
+#define QOI_HASH(c) (((c).red * 3 + (c).green * 5 + (c).blue * 7 + (c).alpha * 11) % 64)
+#define QOI_PADDING 8
+
+static int qoi_open(RawImage *img, const unsigned char *buf, size_t len)
+{
+    if (len < 14 + QOI_PADDING)
+        return IMAGE_ERR_BADDATA;
+    img->w = get_be32(buf + 4);
+    img->h = get_be32(buf + 8);
+    img->ch = buf[12];
+    if (img->w == 0 || img->h == 0 || img->w > MAXDIM || img->h > MAXDIM
+     || (img->ch != 3 && img->ch != 4))
+        return IMAGE_ERR_BADDATA;
+    img->data = buf + 14;
+    img->end = buf + len - QOI_PADDING;
+    memset(img->index, 0, sizeof(img->index));
+    img->px.red = img->px.green = img->px.blue = 0;
+    img->px.alpha = 0xFF;
+    img->run = 0;
+    return reserve_row(img);
+}
+
+/* Decodes one row into img->rowbuf. QOI can only be decoded in order,
+ * so skipped rows go through here too. */
+static int qoi_row(RawImage *img, unsigned char **row)
+{
+    const unsigned char *p = img->data, *end = img->end;
+    unsigned char *dst = img->rowbuf;
+    Color px = img->px;
+    int run = img->run, b, vg;
+    uint32_t x;
+
+    for (x = 0; x < img->w; x++) {
+        if (run > 0)
+            run--;
+        else {
+            if (p >= end)
+                return IMAGE_ERR_BADDATA;
+            b = *p++;
+            if (b == QOI_OP_RGB || b == QOI_OP_RGBA) {
+                if (end - p < (b == QOI_OP_RGB ? 3 : 4))
+                    return IMAGE_ERR_BADDATA;
+                px.red = *p++;
+                px.green = *p++;
+                px.blue = *p++;
+                if (b == QOI_OP_RGBA)
+                    px.alpha = *p++;
+            } else if ((b & 0xC0) == 0x00) {   /* index */
+                px = img->index[b];
+            } else if ((b & 0xC0) == 0x40) {   /* diff */
+                px.red   += ((b >> 4) & 3) - 2;
+                px.green += ((b >> 2) & 3) - 2;
+                px.blue  += ( b       & 3) - 2;
+            } else if ((b & 0xC0) == 0x80) {   /* luma */
+                if (p >= end)
+                    return IMAGE_ERR_BADDATA;
+                vg = (b & 0x3F) - 32;
+                px.red   += vg - 8 + ((*p >> 4) & 0x0F);
+                px.green += vg;
+                px.blue  += vg - 8 + (*p & 0x0F);
+                p++;
+            } else                              /* run */
+                run = b & 0x3F;
+            img->index[QOI_HASH(px)] = px;
+        }
+        dst[0] = px.red;
+        dst[1] = px.green;
+        dst[2] = px.blue;
+        if (img->ch == 4)
+            dst[3] = px.alpha;
+        dst += img->ch;
+    }
+    img->data = p;
+    img->px = px;
+    img->run = run;
+    *row = img->rowbuf;
+    return 0;
+}
+
+/* BMP */
+
+#define BMP_RGB       0
+#define BMP_BITFIELDS 3
+#define BMP_ALPHABITFIELDS 6
+
+/* Turns a channel mask into a shift and the channel's maximum value. */
+static void bmp_mask(RawImage *img, int i, uint32_t mask)
+{
+    img->mask[i] = mask;
+    img->shift[i] = 0;
+    img->maxv[i] = 0;
+    if (mask == 0)
+        return;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        img->shift[i]++;
+    }
+    img->maxv[i] = mask;
+}
+
+static int bmp_open(RawImage *img, const unsigned char *buf, size_t len)
+{
+    uint32_t offset, hsize, compression, nplte, entsize;
+    int32_t w, h;
+    const unsigned char *plte;
+    size_t i;
+
+    if (len < 26)
+        return IMAGE_ERR_BADDATA;
+    offset = get_le32(buf + 10);
+    hsize = get_le32(buf + 14);
+    if (hsize == 12) {              /* OS/2 BITMAPCOREHEADER */
+        w = get_le16(buf + 18);
+        h = get_le16(buf + 20);
+        img->bpp = get_le16(buf + 24);
+        compression = BMP_RGB;
+        nplte = 0;
+        entsize = 3;
+    } else if (hsize >= 40 && len >= 54) {
+        w = (int32_t) get_le32(buf + 18);
+        h = (int32_t) get_le32(buf + 22);
+        img->bpp = get_le16(buf + 28);
+        compression = get_le32(buf + 30);
+        nplte = get_le32(buf + 46);
+        entsize = 4;
+    } else
+        return IMAGE_ERR_BADDATA;
+
+    /* -INT32_MIN doesn't fit */
+    if (h == INT32_MIN)
+        return IMAGE_ERR_BADDATA;
+    img->bottomup = h > 0;
+    if (h < 0)
+        h = -h;
+    if (w <= 0 || h <= 0 || (uint32_t) w > MAXDIM || (uint32_t) h > MAXDIM)
+        return IMAGE_ERR_BADDATA;
+    img->w = w;
+    img->h = h;
+    img->ch = 3;
+
+    switch (img->bpp) {
+    case 1: case 4: case 8:
+        if (compression != BMP_RGB)
+            return IMAGE_ERR_BADDATA;
+        if (nplte == 0 || nplte > (1u << img->bpp))
+            nplte = 1u << img->bpp;
+        /* some writers leave out the unused entries, even when the
+         * header says there's a full palette */
+        if (offset > 14 + hsize && (offset - 14 - hsize) / entsize < nplte)
+            nplte = (offset - 14 - hsize) / entsize;
+        plte = buf + 14 + hsize;
+        if (plte > buf + len || (size_t) (buf + len - plte) / entsize < nplte)
+            return IMAGE_ERR_BADDATA;
+        for (i = 0; i < nplte; i++) {
+            img->plte[i].blue  = plte[i*entsize + 0];
+            img->plte[i].green = plte[i*entsize + 1];
+            img->plte[i].red   = plte[i*entsize + 2];
+            img->plte[i].alpha = 0xFF;
+        }
+        /* indices past the palette are black, like most readers do */
+        for ( ; i < 256; i++)
+            img->plte[i].value = 0;
+        img->ncolors = nplte;
+        break;
+    case 16: case 32:
+        if (compression == BMP_BITFIELDS || compression == BMP_ALPHABITFIELDS) {
+            /* the masks follow a BITMAPINFOHEADER, and are part of the
+             * later headers, at the same place */
+            if (len < 66 + (compression == BMP_ALPHABITFIELDS || hsize >= 56 ? 4 : 0))
+                return IMAGE_ERR_BADDATA;
+            bmp_mask(img, 0, get_le32(buf + 54));
+            bmp_mask(img, 1, get_le32(buf + 58));
+            bmp_mask(img, 2, get_le32(buf + 62));
+            bmp_mask(img, 3, compression == BMP_ALPHABITFIELDS || hsize >= 56
+                             ? get_le32(buf + 66) : 0);
+        } else if (compression == BMP_RGB && img->bpp == 16) {
+            bmp_mask(img, 0, 0x7C00);
+            bmp_mask(img, 1, 0x03E0);
+            bmp_mask(img, 2, 0x001F);
+            bmp_mask(img, 3, 0);
+        } else if (compression == BMP_RGB) {
+            /* the fourth byte is unused */
+            bmp_mask(img, 0, 0x00FF0000);
+            bmp_mask(img, 1, 0x0000FF00);
+            bmp_mask(img, 2, 0x000000FF);
+            bmp_mask(img, 3, 0);
+        } else
+            return IMAGE_ERR_BADDATA;
+        if (img->maxv[0] == 0 || img->maxv[1] == 0 || img->maxv[2] == 0)
+            return IMAGE_ERR_BADDATA;
+        if (img->mask[3] != 0)
+            img->ch = 4;
+        break;
+    case 24:
+        if (compression != BMP_RGB)
+            return IMAGE_ERR_BADDATA;
+        break;
+    default:
+        return IMAGE_ERR_BADDATA;
+    }
+
+    img->stride = ((size_t) img->w * img->bpp + 31) / 32 * 4;
+    if (offset > len || (len - offset) / img->stride < img->h)
+        return IMAGE_ERR_BADDATA;
+    img->data = buf + offset;
+    img->end = buf + len;
+    return reserve_row(img);
+}
+
+static unsigned char bmp_channel(const RawImage *img, int i, uint32_t px)
+{
+    uint32_t v = (px & img->mask[i]) >> img->shift[i];
+
+    if (img->maxv[i] == 255)
+        return v;
+    return ((uint64_t) v * 255 + img->maxv[i] / 2) / img->maxv[i];
+}
+
+static int bmp_row(RawImage *img, unsigned char **row)
+{
+    uint32_t y = img->bottomup ? img->h - 1 - img->row : img->row;
+    const unsigned char *src = img->data + y * img->stride;
+    unsigned char *dst = img->rowbuf;
+    uint32_t x, px;
+    int bit, idx;
+    Color c;
+
+    switch (img->bpp) {
+    case 1: case 4: case 8:
+        for (x = 0; x < img->w; x++) {
+            bit = x * img->bpp;
+            idx = (src[bit / 8] >> (8 - img->bpp - bit % 8)) & ((1 << img->bpp) - 1);
+            c = img->plte[idx];
+            *dst++ = c.red;
+            *dst++ = c.green;
+            *dst++ = c.blue;
+        }
+        break;
+    case 24:
+        for (x = 0; x < img->w; x++, src += 3) {
+            *dst++ = src[2];
+            *dst++ = src[1];
+            *dst++ = src[0];
+        }
+        break;
+    default:
+        for (x = 0; x < img->w; x++) {
+            if (img->bpp == 16) {
+                px = get_le16(src);
+                src += 2;
+            } else {
+                px = get_le32(src);
+                src += 4;
+            }
+            *dst++ = bmp_channel(img, 0, px);
+            *dst++ = bmp_channel(img, 1, px);
+            *dst++ = bmp_channel(img, 2, px);
+            if (img->ch == 4)
+                *dst++ = bmp_channel(img, 3, px);
+        }
+    }
+    *row = img->rowbuf;
+    return 0;
+}
+
+/* Reads the header of the image at buf, which must be PNM, QOI or BMP.
+ * img->rowbuf is kept from the last image. buf must stay around until
+ * the last row has been read. */
+int rawimage_open(RawImage *img, const unsigned char *buf, size_t len)
+{
+    if (!img || !buf)
+        return IMAGE_ERR_BADPARAM;
+    img->format = rawimage_sniff(buf, len);
+    img->row = 0;
+    switch (img->format) {
+    case IMAGE_FORMAT_PNM: return pnm_open(img, buf, len);
+    case IMAGE_FORMAT_QOI: return qoi_open(img, buf, len);
+    case IMAGE_FORMAT_BMP: return bmp_open(img, buf, len);
+    }
+    return IMAGE_ERR_NOTIMAGE;
+}
+
+/* Decodes the next row; *row points to it until the next call. */
+int rawimage_next_row(RawImage *img, unsigned char **row)
+{
+    int err = IMAGE_ERR_BADPARAM;
+
+    if (img->row >= img->h)
+        return IMAGE_ERR_BADPARAM;
+    switch (img->format) {
+    case IMAGE_FORMAT_PNM: err = pnm_row(img, row); break;
+    case IMAGE_FORMAT_QOI: err = qoi_row(img, row); break;
+    case IMAGE_FORMAT_BMP: err = bmp_row(img, row); break;
+    }
+    if (err == 0)
+        img->row++;
+    return err;
+}
+
+/* Skips n rows. Only QOI needs to decode them. */
+int rawimage_skip_rows(RawImage *img, uint32_t n)
+{
+    unsigned char *row;
+    int err;
+
+    if (n > img->h - img->row)
+        n = img->h - img->row;
+    if (img->format != IMAGE_FORMAT_QOI) {
+        img->row += n;
+        return 0;
+    }
+    for ( ; n > 0; n--)
+        if (err = rawimage_next_row(img, &row), err != 0)
+            return err;
+    return 0;
+}
+
+/* Returns an upper bound on the number of colors in an opened image,
+ * from its header alone. */
+size_t rawimage_max_colors(const RawImage *img)
+{
+    size_t bound = (size_t) img->w * img->h;
+
+    /* a short palette leaves room for black, which indices past it are */
+    if (img->format == IMAGE_FORMAT_BMP && img->bpp <= 8
+     && img->ncolors + (img->ncolors < 1u << img->bpp) < bound)
+        bound = img->ncolors + (img->ncolors < 1u << img->bpp);
+    if (img->format == IMAGE_FORMAT_PNM && img->depth == 1
+     && (img->maxval > 255 ? 256 : img->maxval + 1) < bound)
+        bound = img->maxval > 255 ? 256 : img->maxval + 1;
+    return bound;
+}
+
+void rawimage_free(RawImage *img)
+{
+    free(img->rowbuf);
+    img->rowbuf = NULL;
+    img->rowcap = 0;
+}
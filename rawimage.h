@@ -0,0 +1,67 @@
+/* *******************************************************************
+ *                          rawimage.h
+ * Decoders for the uncompressed (or nearly) formats a renderer can
+ * write directly, so that no PNG has to be encoded and decoded:
+ *  - binary netpbm: PGM (P5), PPM (P6) and PAM (P7), maxval up to 65535
+ *  - QOI
+ *  - BMP without compression: 1, 4, 8, 16, 24 and 32 bits per pixel,
+ *    BI_RGB or BI_BITFIELDS
+ * Images are read from memory one row at a time, like pngimage_open_mem
+ * and pngimage_next_row do, and rows come out as 8-bit RGB or RGBA.
+ * PPM and PAM rows that are already in that form aren't copied.
+ * rawimage_sniff tells which decoder, PNG included, a buffer needs.
+ *
+ * *******************************************************************/
+
+#ifndef RAWIMAGE_H_INCLUDED
+#define RAWIMAGE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+enum {
+    IMAGE_FORMAT_UNKNOWN,
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_PNM,
+    IMAGE_FORMAT_QOI,
+    IMAGE_FORMAT_BMP,
+};
+
+typedef struct _rawimage {
+    int format;
+    uint32_t w, h;
+    uint32_t row;               /* next row to be read */
+    int ch;                     /* channels of the rows returned: 3 or 4 */
+    const unsigned char *data;  /* first row; for QOI, what's left to decode */
+    const unsigned char *end;
+    size_t stride;              /* bytes from one row to the next */
+    /* netpbm */
+    int depth;                  /* samples per pixel */
+    unsigned maxval;
+    unsigned char scale[256];   /* sample to 8 bits, for maxval < 255 */
+    /* BMP */
+    int bpp, bottomup;
+    uint32_t mask[4];           /* red, green, blue, alpha */
+    int shift[4];
+    uint32_t maxv[4];
+    Color plte[256];
+    size_t ncolors;
+    /* QOI */
+    Color index[64];
+    Color px;
+    int run;
+    unsigned char *rowbuf;
+    size_t rowcap;
+} RawImage;
+
+#define RAWIMAGE_INIT { 0 }
+
+int     rawimage_sniff(const unsigned char *buf, size_t len);
+int     rawimage_open(RawImage *img, const unsigned char *buf, size_t len);
+int     rawimage_next_row(RawImage *img, unsigned char **row);
+int     rawimage_skip_rows(RawImage *img, uint32_t n);
+size_t  rawimage_max_colors(const RawImage *img);
+void    rawimage_free(RawImage *img);
+
+#endif
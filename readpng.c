@@ -69,13 +69,6 @@
 #  define png_jmpbuf(png_ptr)   ((png_ptr)->jmpbuf)
 #endif
 
-static png_structp png_ptr = NULL;
-static png_infop info_ptr = NULL;
-
-png_uint_32     width, height;
-int             bit_depth, color_type;
-unsigned char  *image_data = NULL;
-
 void readpng_version_info(void)
 {
     fprintf(stderr, "   Compiled with libpng %s; using libpng %s.\n", PNG_LIBPNG_VER_STRING, png_libpng_ver);
@@ -83,12 +76,14 @@ void readpng_version_info(void)
 }
 
 /* return value = 0 for success, 1 for bad sig, 2 for bad IHDR, 4 for no mem */
-int readpng_init(FILE *infile, unsigned long *pWidth, unsigned long *pHeight)
+int readpng_init(readpng_info *rp, FILE *infile, unsigned long *pWidth, unsigned long *pHeight)
 {
     unsigned char sig[8];
+    png_structp png_ptr;
+    png_infop info_ptr;
 
-    fread(sig, 1, 8, infile); /* check the file's signature to see if it is a png file */
-    if (!png_check_sig(sig, 8))
+    /* check the file's signature to see if it is a png file */
+    if (fread(sig, 1, 8, infile) != 8 || !png_check_sig(sig, 8))
         return 1;   /* bad signature */
 
     /* could pass pointers to user-defined error handlers instead of NULLs: */
@@ -119,22 +114,28 @@ int readpng_init(FILE *infile, unsigned long *pWidth, unsigned long *pHeight)
     /* alternatively, could make separate calls to png_get_image_width(),
      * etc., but want bit_depth and color_type for later [don't care about
      * compression_type and filter_type => NULLs] */
-    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
-    *pWidth = width;
-    *pHeight = height;
+    png_get_IHDR(png_ptr, info_ptr, &rp->width, &rp->height, &rp->bit_depth, &rp->color_type, NULL, NULL, NULL);
+    *pWidth = rp->width;
+    *pHeight = rp->height;
 
+    rp->png_ptr = png_ptr;
+    rp->info_ptr = info_ptr;
+    rp->image_data = NULL;
     return 0;
 }
 
 /* returns 0 if succeeds, 1 if fails due to no bKGD chunk, 2 if libpng error;
  * scales values to 8-bit if necessary */
-int readpng_get_bgcolor(unsigned char *red, unsigned char *green, unsigned char *blue)
+int readpng_get_bgcolor(readpng_info *rp, unsigned char *red, unsigned char *green, unsigned char *blue)
 {
+    png_structp png_ptr = rp->png_ptr;
+    png_infop info_ptr = rp->info_ptr;
     png_color_16p pBackground;
+    int bit_depth = rp->bit_depth, color_type = rp->color_type;
 
     /* setjmp() must be called in every function that calls a PNG-reading libpng function */
     if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        png_destroy_read_struct(&rp->png_ptr, &rp->info_ptr, NULL);
         return 2;
     }
 
@@ -168,14 +169,19 @@ int readpng_get_bgcolor(unsigned char *red, unsigned char *green, unsigned char
 }
 
 /* display_exponent == LUT_exponent * CRT_exponent */
-unsigned char *readpng_get_image(/*double display_exponent, */int *pChannels, unsigned long *pRowbytes)
+unsigned char *readpng_get_image(readpng_info *rp, /*double display_exponent, */int *pChannels, unsigned long *pRowbytes)
 {
-    png_uint_32 i, rowbytes;
+    png_structp png_ptr = rp->png_ptr;
+    png_infop   info_ptr = rp->info_ptr;
+    png_uint_32 i, rowbytes, height = rp->height;
+    int         bit_depth = rp->bit_depth, color_type = rp->color_type;
     png_bytep   row_pointers[height];
 
     /* setjmp() must be called in every function that calls a PNG-reading libpng function */
     if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        png_destroy_read_struct(&rp->png_ptr, &rp->info_ptr, NULL);
+        free(rp->image_data);
+        rp->image_data = NULL;
         return NULL;
     }
 
@@ -202,8 +208,8 @@ unsigned char *readpng_get_image(/*double display_exponent, */int *pChannels, un
     *pRowbytes = rowbytes = png_get_rowbytes(png_ptr, info_ptr);
     *pChannels = (int) png_get_channels(png_ptr, info_ptr);
 
-    if ((image_data = malloc(rowbytes*height)) == NULL) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    if ((rp->image_data = malloc(rowbytes*height)) == NULL) {
+        png_destroy_read_struct(&rp->png_ptr, &rp->info_ptr, NULL);
         return NULL;
     }
 
@@ -214,25 +220,25 @@ unsigned char *readpng_get_image(/*double display_exponent, */int *pChannels, un
 
     /* set the individual row_pointers to point at the correct offsets */
     for (i = 0;  i < height;  ++i)
-        row_pointers[i] = image_data + i*rowbytes;
+        row_pointers[i] = rp->image_data + i*rowbytes;
 
     png_read_image(png_ptr, row_pointers);  /* read the whole image */
     png_read_end(png_ptr, NULL);            /* and we're done */
 
-    return image_data;
+    return rp->image_data;
 }
 
 /* free_image_data == 1 => also free the image_data */
-void readpng_cleanup(int free_image_data)
+void readpng_cleanup(readpng_info *rp, int free_image_data)
 {
-    if (free_image_data && image_data) {
-        free(image_data);
-        image_data = NULL;
+    if (free_image_data && rp->image_data) {
+        free(rp->image_data);
+        rp->image_data = NULL;
     }
 
-    if (png_ptr && info_ptr) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        png_ptr = NULL;
-        info_ptr = NULL;
+    if (rp->png_ptr && rp->info_ptr) {
+        png_destroy_read_struct(&rp->png_ptr, &rp->info_ptr, NULL);
+        rp->png_ptr = NULL;
+        rp->info_ptr = NULL;
     }
 }
@@ -53,9 +53,30 @@
 
   ---------------------------------------------------------------------------*/
 
+#ifndef READPNG_H_INCLUDED
+#define READPNG_H_INCLUDED
+
+#include <stdio.h>
+#include <png.h>
+
+/* this is the main struct to be passed to any readpng functions. it holds
+ * what used to be file-level globals, so that more than one image can be
+ * read at a time (from different threads, too). initialize it to zero. */
+typedef struct _readpng_info {
+    png_structp     png_ptr;    /* these should be modified by readpng only */
+    png_infop       info_ptr;
+    png_uint_32     width;
+    png_uint_32     height;
+    int             bit_depth;
+    int             color_type;
+    unsigned char  *image_data;
+} readpng_info;
+
 /* prototypes for public functions in readpng.c */
 void            readpng_version_info(void);
-int             readpng_init(FILE *infile, unsigned long *pWidth, unsigned long *pHeight);
-int             readpng_get_bgcolor(unsigned char *bg_red, unsigned char *bg_green, unsigned char *bg_blue);
-unsigned char * readpng_get_image(/*double display_exponent, */int *pChannels, unsigned long *pRowbytes);
-void            readpng_cleanup(int free_image_data);
+int             readpng_init(readpng_info *rp, FILE *infile, unsigned long *pWidth, unsigned long *pHeight);
+int             readpng_get_bgcolor(readpng_info *rp, unsigned char *bg_red, unsigned char *bg_green, unsigned char *bg_blue);
+unsigned char * readpng_get_image(readpng_info *rp, /*double display_exponent, */int *pChannels, unsigned long *pRowbytes);
+void            readpng_cleanup(readpng_info *rp, int free_image_data);
+
+#endif
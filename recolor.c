@@ -0,0 +1,347 @@
+/* *******************************************************************
+ *                          recolor.c
+ * In-place color replacement. Files are written through a temporary
+ * file and rename(), so they're either all old or all new.
+ *
+ * *******************************************************************/
+
+#include "recolor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "color.h"
+#include "colorscan.h"
+#include "membuf.h"
+#include "replfile.h"
+
+#define INIT_CAP 64
+#define MAXTHREADS 64
+
+typedef struct {
+    const RecolorMap *map;
+    char **paths;
+    RecolorResult *res;
+    const size_t *todo;     /* indices into paths, one per file */
+    size_t n, next;
+    pthread_mutex_t lock;
+} Job;
+
+/* a path and the file it reaches */
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    size_t i;
+} FileId;
+
+static size_t recolor_hash(uint64_t key, size_t cap)
+{
+    return (key * 0x9E3779B97F4A7C15ull) >> 32 & (cap - 1);
+}
+
+static uint64_t recolor_key(uint32_t value, int alpha)
+{
+    return value | (uint64_t) (alpha != 0) << 32;
+}
+
+static const RecolorEntry *recolor_lookup(const RecolorMap *map, uint32_t value, int alpha)
+{
+    uint64_t key = recolor_key(value, alpha);
+    size_t i;
+
+    if (map->len == 0)
+        return NULL;
+    for (i = recolor_hash(key, map->cap); map->slots[i].used; i = (i + 1) & (map->cap - 1))
+        if (map->slots[i].key == key)
+            return &map->slots[i];
+    return NULL;
+}
+
+/* Adds or replaces the entry for key. */
+static int recolor_put(RecolorMap *map, uint64_t key, uint32_t value, int alpha)
+{
+    RecolorEntry *old = map->slots, *e;
+    size_t oldcap = map->cap, i;
+
+    /* keep the table at most half full */
+    if ((map->len + 1) * 2 > map->cap) {
+        map->cap = map->cap ? map->cap * 2 : INIT_CAP;
+        map->slots = calloc(map->cap, sizeof(RecolorEntry));
+        if (!map->slots) {
+            map->slots = old;
+            map->cap = oldcap;
+            return RECOLOR_ERR_NOMEM;
+        }
+        map->len = 0;
+        for (i = 0; i < oldcap; i++)
+            if (old[i].used)
+                recolor_put(map, old[i].key, old[i].value, old[i].alpha);
+        free(old);
+    }
+    for (i = recolor_hash(key, map->cap); map->slots[i].used; i = (i + 1) & (map->cap - 1))
+        if (map->slots[i].key == key)
+            break;
+    e = &map->slots[i];
+    map->len += !e->used;
+    e->key = key;
+    e->value = value;
+    e->alpha = alpha;
+    e->used = 1;
+    return 0;
+}
+
+/* Reads the map in buf: a pair of colors on each line, blank lines
+ * allowed. A later pair for the same color wins. On RECOLOR_ERR_FORMAT,
+ * *line is the number of the bad line.
+ * Returns RECOLOR_ERR_NOMEM, RECOLOR_ERR_FORMAT. */
+int recolor_load(RecolorMap *map, const char *buf, size_t len, size_t *line)
+{
+    const char *p = buf, *end = buf + len, *nl, *s;
+    Color col[3];
+    ColorMatch m[3];
+    int n, err;
+
+    for (*line = 1; p < end; p = nl ? nl + 1 : end, (*line)++) {
+        nl = memchr(p, '\n', end - p);
+        s = p;
+        for (n = 0; n < 3 && colorscan_match(&s, nl ? nl : end, &col[n], &m[n]) == 0; n++)
+            ;
+        if (n == 0) {
+            /* must be blank */
+            for (s = p; s < (nl ? nl : end) && (*s == ' ' || *s == '\t' || *s == '\r'); s++)
+                ;
+            if (s == (nl ? nl : end))
+                continue;
+        }
+        if (n != 2)
+            return RECOLOR_ERR_FORMAT;
+        err = recolor_put(map, recolor_key(col[0].value, m[0].alpha), col[1].value, m[1].alpha);
+        if (err != 0)
+            return err;
+    }
+    return 0;
+}
+
+static int isupperhex(const char *s, const char *end)
+{
+    for ( ; s < end; s++)
+        if (*s >= 'A' && *s <= 'F')
+            return 1;
+    return 0;
+}
+
+/* Writes value, with or without alpha, in the notation of m into out,
+ * which has room for 32 characters. Returns the length. */
+static int recolor_format(char *out, const ColorMatch *m, uint32_t value, int alpha)
+{
+    unsigned r, g, b, a;
+    const char *digits;
+    char astr[16];
+    int n = 0;
+
+    r = value >> (alpha ? 24 : 16) & 0xFF;
+    g = value >> (alpha ? 16 : 8) & 0xFF;
+    b = value >> (alpha ? 8 : 0) & 0xFF;
+    a = alpha ? value & 0xFF : 0xFF;
+    /* 0xRRGGBB is a number in code: more digits would change its
+     * meaning, so it keeps its six and the new alpha is dropped */
+    if (m->notation == COLORSCAN_HEX0X)
+        alpha = 0;
+
+    switch (m->notation) {
+    case COLORSCAN_HASH:
+    case COLORSCAN_HEX0X:
+        digits = isupperhex(m->start, m->end) ? "0123456789ABCDEF" : "0123456789abcdef";
+        if (m->notation == COLORSCAN_HASH)
+            out[n++] = '#';
+        else {
+            out[n++] = '0';
+            out[n++] = m->start[1];
+        }
+        if (m->digits <= 4 && r % 17 == 0 && g % 17 == 0 && b % 17 == 0 && a % 17 == 0) {
+            out[n++] = digits[r / 17];
+            out[n++] = digits[g / 17];
+            out[n++] = digits[b / 17];
+            if (alpha)
+                out[n++] = digits[a / 17];
+        } else {
+            out[n++] = digits[r >> 4];
+            out[n++] = digits[r & 15];
+            out[n++] = digits[g >> 4];
+            out[n++] = digits[g & 15];
+            out[n++] = digits[b >> 4];
+            out[n++] = digits[b & 15];
+            if (alpha) {
+                out[n++] = digits[a >> 4];
+                out[n++] = digits[a & 15];
+            }
+        }
+        return n;
+    default:
+        snprintf(astr, sizeof(astr), "%.3g", a / 255.0);
+        if (memchr(m->start, ',', m->end - m->start))
+            return alpha ? snprintf(out, 32, "rgba(%u, %u, %u, %s)", r, g, b, astr)
+                         : snprintf(out, 32, "rgb(%u, %u, %u)", r, g, b);
+        return alpha ? snprintf(out, 32, "rgb(%u %u %u / %s)", r, g, b, astr)
+                     : snprintf(out, 32, "rgb(%u %u %u)", r, g, b);
+    }
+}
+
+/* Replaces the colors of the file at path that are in map. The file is
+ * only written if at least one color changes; *replaced is how many did.
+ * If path is a symbolic link, the file it points to is replaced.
+ * Returns RECOLOR_ERR_NOMEM, RECOLOR_ERR_OPEN, RECOLOR_ERR_WRITE. */
+int recolor_file(const RecolorMap *map, const char *path, size_t *replaced)
+{
+    MemBuf in;
+    ReplFile out = { NULL };
+    char text[32];
+    const char *p, *end, *done;
+    const RecolorEntry *e;
+    Color col;
+    ColorMatch m;
+    int err, n;
+
+    *replaced = 0;
+    err = membuf_open(&in, path);
+    if (err != 0)
+        return err == MEMBUF_ERR_NOMEM ? RECOLOR_ERR_NOMEM : RECOLOR_ERR_OPEN;
+
+    p = done = (const char *) in.data;
+    end = p + in.len;
+    while (err == 0 && colorscan_match(&p, end, &col, &m) == 0) {
+        e = recolor_lookup(map, col.value, m.alpha);
+        if (!e)
+            continue;
+        n = recolor_format(text, &m, e->value, e->alpha);
+        if (n == m.end - m.start && memcmp(text, m.start, n) == 0)
+            continue;
+        /* the first change: only now is there something to write */
+        if (!out.f && replfile_open(&out, path) != 0) {
+            err = RECOLOR_ERR_WRITE;
+            break;
+        }
+        if (fwrite(done, 1, m.start - done, out.f) != (size_t) (m.start - done)
+         || fwrite(text, 1, n, out.f) != (size_t) n)
+            err = RECOLOR_ERR_WRITE;
+        done = m.end;
+        (*replaced)++;
+    }
+
+    if (out.f) {
+        if (err == 0 && fwrite(done, 1, end - done, out.f) != (size_t) (end - done))
+            err = RECOLOR_ERR_WRITE;
+        if (err == 0)
+            err = replfile_commit(&out) != 0 ? RECOLOR_ERR_WRITE : 0;
+        else
+            replfile_discard(&out);
+        if (err != 0)
+            *replaced = 0;
+    }
+    membuf_close(&in);
+    return err;
+}
+
+static void *recolor_worker(void *arg)
+{
+    Job *job = arg;
+    size_t i;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->n)
+            break;
+        i = job->todo[i];
+        job->res[i].err = recolor_file(job->map, job->paths[i], &job->res[i].replaced);
+    }
+    return NULL;
+}
+
+static int fileid_cmp(const void *a, const void *b)
+{
+    const FileId *x = a, *y = b;
+
+    if (x->dev != y->dev)
+        return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino)
+        return x->ino < y->ino ? -1 : 1;
+    return x->i < y->i ? -1 : x->i > y->i;
+}
+
+/* Fills todo with the indices of paths that reach a file no earlier path
+ * does: a file named twice, or through a symbolic link, must be done
+ * once, not by two threads at a time. Paths that can't be looked at are
+ * kept for recolor_file to report. Returns how many, or -1 for memory
+ * error. */
+static ptrdiff_t unique_files(char **paths, size_t n, size_t *todo)
+{
+    FileId *ids = malloc(n * sizeof(FileId));
+    char *dup = calloc(n, 1);
+    struct stat st;
+    size_t i, k = 0, ntodo = 0;
+
+    if (!ids || !dup) {
+        free(ids);
+        free(dup);
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+        if (stat(paths[i], &st) == 0)
+            ids[k++] = (FileId) { st.st_dev, st.st_ino, i };
+    qsort(ids, k, sizeof(FileId), fileid_cmp);
+    for (i = 1; i < k; i++)
+        if (ids[i].dev == ids[i-1].dev && ids[i].ino == ids[i-1].ino)
+            dup[ids[i].i] = 1;
+    for (i = 0; i < n; i++)
+        if (!dup[i])
+            todo[ntodo++] = i;
+    free(ids);
+    free(dup);
+    return ntodo;
+}
+
+/* Runs recolor_file on the n files in paths with up to nthreads threads,
+ * the calling one included. The outcome for paths[i] goes in res[i]; a
+ * path reaching the same file as an earlier one is left alone, with
+ * nothing replaced. */
+void recolor_files(const RecolorMap *map, char **paths, size_t n, int nthreads,
+                  RecolorResult *res)
+{
+    pthread_t threads[MAXTHREADS];
+    Job job = { map, paths, res, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+    size_t *todo = malloc(n * sizeof(size_t) + 1);
+    ptrdiff_t ntodo = todo ? unique_files(paths, n, todo) : -1;
+    size_t j;
+    int i, started = 0;
+
+    for (j = 0; j < n; j++)
+        res[j] = (RecolorResult) { ntodo < 0 ? RECOLOR_ERR_NOMEM : 0, 0 };
+    if (ntodo < 0) {
+        free(todo);
+        return;
+    }
+    job.todo = todo;
+    job.n = ntodo;
+    if (nthreads > MAXTHREADS)
+        nthreads = MAXTHREADS;
+    if ((size_t) nthreads > job.n)
+        nthreads = job.n;
+    for (i = 1; i < nthreads; i++)
+        if (pthread_create(&threads[started], NULL, recolor_worker, &job) == 0)
+            started++;
+    recolor_worker(&job);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(todo);
+}
+
+void recolor_free(RecolorMap *map)
+{
+    free(map->slots);
+    map->slots = NULL;
+    map->cap = map->len = 0;
+}
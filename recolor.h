@@ -0,0 +1,59 @@
+/* *******************************************************************
+ *                          recolor.h
+ * Replaces colors in text files, by a map of old to new colors.
+ * The map is a text file with one pair per line, in any notation
+ * colorscan knows:
+ *   #ff0000 #00ff00
+ *   rgb(0, 0, 255) #123
+ * Colors are looked up by value, so #f00, #FF0000 and rgb(255, 0, 0)
+ * in a file are all replaced by the first line. The new color is
+ * written in the notation of the one it replaces (#RGB only if it
+ * fits, digits in the same case), so that a 0xRRGGBB in C code stays
+ * C; it also stays six digits long, without the new color's alpha.
+ * Each file is scanned once, and only files where something changes
+ * are written: to a temporary file next to them, renamed over the
+ * original at the end. Many files are done in parallel, a file named
+ * twice (or through a link) only once.
+ *
+ * *******************************************************************/
+
+#ifndef RECOLOR_H_INCLUDED
+#define RECOLOR_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t key;       /* old color: value, and 1 << 32 if it has alpha */
+    uint32_t value;     /* new color */
+    int alpha;
+    int used;
+} RecolorEntry;
+
+typedef struct _recolormap {
+    RecolorEntry *slots;
+    size_t cap;         /* a power of two */
+    size_t len;
+} RecolorMap;
+
+#define RECOLORMAP_INIT { NULL, 0, 0 }
+
+typedef struct {
+    int err;
+    size_t replaced;
+} RecolorResult;
+
+enum {
+    RECOLOR_ERR_NOMEM = 1,
+    RECOLOR_ERR_FORMAT,
+    RECOLOR_ERR_OPEN,
+    RECOLOR_ERR_WRITE,
+};
+
+int     recolor_load(RecolorMap *map, const char *buf, size_t len, size_t *line);
+int     recolor_file(const RecolorMap *map, const char *path, size_t *replaced);
+void    recolor_files(const RecolorMap *map, char **paths, size_t n, int nthreads,
+                      RecolorResult *res);
+void    recolor_free(RecolorMap *map);
+
+#endif
@@ -0,0 +1,85 @@
+/* *******************************************************************
+ *                          replfile.c
+ * Files replaced through a temporary file and rename().
+ *
+ * *******************************************************************/
+
+#include "replfile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void replfile_free(ReplFile *rf)
+{
+    free(rf->path);
+    free(rf->tmpname);
+    rf->f = NULL;
+    rf->path = rf->tmpname = NULL;
+}
+
+/* Opens a temporary file next to the file at path, with the same
+ * permissions, for its new content.
+ * Returns REPLFILE_ERR_NOMEM, REPLFILE_ERR_OPEN. */
+int replfile_open(ReplFile *rf, const char *path)
+{
+    struct stat st;
+    int fd;
+
+    rf->f = NULL;
+    rf->tmpname = NULL;
+    rf->path = realpath(path, NULL);
+    if (!rf->path)
+        return errno == ENOMEM ? REPLFILE_ERR_NOMEM : REPLFILE_ERR_OPEN;
+    rf->tmpname = malloc(strlen(rf->path) + 8);
+    if (!rf->tmpname) {
+        replfile_free(rf);
+        return REPLFILE_ERR_NOMEM;
+    }
+    sprintf(rf->tmpname, "%s.XXXXXX", rf->path);
+    fd = mkstemp(rf->tmpname);
+    if (fd == -1) {
+        replfile_free(rf);
+        return REPLFILE_ERR_OPEN;
+    }
+    if (stat(rf->path, &st) == 0)
+        fchmod(fd, st.st_mode & 07777);
+    rf->f = fdopen(fd, "wb");
+    if (!rf->f) {
+        close(fd);
+        unlink(rf->tmpname);
+        replfile_free(rf);
+        return REPLFILE_ERR_NOMEM;
+    }
+    return 0;
+}
+
+/* Puts the new content in place of the old one. On failure the old file
+ * is left as it was. Either way rf is closed.
+ * Returns REPLFILE_ERR_WRITE. */
+int replfile_commit(ReplFile *rf)
+{
+    int err = 0;
+
+    if (fflush(rf->f) != 0 || fsync(fileno(rf->f)) != 0)
+        err = REPLFILE_ERR_WRITE;
+    if (fclose(rf->f) != 0)
+        err = REPLFILE_ERR_WRITE;
+    if (err == 0 && rename(rf->tmpname, rf->path) != 0)
+        err = REPLFILE_ERR_WRITE;
+    if (err != 0)
+        unlink(rf->tmpname);
+    replfile_free(rf);
+    return err;
+}
+
+/* Closes rf and removes the temporary file, keeping the old one. */
+void replfile_discard(ReplFile *rf)
+{
+    fclose(rf->f);
+    unlink(rf->tmpname);
+    replfile_free(rf);
+}
@@ -0,0 +1,32 @@
+/* *******************************************************************
+ *                          replfile.h
+ * Replacing a file as a whole: the new content is written to a
+ * temporary file next to it, with the same permissions, which is synced
+ * and renamed over the old one. Readers see either the old file or the
+ * new one, never half of it. If the path is a symbolic link, the file
+ * it points to is replaced.
+ *
+ * *******************************************************************/
+
+#ifndef REPLFILE_H_INCLUDED
+#define REPLFILE_H_INCLUDED
+
+#include <stdio.h>
+
+typedef struct _replfile {
+    FILE *f;            /* where the new content goes */
+    char *path;         /* the file being replaced, links resolved */
+    char *tmpname;
+} ReplFile;
+
+enum {
+    REPLFILE_ERR_NOMEM = 1,
+    REPLFILE_ERR_OPEN,
+    REPLFILE_ERR_WRITE,
+};
+
+int     replfile_open(ReplFile *rf, const char *path);
+int     replfile_commit(ReplFile *rf);
+void    replfile_discard(ReplFile *rf);
+
+#endif
@@ -0,0 +1,122 @@
+/* *******************************************************************
+ *                          rowpipe.c
+ * Single producer, single consumer ring of rows.
+ *
+ * *******************************************************************/
+
+#include "rowpipe.h"
+
+#include <stdlib.h>
+#include <sched.h>
+
+#define MINSLOTS 4
+#define MAXSLOTS 256
+#define SPINS 256
+
+static void rowpipe_wait(unsigned *spins)
+{
+    if (++*spins >= SPINS) {
+        sched_yield();
+        *spins = 0;
+    }
+}
+
+/* Gets p ready for a new image with rows of rowbytes bytes. The slots
+ * are only reallocated if they don't fit anymore.
+ * Returns ROWPIPE_ERR_NOMEM. */
+int rowpipe_reset(RowPipe *p, size_t rowbytes)
+{
+    uint32_t n = MINSLOTS;
+
+    while (n < MAXSLOTS && (size_t) n * 2 * rowbytes <= ROWPIPE_BYTES)
+        n *= 2;
+    if (p->cap < n * rowbytes) {
+        free(p->slots);
+        p->slots = malloc(n * rowbytes);
+        p->cap = p->slots ? n * rowbytes : 0;
+        if (!p->slots)
+            return ROWPIPE_ERR_NOMEM;
+    }
+    p->rowbytes = rowbytes;
+    p->nslots = n;
+    p->err = 0;
+    atomic_store(&p->head, 0);
+    atomic_store(&p->tail, 0);
+    atomic_store(&p->closed, 0);
+    atomic_store(&p->cancelled, 0);
+    return 0;
+}
+
+/* Producer: waits for a free slot and returns it, or NULL if the
+ * consumer cancelled. */
+unsigned char *rowpipe_slot(RowPipe *p)
+{
+    uint32_t head = atomic_load_explicit(&p->head, memory_order_relaxed);
+    unsigned spins = 0;
+
+    while (head - atomic_load_explicit(&p->tail, memory_order_acquire) == p->nslots) {
+        if (atomic_load_explicit(&p->cancelled, memory_order_relaxed))
+            return NULL;
+        rowpipe_wait(&spins);
+    }
+    if (atomic_load_explicit(&p->cancelled, memory_order_relaxed))
+        return NULL;
+    return p->slots + (head & (p->nslots - 1)) * p->rowbytes;
+}
+
+/* Producer: hands the slot from rowpipe_slot to the consumer. */
+void rowpipe_push(RowPipe *p)
+{
+    atomic_fetch_add_explicit(&p->head, 1, memory_order_release);
+}
+
+/* Producer: no more rows will come. err is what rowpipe_error returns. */
+void rowpipe_close(RowPipe *p, int err)
+{
+    p->err = err;
+    atomic_store_explicit(&p->closed, 1, memory_order_release);
+}
+
+/* Consumer: waits for the next row and returns it, or NULL once the
+ * producer closed and every row was taken. */
+const unsigned char *rowpipe_peek(RowPipe *p)
+{
+    uint32_t tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+    unsigned spins = 0;
+
+    while (atomic_load_explicit(&p->head, memory_order_acquire) == tail) {
+        /* head has to be checked again: rows may have been pushed right
+         * before closing */
+        if (atomic_load_explicit(&p->closed, memory_order_acquire)
+         && atomic_load_explicit(&p->head, memory_order_acquire) == tail)
+            return NULL;
+        rowpipe_wait(&spins);
+    }
+    return p->slots + (tail & (p->nslots - 1)) * p->rowbytes;
+}
+
+/* Consumer: gives the row from rowpipe_peek back to the producer. */
+void rowpipe_pop(RowPipe *p)
+{
+    atomic_fetch_add_explicit(&p->tail, 1, memory_order_release);
+}
+
+/* Consumer: stops the producer, which sees NULL from rowpipe_slot. */
+void rowpipe_cancel(RowPipe *p)
+{
+    atomic_store_explicit(&p->cancelled, 1, memory_order_relaxed);
+}
+
+/* Consumer: the error the producer closed with. Only valid after
+ * rowpipe_peek returned NULL. */
+int rowpipe_error(const RowPipe *p)
+{
+    return p->err;
+}
+
+void rowpipe_free(RowPipe *p)
+{
+    free(p->slots);
+    p->slots = NULL;
+    p->cap = 0;
+}
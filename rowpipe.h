@@ -0,0 +1,58 @@
+/* *******************************************************************
+ *                          rowpipe.h
+ * A ring of row slots between two threads: one decodes rows into it,
+ * the other takes them out and looks at their colors, so that inflating
+ * and deduplicating happen at the same time. There's exactly one
+ * producer and one consumer, and they only share two counters, so no
+ * lock is needed; a side that has to wait for the other spins for a
+ * little while, then yields.
+ *
+ *   producer                          consumer
+ *   while ((slot = rowpipe_slot(p)))  while ((row = rowpipe_peek(p))) {
+ *       fill slot, rowpipe_push(p)        use row, rowpipe_pop(p)
+ *   rowpipe_close(p, err)             }
+ *
+ * Either side can give up: the consumer with rowpipe_cancel, after which
+ * rowpipe_slot returns NULL, and the producer by closing early with an
+ * error, which rowpipe_error returns once the ring is drained.
+ *
+ * *******************************************************************/
+
+#ifndef ROWPIPE_H_INCLUDED
+#define ROWPIPE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* slots are added until the ring holds about this many bytes */
+#define ROWPIPE_BYTES (1u << 21)
+
+typedef struct _rowpipe {
+    unsigned char *slots;
+    size_t cap;                 /* bytes allocated for slots */
+    size_t rowbytes;
+    uint32_t nslots;            /* a power of two */
+    atomic_uint_fast32_t head;  /* rows pushed */
+    atomic_uint_fast32_t tail;  /* rows popped */
+    atomic_int closed, cancelled;
+    int err;                    /* from rowpipe_close; read after closed */
+} RowPipe;
+
+#define ROWPIPE_INIT { NULL, 0, 0, 0, 0, 0, 0, 0, 0 }
+
+enum {
+    ROWPIPE_ERR_NOMEM = 1,
+};
+
+int             rowpipe_reset(RowPipe *p, size_t rowbytes);
+unsigned char * rowpipe_slot(RowPipe *p);
+void            rowpipe_push(RowPipe *p);
+void            rowpipe_close(RowPipe *p, int err);
+const unsigned char *rowpipe_peek(RowPipe *p);
+void            rowpipe_pop(RowPipe *p);
+void            rowpipe_cancel(RowPipe *p);
+int             rowpipe_error(const RowPipe *p);
+void            rowpipe_free(RowPipe *p);
+
+#endif
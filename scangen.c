@@ -0,0 +1,396 @@
+/* *****************************************************************
+ *                      scangen.c
+ * Generates the tables of the color scanner (colorscan.c) at build
+ * time. Every notation is a regular expression; all of them are
+ * compiled together into a single DFA, so that the scanner looks at
+ * each byte once however many notations there are. The scanner takes
+ * the longest match, and among matches of the same length, the rule
+ * that comes first.
+ * Besides the colors, there are rules for words and for any other
+ * byte: "#define" is a word, not #DEF followed by "ine", and neither is
+ * "10x123456" a 0xRRGGBB. Words go on after a '#', so "abc#fed" is one
+ * word too, not "abc" and #FED.
+ * The regular expressions know ( ) | * + ? {m} {m,n} [a-z] [^...] . and
+ * \ to escape.
+ *
+ * Usage: scangen > scantab.h
+ *
+ * *****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
+
+#define MAXNODES 4096
+#define MAXNFA 8192
+#define MAXDFA 1024
+#define SETBYTES (MAXNFA / 8)
+
+#define HEX "[0-9A-Fa-f]"
+#define WS "[ \t\r\n]"
+#define NUM "([0-9]+(\\.[0-9]*)?|\\.[0-9]+)%?"
+
+static const struct {
+    const char *name;
+    const char *re;
+} rules[] = {
+    /* #RGB, #RGBA, #RRGGBB, #RRGGBBAA */
+    { "HASH",  "#(" HEX "{3}|" HEX "{4}|" HEX "{6}|" HEX "{8})" },
+    /* 0xRRGGBB */
+    { "HEX0X", "0[xX]" HEX "{6}" },
+    /* rgb(r, g, b), rgba(r, g, b, a), rgb(r g b / a) */
+    { "RGB",   "[rR][gG][bB][aA]?\\(" WS "*" NUM
+               "((" WS "*," WS "*" NUM "){2}(" WS "*," WS "*" NUM ")?"
+               "|(" WS "+" NUM "){2}(" WS "*/" WS "*" NUM ")?)" WS "*\\)" },
+    { "WORD",  "#?[0-9A-Za-z_]+(#[0-9A-Za-z_]+)*" },
+    { "OTHER", "." },
+};
+
+#define NRULES (sizeof(rules) / sizeof(rules[0]))
+
+/* regular expressions are parsed into a tree first, so that {m,n} can
+ * instantiate its operand more than once */
+enum { N_SET, N_CAT, N_ALT, N_STAR, N_PLUS, N_QUEST, N_REPEAT, N_EMPTY };
+
+typedef struct {
+    int type;
+    int a, b;                   /* operands */
+    int min, max;               /* N_REPEAT */
+    unsigned char set[32];      /* N_SET */
+} Node;
+
+typedef struct {
+    int eps[2];                 /* -1 if none */
+    int next;                   /* on a byte in set, -1 if none */
+    unsigned char set[32];
+    int rule;                   /* accepting for this rule, or -1 */
+} NfaState;
+
+static Node nodes[MAXNODES];
+static int nnodes;
+static NfaState nfa[MAXNFA];
+static int nnfa;
+
+static unsigned char dfa_sets[MAXDFA][SETBYTES];
+static int dfa_next[MAXDFA][256];
+static int dfa_rule[MAXDFA];
+static int ndfa;
+
+static const char *re_pos;
+
+static void die(const char *msg)
+{
+    error("%s\n", msg);
+    exit(1);
+}
+
+static int node_new(int type, int a, int b)
+{
+    if (nnodes == MAXNODES)
+        die("too many nodes");
+    memset(&nodes[nnodes], 0, sizeof(Node));
+    nodes[nnodes].type = type;
+    nodes[nnodes].a = a;
+    nodes[nnodes].b = b;
+    return nnodes++;
+}
+
+static void set_add(unsigned char *set, int c) { set[c >> 3] |= 1 << (c & 7); }
+static int set_has(const unsigned char *set, int c) { return set[c >> 3] >> (c & 7) & 1; }
+
+static int parse_alt(void);
+
+static int parse_atom(void)
+{
+    int n, c, neg, lo, hi;
+
+    c = (unsigned char) *re_pos++;
+    if (c == '(') {
+        n = parse_alt();
+        if (*re_pos++ != ')')
+            die("missing )");
+        return n;
+    }
+    n = node_new(N_SET, -1, -1);
+    if (c == '.') {
+        memset(nodes[n].set, 0xFF, 32);
+    } else if (c == '[') {
+        neg = *re_pos == '^';
+        re_pos += neg;
+        while (*re_pos && *re_pos != ']') {
+            lo = (unsigned char) *re_pos++;
+            if (lo == '\\')
+                lo = (unsigned char) *re_pos++;
+            hi = lo;
+            if (re_pos[0] == '-' && re_pos[1] && re_pos[1] != ']') {
+                hi = (unsigned char) re_pos[1];
+                re_pos += 2;
+            }
+            for (c = lo; c <= hi; c++)
+                set_add(nodes[n].set, c);
+        }
+        if (*re_pos++ != ']')
+            die("missing ]");
+        if (neg)
+            for (c = 0; c < 32; c++)
+                nodes[n].set[c] = ~nodes[n].set[c];
+    } else {
+        if (c == '\\')
+            c = (unsigned char) *re_pos++;
+        if (c == '\0')
+            die("unexpected end of expression");
+        set_add(nodes[n].set, c);
+    }
+    return n;
+}
+
+static int parse_repeat(void)
+{
+    int n = parse_atom(), r;
+    char *end;
+
+    for (;;) {
+        switch (*re_pos) {
+        case '*': n = node_new(N_STAR, n, -1); break;
+        case '+': n = node_new(N_PLUS, n, -1); break;
+        case '?': n = node_new(N_QUEST, n, -1); break;
+        case '{':
+            r = node_new(N_REPEAT, n, -1);
+            nodes[r].min = nodes[r].max = strtol(re_pos + 1, &end, 10);
+            if (*end == ',')
+                nodes[r].max = strtol(end + 1, &end, 10);
+            if (*end != '}' || nodes[r].max < nodes[r].min)
+                die("bad {m,n}");
+            re_pos = end;
+            n = r;
+            break;
+        default:
+            return n;
+        }
+        re_pos++;
+    }
+}
+
+static int parse_cat(void)
+{
+    int n = -1;
+
+    while (*re_pos && *re_pos != '|' && *re_pos != ')')
+        n = n == -1 ? parse_repeat() : node_new(N_CAT, n, parse_repeat());
+    return n == -1 ? node_new(N_EMPTY, -1, -1) : n;
+}
+
+static int parse_alt(void)
+{
+    int n = parse_cat();
+
+    while (*re_pos == '|') {
+        re_pos++;
+        n = node_new(N_ALT, n, parse_cat());
+    }
+    return n;
+}
+
+static int nfa_new(void)
+{
+    if (nnfa == MAXNFA)
+        die("too many NFA states");
+    memset(&nfa[nnfa], 0, sizeof(NfaState));
+    nfa[nnfa].eps[0] = nfa[nnfa].eps[1] = nfa[nnfa].next = nfa[nnfa].rule = -1;
+    return nnfa++;
+}
+
+static void nfa_eps(int from, int to)
+{
+    nfa[from].eps[nfa[from].eps[0] == -1 ? 0 : 1] = to;
+}
+
+/* Builds the NFA of node n between two new states, the usual way.
+ * Returns the start state; *out is the end state. */
+static int build(int n, int *out)
+{
+    int s, e, s1, e1, s2, e2, i;
+
+    switch (nodes[n].type) {
+    case N_SET:
+        s = nfa_new();
+        e = nfa_new();
+        nfa[s].next = e;
+        memcpy(nfa[s].set, nodes[n].set, 32);
+        break;
+    case N_EMPTY:
+        s = e = nfa_new();
+        break;
+    case N_CAT:
+        s = build(nodes[n].a, &e1);
+        s2 = build(nodes[n].b, &e);
+        nfa_eps(e1, s2);
+        break;
+    case N_ALT:
+        s = nfa_new();
+        e = nfa_new();
+        s1 = build(nodes[n].a, &e1);
+        s2 = build(nodes[n].b, &e2);
+        nfa_eps(s, s1);
+        nfa_eps(s, s2);
+        nfa_eps(e1, e);
+        nfa_eps(e2, e);
+        break;
+    case N_STAR:
+    case N_PLUS:
+    case N_QUEST:
+        s = nfa_new();
+        e = nfa_new();
+        s1 = build(nodes[n].a, &e1);
+        nfa_eps(s, s1);
+        if (nodes[n].type != N_PLUS)
+            nfa_eps(s, e);
+        if (nodes[n].type != N_QUEST)
+            nfa_eps(e1, s1);
+        nfa_eps(e1, e);
+        break;
+    case N_REPEAT:
+        /* min copies, then max - min optional ones */
+        s = e = nfa_new();
+        for (i = 0; i < nodes[n].max; i++) {
+            s1 = build(nodes[n].a, &e1);
+            nfa_eps(e, s1);
+            if (i >= nodes[n].min) {
+                e2 = nfa_new();
+                nfa_eps(e, e2);
+                nfa_eps(e1, e2);
+                e1 = e2;
+            }
+            e = e1;
+        }
+        break;
+    default:
+        die("bad node");
+    }
+    *out = e;
+    return s;
+}
+
+static void closure(unsigned char *set)
+{
+    int stack[MAXNFA], top = 0, i, j, t;
+
+    for (i = 0; i < nnfa; i++)
+        if (set_has(set, i))
+            stack[top++] = i;
+    while (top > 0) {
+        i = stack[--top];
+        for (j = 0; j < 2; j++) {
+            t = nfa[i].eps[j];
+            if (t != -1 && !set_has(set, t)) {
+                set_add(set, t);
+                stack[top++] = t;
+            }
+        }
+    }
+}
+
+/* Returns the DFA state for the NFA states in set, adding it if new. */
+static int dfa_state(const unsigned char *set)
+{
+    int i, r;
+
+    for (i = 0; i < ndfa; i++)
+        if (memcmp(dfa_sets[i], set, SETBYTES) == 0)
+            return i;
+    if (ndfa == MAXDFA)
+        die("too many DFA states");
+    memcpy(dfa_sets[ndfa], set, SETBYTES);
+    dfa_rule[ndfa] = -1;
+    for (i = 0; i < nnfa; i++) {
+        r = nfa[i].rule;
+        if (r != -1 && set_has(set, i) && (dfa_rule[ndfa] == -1 || r < dfa_rule[ndfa]))
+            dfa_rule[ndfa] = r;
+    }
+    return ndfa++;
+}
+
+int main(void)
+{
+    static unsigned char set[SETBYTES];
+    int start, end, s, r, i, c, d, classof[256], rep[256], nclasses = 0;
+    size_t k;
+
+    /* one NFA for all the rules, with a common start state */
+    start = nfa_new();
+    for (k = 0; k < NRULES; k++) {
+        nnodes = 0;
+        re_pos = rules[k].re;
+        r = parse_alt();
+        if (*re_pos != '\0')
+            die("unbalanced )");
+        s = build(r, &end);
+        nfa[end].rule = k;
+        nfa_eps(start, s);
+        /* the start state has more than two ways out: chain them */
+        if (k + 1 < NRULES) {
+            s = nfa_new();
+            nfa_eps(start, s);
+            start = s;
+        }
+    }
+
+    /* subset construction. state 0 is the dead state, 1 the start */
+    memset(set, 0, sizeof(set));
+    dfa_state(set);
+    set_add(set, 0);
+    closure(set);
+    dfa_state(set);
+    for (d = 0; d < ndfa; d++) {
+        for (c = 0; c < 256; c++) {
+            memset(set, 0, sizeof(set));
+            for (i = 0; i < nnfa; i++)
+                if (set_has(dfa_sets[d], i) && nfa[i].next != -1 && set_has(nfa[i].set, c))
+                    set_add(set, nfa[i].next);
+            closure(set);
+            dfa_next[d][c] = dfa_state(set);
+        }
+    }
+
+    /* bytes that go to the same states everywhere share a class */
+    for (c = 0; c < 256; c++) {
+        for (i = 0; i < nclasses; i++) {
+            for (d = 0; d < ndfa && dfa_next[d][c] == dfa_next[d][rep[i]]; d++)
+                ;
+            if (d == ndfa)
+                break;
+        }
+        if (i == nclasses)
+            rep[nclasses++] = c;
+        classof[c] = i;
+    }
+
+    printf("/* generated by scangen from the rules in scangen.c: don't edit */\n\n");
+    printf("#define SCAN_NSTATES %d\n#define SCAN_NCLASSES %d\n", ndfa, nclasses);
+    printf("#define SCAN_DEAD 0\n#define SCAN_START 1\n\n");
+    printf("enum {\n");
+    for (k = 0; k < NRULES; k++)
+        printf("    SCAN_%s = %zu,\n", rules[k].name, k + 1);
+    printf("};\n\n");
+    printf("static const unsigned char scan_class[256] = {");
+    for (c = 0; c < 256; c++)
+        printf("%s%d,", c % 16 == 0 ? "\n    " : " ", classof[c]);
+    printf("\n};\n\n");
+    printf("static const %s scan_next[SCAN_NSTATES][SCAN_NCLASSES] = {\n",
+           ndfa <= 256 ? "unsigned char" : "unsigned short");
+    for (d = 0; d < ndfa; d++) {
+        printf("    {");
+        for (i = 0; i < nclasses; i++)
+            printf("%s%d", i ? ", " : " ", dfa_next[d][rep[i]]);
+        printf(" },\n");
+    }
+    printf("};\n\n");
+    printf("/* the rule a state accepts, 0 if none */\n");
+    printf("static const unsigned char scan_rule[SCAN_NSTATES] = {");
+    for (d = 0; d < ndfa; d++)
+        printf("%s%d,", d % 16 == 0 ? "\n    " : " ", dfa_rule[d] + 1);
+    printf("\n};\n");
+    return 0;
+}
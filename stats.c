@@ -0,0 +1,127 @@
+/* *******************************************************************
+ *                          stats.c
+ * Phase timers and counters for --stats.
+ *
+ * *******************************************************************/
+
+#include "stats.h"
+
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+int             stats_mode = STATS_OFF;
+_Atomic uint64_t stats_counters[STATS_NCOUNTERS];
+
+static uint64_t phase_ns[STATS_NPHASES];
+static uint64_t start_ns, mark_ns;
+static int      curphase = STATS_OTHER;
+static _Thread_local int ownphases;     /* this thread called stats_start */
+
+static const char *phase_names[STATS_NPHASES] = {
+    "other", "io", "decode", "parse", "dedup", "output",
+};
+
+static const char *counter_names[STATS_NCOUNTERS] = {
+    "bytes_read", "pixels", "colors", "probes", "collisions",
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* peak resident set size in KiB, 0 if unknown */
+static long peak_rss_kb(void)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;     /* bytes on macOS */
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+}
+
+/* Parses the argument of --stats. A NULL argument means text.
+ * Returns -1 if the argument isn't valid. */
+int stats_parse_mode(const char *s)
+{
+    if (!s || strcmp(s, "text") == 0)
+        return STATS_TEXT;
+    if (strcmp(s, "json") == 0)
+        return STATS_JSON;
+    return -1;
+}
+
+void stats_start(int mode)
+{
+    stats_mode = mode;
+    ownphases = 1;
+    for (int i = 0; i < STATS_NCOUNTERS; i++)
+        atomic_store(&stats_counters[i], 0);
+    memset(phase_ns, 0, sizeof(phase_ns));
+    curphase = STATS_OTHER;
+    start_ns = mark_ns = now_ns();
+}
+
+/* Charges the time since the last switch to the current phase and makes
+ * phase the current one. Returns the previous phase, so that callers can
+ * go back to it. On other threads than stats_start's, returns phase. */
+int stats_enter(int phase)
+{
+    uint64_t now;
+    int prev = curphase;
+
+    if (!ownphases)
+        return phase;
+    now = now_ns();
+
+    phase_ns[curphase] += now - mark_ns;
+    mark_ns = now;
+    curphase = phase;
+    return prev;
+}
+
+void stats_print(FILE *f)
+{
+    int i;
+    double total;
+
+    if (stats_mode == STATS_OFF)
+        return;
+    stats_enter(curphase);
+    total = (now_ns() - start_ns) / 1e6;
+
+    if (stats_mode == STATS_JSON) {
+        fprintf(f, "{\"total_ms\":%.3f,\"phases_ms\":{", total);
+        for (i = 0; i < STATS_NPHASES; i++)
+            fprintf(f, "%s\"%s\":%.3f", i ? "," : "", phase_names[i], phase_ns[i] / 1e6);
+        fprintf(f, "},\"counters\":{");
+        for (i = 0; i < STATS_NCOUNTERS; i++)
+            fprintf(f, "%s\"%s\":%llu", i ? "," : "", counter_names[i],
+                    (unsigned long long) atomic_load(&stats_counters[i]));
+        fprintf(f, "},\"peak_rss_kb\":%ld}\n", peak_rss_kb());
+        return;
+    }
+
+    fprintf(f, "total        %12.3f ms\n", total);
+    for (i = 0; i < STATS_NPHASES; i++)
+        fprintf(f, "  %-10s %12.3f ms %5.1f%%\n", phase_names[i], phase_ns[i] / 1e6,
+                total > 0 ? phase_ns[i] / 1e4 / total : 0.0);
+    for (i = 0; i < STATS_NCOUNTERS; i++)
+        fprintf(f, "%-12s %12llu\n", counter_names[i],
+                (unsigned long long) atomic_load(&stats_counters[i]));
+    fprintf(f, "%-12s %12ld KiB\n", "peak_rss", peak_rss_kb());
+}
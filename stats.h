@@ -0,0 +1,60 @@
+/* *******************************************************************
+ *                          stats.h
+ * Phase timers and counters, printed by the tools with --stats.
+ * Time is accounted to one phase at a time: entering a phase closes
+ * the previous one, so the phases always add up to the total.
+ * When stats are off, every macro is a single branch.
+ * Counters may be bumped from any thread (the decoder's producer, the
+ * tile workers), so they are atomic. Phases belong to the thread that
+ * called stats_start: STATS_ENTER does nothing on other threads.
+ *
+ * *******************************************************************/
+
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+enum {
+    STATS_OTHER,
+    STATS_IO,
+    STATS_DECODE,
+    STATS_PARSE,
+    STATS_DEDUP,
+    STATS_OUTPUT,
+    STATS_NPHASES,
+};
+
+enum {
+    STATS_BYTES_READ,
+    STATS_PIXELS,
+    STATS_COLORS,
+    STATS_PROBES,
+    STATS_COLLISIONS,
+    STATS_NCOUNTERS,
+};
+
+enum {
+    STATS_OFF,
+    STATS_TEXT,
+    STATS_JSON,
+};
+
+extern int      stats_mode;
+extern _Atomic uint64_t stats_counters[STATS_NCOUNTERS];
+
+int     stats_parse_mode(const char *s);
+void    stats_start(int mode);
+int     stats_enter(int phase);
+void    stats_print(FILE *f);
+
+#define STATS_ENTER(phase) (stats_mode != STATS_OFF ? stats_enter(phase) : 0)
+#define STATS_ADD(counter, n) \
+    do { \
+        if (stats_mode != STATS_OFF) \
+            atomic_fetch_add_explicit(&stats_counters[(counter)], (n), memory_order_relaxed); \
+    } while (0)
+
+#endif
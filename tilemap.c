@@ -0,0 +1,211 @@
+/* *****************************************************************
+ *                      tilemap.c
+ * Cuts an image (a tileset, or a sprite sheet) in tiles and finds the
+ * distinct ones, counting tiles that are mirror images of another as
+ * the same unless --no-flips is given. Writes them to an atlas PNG and
+ * writes a binary tilemap that says which tile of the atlas goes where,
+ * and how it's flipped (see tileset.h for the format).
+ * Prints how many tiles there were and how many are left.
+ *
+ * *****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include "decoder.h"
+#include "membuf.h"
+#include "pngimage.h"
+#include "tilepal.h"
+#include "tileset.h"
+#include "stats.h"
+
+#define error(...) do { fprintf(stderr, "error: " __VA_ARGS__); } while (0)
+
+int writeatlas(const char *fname, const TileSet *ts, const Decoder *dec, uint32_t acols);
+int writemap(const char *fname, const TileSet *ts);
+void usage(const char *progname);
+
+/* Returns 1 for memory error and 2 for anything else (after printing
+ * what's wrong). */
+int writeatlas(const char *fname, const TileSet *ts, const Decoder *dec, uint32_t acols)
+{
+    Image atlas = { .ch = 4 };
+    FILE *f;
+    int err;
+
+    tileset_atlas_size(ts, acols, &atlas.w, &atlas.h);
+    atlas.data = malloc((size_t) atlas.w * atlas.h * 4);
+    if (!atlas.data)
+        return 1;
+    tileset_atlas(ts, dec->img.data, dec->img.ch, dec->img.rowbytes, acols, atlas.data);
+    f = fopen(fname, "wb");
+    if (!f) {
+        error("couldn't open %s\n", fname);
+        free(atlas.data);
+        return 2;
+    }
+    err = pngimage_write_image_rgba(&atlas, f);
+    if (fclose(f) != 0 && err == 0)
+        err = IMAGE_ERR_GENERIC;
+    free(atlas.data);
+    if (err == IMAGE_ERR_NOMEM)
+        return 1;
+    if (err != 0) {
+        error("couldn't write %s\n", fname);
+        return 2;
+    }
+    return 0;
+}
+
+/* Returns 2 for errors, after printing what's wrong. */
+int writemap(const char *fname, const TileSet *ts)
+{
+    FILE *f = fopen(fname, "wb");
+    int err;
+
+    if (!f) {
+        error("couldn't open %s\n", fname);
+        return 2;
+    }
+    err = tileset_write_map(f, ts);
+    if (fclose(f) != 0 || err != 0) {
+        error("couldn't write %s\n", fname);
+        return 2;
+    }
+    return 0;
+}
+
+void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [--stats[=text|json]] [--tiles=WxH] [--no-flips] [--columns=N]\n"
+                    "              image atlas.png tilemap\n"
+                    "Tiles are 8x8 unless --tiles is given; the atlas is about square unless\n"
+                    "--columns is given\n", progname);
+}
+
+int main(int argc, char **argv)
+{
+    MemBuf infile;
+    Decoder dec;
+    TileSet ts = TILESET_INIT;
+    uint32_t tw = 8, th = 8, acols = 0;
+    unsigned flags = TILESET_FLIPS;
+    unsigned long n;
+    size_t i, flipped = 0;
+    int err, opt, mode;
+    char *end;
+    const char *progname = *argv;
+    static const struct option longopts[] = {
+        { "stats",    optional_argument, NULL, 's' },
+        { "tiles",    required_argument, NULL, 't' },
+        { "no-flips", no_argument,       NULL, 'F' },
+        { "columns",  required_argument, NULL, 'c' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    while (opt = getopt_long(argc, argv, "", longopts, NULL), opt != -1) {
+        switch (opt) {
+        case 's':
+            mode = stats_parse_mode(optarg);
+            if (mode == -1) {
+                error("invalid stats format: %s\n", optarg);
+                return 1;
+            }
+            stats_start(mode);
+            break;
+        case 't':
+            if (tilepal_parse_size(optarg, &tw, &th) != 0) {
+                error("invalid tile size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'F':
+            flags &= ~TILESET_FLIPS;
+            break;
+        case 'c':
+            n = strtoul(optarg, &end, 10);
+            if (n == 0 || n > 65536 || *end != '\0') {
+                error("invalid number of columns: %s\n", optarg);
+                return 1;
+            }
+            acols = n;
+            break;
+        default:
+            usage(progname);
+            return 1;
+        }
+    }
+    if (argc - optind != 3) {
+        usage(progname);
+        return 1;
+    }
+
+    STATS_ENTER(STATS_IO);
+    err = membuf_open(&infile, argv[optind]);
+    if (err == MEMBUF_ERR_NOMEM) {
+        error("out of memory\n");
+        return 1;
+    } else if (err != 0) {
+        error("couldn't open %s\n", argv[optind]);
+        return 1;
+    }
+    STATS_ENTER(STATS_DECODE);
+    decoder_init(&dec);
+    err = decoder_read_image(&dec, infile.data, infile.len);
+    membuf_close(&infile);
+    switch (err) {
+    case 0:
+        break;
+    case IMAGE_ERR_NOTIMAGE:
+        error("%s: not an image file\n", argv[optind]);
+        return 1;
+    case IMAGE_ERR_BADDATA:
+        error("%s: malformed or unsupported image\n", argv[optind]);
+        return 1;
+    case IMAGE_ERR_NOMEM:
+        error("out of memory\n");
+        return 1;
+    default:
+        error("%s: libpng error\n", argv[optind]);
+        return 1;
+    }
+
+    STATS_ENTER(STATS_DEDUP);
+    err = tileset_build(&ts, dec.img.data, dec.img.w, dec.img.h, dec.img.ch, dec.img.rowbytes,
+                        tw, th, flags);
+    if (err == TILESET_ERR_NOMEM) {
+        error("out of memory\n");
+        return 1;
+    } else if (err != 0) {
+        error("%s: the image is %ux%u, which can't be cut in %ux%u tiles\n",
+              argv[optind], dec.img.w, dec.img.h, tw, th);
+        return 1;
+    }
+    if (acols == 0)
+        acols = ts.len ? ceil(sqrt(ts.len)) : 1;
+    if (acols > ts.len && ts.len != 0)
+        acols = ts.len;
+
+    STATS_ENTER(STATS_OUTPUT);
+    err = writeatlas(argv[optind+1], &ts, &dec, acols);
+    if (err == 0)
+        err = writemap(argv[optind+2], &ts);
+    if (err == 1)
+        error("out of memory\n");
+    if (err != 0)
+        return 1;
+    for (i = 0; i < (size_t) ts.cols * ts.rows; i++)
+        flipped += (ts.map[i] & (TILESET_HFLIP | TILESET_VFLIP)) != 0;
+    printf("%s: %zu tiles, %zu distinct, %zu flipped\n", argv[optind],
+           (size_t) ts.cols * ts.rows, ts.len, flipped);
+
+    if (stats_mode != STATS_OFF) {
+        fflush(stdout);
+        stats_print(stderr);
+    }
+    tileset_free(&ts);
+    decoder_free(&dec);
+    return 0;
+}
@@ -0,0 +1,200 @@
+/* *******************************************************************
+ *                          tilepal.c
+ * Per-tile palettes, in one pass over the rows.
+ *
+ * *******************************************************************/
+
+#include "tilepal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stats.h"
+
+#define MAXTHREADS 64
+
+typedef struct {
+    TilePal *tp;
+    const unsigned char *data;
+    uint32_t w, h;
+    int ch;
+    size_t stride;
+} Sheet;
+
+/* A thread's share of the work: the columns of tiles from first to end,
+ * and a set for each of them, cap slots apiece. A slot holds 1 + the
+ * index of a color in the tile's array, 0 if it's free. */
+typedef struct {
+    const Sheet *sheet;
+    uint32_t first, end;
+    uint32_t *slots;
+    size_t cap;
+    pthread_t thread;
+    int err;
+} Slice;
+
+/* Returns 0 if s isn't a valid size. */
+static uint32_t parse_side(const char *s, char **end)
+{
+    unsigned long n = strtoul(s, end, 10);
+
+    return *end == s || n == 0 || n > TILEPAL_MAX_SIZE ? 0 : n;
+}
+
+/* Reads a tile size, "WxH" or "N" for a square. Returns 1 if s isn't
+ * valid. */
+int tilepal_parse_size(const char *s, uint32_t *tw, uint32_t *th)
+{
+    char *end;
+
+    *tw = parse_side(s, &end);
+    if (*tw == 0)
+        return 1;
+    if (*end == '\0') {
+        *th = *tw;
+        return 0;
+    }
+    if (*end != 'x')
+        return 1;
+    *th = parse_side(end + 1, &end);
+    return *th == 0 || *end != '\0';
+}
+
+static inline size_t slot_hash(uint32_t value, size_t mask)
+{
+    return (size_t) ((value * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+static void *scan_slice(void *arg)
+{
+    Slice *sl = arg;
+    const Sheet *sh = sl->sheet;
+    TilePal *tp = sh->tp;
+    const unsigned char *row, *p;
+    uint32_t band, y, c, x, x0, x1, *slots, *len;
+    size_t mask = sl->cap - 1, i, tile;
+    Color col, *colors;
+
+    col.alpha = 0xFF;
+    for (band = 0; band < tp->rows; band++) {
+        memset(sl->slots, 0, (size_t) (sl->end - sl->first) * sl->cap * sizeof(uint32_t));
+        for (c = sl->first; c < sl->end; c++)
+            tp->len[(size_t) band * tp->cols + c] = 0;
+        for (y = band * tp->th; y < sh->h && y < (band + 1) * tp->th; y++) {
+            row = sh->data + (size_t) y * sh->stride;
+            for (c = sl->first; c < sl->end; c++) {
+                tile = (size_t) band * tp->cols + c;
+                colors = tp->colors + tile * tp->tw * tp->th;
+                len = &tp->len[tile];
+                slots = sl->slots + (size_t) (c - sl->first) * sl->cap;
+                x0 = c * tp->tw;
+                x1 = x0 + tp->tw < sh->w ? x0 + tp->tw : sh->w;
+                for (x = x0, p = row + (size_t) x0 * sh->ch; x < x1; x++, p += sh->ch) {
+                    col.red = p[0];
+                    col.green = p[1];
+                    col.blue = p[2];
+                    if (sh->ch == 4)
+                        col.alpha = p[3];
+                    /* a tile never has more colors than half its slots */
+                    for (i = slot_hash(col.value, mask); slots[i] != 0; i = (i + 1) & mask)
+                        if (colors[slots[i] - 1].value == col.value)
+                            break;
+                    if (slots[i] == 0) {
+                        colors[*len] = col;
+                        slots[i] = ++*len;
+                    }
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Fills tp with the palettes of the tw x th tiles of the image at data,
+ * which has h rows of w pixels, stride bytes apart, with ch (3 or 4)
+ * 8-bit channels, as pngimage returns them. Uses up to nthreads
+ * threads, the calling one included. tp's arrays are reused if they're
+ * big enough.
+ * Returns TILEPAL_ERR_BADPARAM, TILEPAL_ERR_NOMEM. */
+int tilepal_scan(TilePal *tp, const unsigned char *data, uint32_t w, uint32_t h, int ch,
+                 size_t stride, uint32_t tw, uint32_t th, int nthreads)
+{
+    Slice slices[MAXTHREADS];
+    Sheet sheet = { tp, data, w, h, ch, stride };
+    size_t ntiles, ncolors, cap;
+    Color *colors;
+    uint32_t *len;
+    int i, n, err = 0;
+
+    if (!tp || !data || (ch != 3 && ch != 4) || tw == 0 || th == 0
+     || tw > TILEPAL_MAX_SIZE || th > TILEPAL_MAX_SIZE)
+        return TILEPAL_ERR_BADPARAM;
+    tp->tw = tw;
+    tp->th = th;
+    tp->cols = (w + tw - 1) / tw;
+    tp->rows = (h + th - 1) / th;
+    ntiles = (size_t) tp->cols * tp->rows;
+    ncolors = ntiles * tw * th;
+    if (ncolors > tp->cap) {
+        colors = realloc(tp->colors, ncolors * sizeof(Color));
+        if (!colors)
+            return TILEPAL_ERR_NOMEM;
+        tp->colors = colors;
+        tp->cap = ncolors;
+    }
+    if (ntiles > tp->lencap) {
+        len = realloc(tp->len, ntiles * sizeof(uint32_t));
+        if (!len)
+            return TILEPAL_ERR_NOMEM;
+        tp->len = len;
+        tp->lencap = ntiles;
+    }
+    if (ntiles == 0)
+        return 0;
+    STATS_ADD(STATS_PIXELS, (uint64_t) w * h);
+
+    /* keep the sets at most half full */
+    for (cap = 8; cap < 2 * (size_t) tw * th; cap *= 2)
+        ;
+    if (nthreads > MAXTHREADS)
+        nthreads = MAXTHREADS;
+    if ((uint32_t) nthreads > tp->cols)
+        nthreads = tp->cols;
+    if (nthreads < 1)
+        nthreads = 1;
+    for (n = 0; n < nthreads; n++) {
+        slices[n].sheet = &sheet;
+        slices[n].first = (uint64_t) tp->cols * n / nthreads;
+        slices[n].end = (uint64_t) tp->cols * (n + 1) / nthreads;
+        slices[n].cap = cap;
+        slices[n].slots = malloc((slices[n].end - slices[n].first) * cap * sizeof(uint32_t));
+        if (!slices[n].slots) {
+            err = TILEPAL_ERR_NOMEM;
+            break;
+        }
+    }
+    if (err == 0) {
+        /* slices that don't get a thread are done here */
+        for (i = 1; i < n; i++)
+            slices[i].err = pthread_create(&slices[i].thread, NULL, scan_slice, &slices[i]);
+        scan_slice(&slices[0]);
+        for (i = 1; i < n; i++) {
+            if (slices[i].err == 0)
+                pthread_join(slices[i].thread, NULL);
+            else
+                scan_slice(&slices[i]);
+        }
+    }
+    for (i = 0; i < n; i++)
+        free(slices[i].slots);
+    return err;
+}
+
+void tilepal_free(TilePal *tp)
+{
+    free(tp->colors);
+    free(tp->len);
+    tp->colors = NULL;
+    tp->len = NULL;
+    tp->cap = tp->lencap = 0;
+}
@@ -0,0 +1,45 @@
+/* *******************************************************************
+ *                          tilepal.h
+ * The palette of every tile of a decoded image, for sprite sheets and
+ * tilesets. The image is cut in tiles of tw x th pixels, left to right
+ * and top to bottom; tiles on the right and bottom edges may be smaller.
+ * Every row is looked at once: each tile of the current band of rows
+ * has a small hash set of its own, emptied when the band is done, so
+ * the memory touched stays in cache. The columns of tiles are split
+ * among threads, each one going down its own slice of the rows.
+ * A tile's colors are in the order they're first found, reading the
+ * tile left to right and top to bottom.
+ *
+ * *******************************************************************/
+
+#ifndef TILEPAL_H_INCLUDED
+#define TILEPAL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "color.h"
+
+/* tiles can't be bigger than this on either side */
+#define TILEPAL_MAX_SIZE 256
+
+typedef struct _tilepal {
+    uint32_t tw, th;
+    uint32_t cols, rows;    /* number of tiles across and down */
+    Color *colors;          /* tile i's colors start at i * tw * th */
+    uint32_t *len;          /* number of colors of each tile */
+    size_t cap, lencap;     /* colors and tiles there's room for */
+} TilePal;
+
+enum {
+    TILEPAL_ERR_BADPARAM = 1,
+    TILEPAL_ERR_NOMEM,
+};
+
+#define TILEPAL_INIT { 0, 0, 0, 0, NULL, NULL, 0, 0 }
+
+int     tilepal_parse_size(const char *s, uint32_t *tw, uint32_t *th);
+int     tilepal_scan(TilePal *tp, const unsigned char *data, uint32_t w, uint32_t h, int ch,
+                     size_t stride, uint32_t tw, uint32_t th, int nthreads);
+void    tilepal_free(TilePal *tp);
+
+#endif
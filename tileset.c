@@ -0,0 +1,327 @@
+/* *******************************************************************
+ *                          tileset.c
+ * Distinct tiles of an image, through a hash table.
+ *
+ * *******************************************************************/
+
+#include "tileset.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+#define WRITE_CHUNK 4096
+
+/* where a tile is in the image, and which way it's read */
+typedef struct {
+    const unsigned char *data;
+    size_t stride;
+    int ch;
+    uint32_t tw, th, cols;
+} Sheet;
+
+static int little_endian(void)
+{
+    const uint32_t one = 1;
+    return *(const unsigned char *) &one == 1;
+}
+
+static void put_le16(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline const unsigned char *tile_start(const Sheet *sh, uint32_t tile)
+{
+    return sh->data + (size_t) (tile / sh->cols) * sh->th * sh->stride
+                    + (size_t) (tile % sh->cols) * sh->tw * sh->ch;
+}
+
+static inline uint32_t load_pixel(const unsigned char *p, int ch)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (ch == 4 ? (uint32_t) p[3] << 24 : 0xFF000000u);
+}
+
+/* Hashes the pixels of tile one at a time, in the order they'd be in
+ * with the tile mirrored as flip says, so that a tile and its mirror
+ * image read backwards hash the same. */
+static uint64_t hash_tile(const Sheet *sh, uint32_t tile, uint32_t flip)
+{
+    const unsigned char *row = tile_start(sh, tile), *p;
+    ptrdiff_t rowstep = sh->stride, step = sh->ch;
+    uint64_t h = 0x243F6A8885A308D3ull;
+    uint32_t x, y;
+
+    if (flip & TILESET_VFLIP) {
+        row += (size_t) (sh->th - 1) * sh->stride;
+        rowstep = -rowstep;
+    }
+    for (y = 0; y < sh->th; y++, row += rowstep) {
+        p = row;
+        if (flip & TILESET_HFLIP) {
+            p += (size_t) (sh->tw - 1) * sh->ch;
+            step = -sh->ch;
+        }
+        for (x = 0; x < sh->tw; x++, p += step) {
+            h = (h ^ load_pixel(p, sh->ch)) * 0x9E3779B97F4A7C15ull;
+            h ^= h >> 29;
+        }
+    }
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    return h ^ (h >> 32);
+}
+
+/* Returns 1 if tile b, mirrored as flip says, is the same as tile a. */
+static int same_tile(const Sheet *sh, uint32_t a, uint32_t b, uint32_t flip)
+{
+    const unsigned char *pa = tile_start(sh, a), *rowb = tile_start(sh, b), *pb;
+    size_t rowbytes = (size_t) sh->tw * sh->ch;
+    ptrdiff_t rowstep = sh->stride;
+    uint32_t x, y;
+
+    if (flip & TILESET_VFLIP) {
+        rowb += (size_t) (sh->th - 1) * sh->stride;
+        rowstep = -rowstep;
+    }
+    for (y = 0; y < sh->th; y++, pa += sh->stride, rowb += rowstep) {
+        if (!(flip & TILESET_HFLIP)) {
+            if (memcmp(pa, rowb, rowbytes) != 0)
+                return 0;
+            continue;
+        }
+        pb = rowb + rowbytes - sh->ch;
+        for (x = 0; x < rowbytes; x += sh->ch, pb -= sh->ch)
+            if (memcmp(pa + x, pb, sh->ch) != 0)
+                return 0;
+    }
+    return 1;
+}
+
+/* Returns the index of the distinct tile that tile is, mirrored as flip
+ * says, and that hashes to h, or -1 if there's none; *slot is where it
+ * would go. */
+static long find(const TileSet *ts, const Sheet *sh, uint32_t tile, uint32_t flip, uint64_t h,
+                 size_t *slot)
+{
+    size_t mask = ts->nslots - 1, i;
+    uint32_t u;
+
+    for (i = h & mask; ts->slots[i] != 0; i = (i + 1) & mask) {
+        STATS_ADD(STATS_PROBES, 1);
+        u = ts->slots[i] - 1;
+        if (ts->hash[u] == h && same_tile(sh, ts->first[u], tile, flip))
+            return u;
+        STATS_ADD(STATS_COLLISIONS, 1);
+    }
+    *slot = i;
+    return -1;
+}
+
+/* Doubles the table. Returns 1 for memory error. */
+static int grow(TileSet *ts)
+{
+    size_t n = ts->nslots ? ts->nslots * 2 : 1024, mask = n - 1, i, u;
+    uint32_t *slots = calloc(n, sizeof(uint32_t));
+
+    if (!slots)
+        return 1;
+    for (u = 0; u < ts->len; u++) {
+        for (i = ts->hash[u] & mask; slots[i] != 0; i = (i + 1) & mask)
+            ;
+        slots[i] = u + 1;
+    }
+    free(ts->slots);
+    ts->slots = slots;
+    ts->nslots = n;
+    return 0;
+}
+
+/* Adds tile as a new distinct tile with hash h, in slot. Returns 1 for
+ * memory error. */
+static int add(TileSet *ts, uint32_t tile, uint64_t h, size_t slot)
+{
+    uint32_t *first;
+    uint64_t *hash;
+    size_t cap;
+
+    if (ts->len == ts->cap) {
+        cap = ts->cap ? ts->cap * 2 : 256;
+        first = realloc(ts->first, cap * sizeof(uint32_t));
+        if (!first)
+            return 1;
+        ts->first = first;
+        hash = realloc(ts->hash, cap * sizeof(uint64_t));
+        if (!hash)
+            return 1;
+        ts->hash = hash;
+        ts->cap = cap;
+    }
+    ts->first[ts->len] = tile;
+    ts->hash[ts->len] = h;
+    ts->slots[slot] = ++ts->len;
+    return 0;
+}
+
+/* Finds the distinct tw x th tiles of the image at data, which has h
+ * rows of w pixels, stride bytes apart, with ch (3 or 4) 8-bit
+ * channels, and fills ts->map. flags can have TILESET_FLIPS. ts's
+ * arrays are reused if they're big enough.
+ * Returns TILESET_ERR_BADPARAM, TILESET_ERR_BADSIZE if w or h aren't
+ * multiples of the tile size, TILESET_ERR_NOMEM. */
+int tileset_build(TileSet *ts, const unsigned char *data, uint32_t w, uint32_t h, int ch,
+                  size_t stride, uint32_t tw, uint32_t th, unsigned flags)
+{
+    static const uint32_t flips[] = { TILESET_HFLIP, TILESET_VFLIP, TILESET_HFLIP | TILESET_VFLIP };
+    Sheet sh = { data, stride, ch, tw, th, 0 };
+    size_t ntiles, slot, fslot;
+    uint32_t tile, *map;
+    uint64_t h0, hf;
+    long u;
+    int f;
+
+    if (!ts || !data || (ch != 3 && ch != 4) || tw == 0 || th == 0)
+        return TILESET_ERR_BADPARAM;
+    if (w % tw != 0 || h % th != 0)
+        return TILESET_ERR_BADSIZE;
+    ts->tw = tw;
+    ts->th = th;
+    ts->cols = sh.cols = w / tw;
+    ts->rows = h / th;
+    ts->flags = flags;
+    ts->len = 0;
+    ntiles = (size_t) ts->cols * ts->rows;
+    if (ntiles > TILESET_INDEX)
+        return TILESET_ERR_BADSIZE;
+    if (ntiles > ts->mapcap) {
+        map = realloc(ts->map, ntiles * sizeof(uint32_t));
+        if (!map)
+            return TILESET_ERR_NOMEM;
+        ts->map = map;
+        ts->mapcap = ntiles;
+    }
+    if (ts->nslots == 0 && grow(ts) != 0)
+        return TILESET_ERR_NOMEM;
+    memset(ts->slots, 0, ts->nslots * sizeof(uint32_t));
+    STATS_ADD(STATS_PIXELS, (uint64_t) w * h);
+
+    for (tile = 0; tile < ntiles; tile++) {
+        h0 = hash_tile(&sh, tile, 0);
+        u = find(ts, &sh, tile, 0, h0, &slot);
+        if (u >= 0) {
+            ts->map[tile] = u;
+            continue;
+        }
+        for (f = 0; (flags & TILESET_FLIPS) && f < 3; f++) {
+            hf = hash_tile(&sh, tile, flips[f]);
+            u = find(ts, &sh, tile, flips[f], hf, &fslot);
+            if (u >= 0) {
+                ts->map[tile] = u | flips[f];
+                break;
+            }
+        }
+        if (u >= 0)
+            continue;
+        /* keep the table at most half full */
+        if (2 * (ts->len + 1) > ts->nslots) {
+            if (grow(ts) != 0)
+                return TILESET_ERR_NOMEM;
+            find(ts, &sh, tile, 0, h0, &slot);
+        }
+        ts->map[tile] = ts->len;
+        if (add(ts, tile, h0, slot) != 0)
+            return TILESET_ERR_NOMEM;
+    }
+    STATS_ADD(STATS_COLORS, ts->len);
+    return 0;
+}
+
+/* The size of an atlas of ts's distinct tiles, acols tiles across. */
+void tileset_atlas_size(const TileSet *ts, uint32_t acols, uint32_t *w, uint32_t *h)
+{
+    *w = acols * ts->tw;
+    *h = (ts->len + acols - 1) / acols * ts->th;
+}
+
+/* Draws ts's distinct tiles, taken from the image at data (the one ts
+ * was built from), acols tiles across, into out as 8-bit RGBA, with no
+ * padding between rows. Cells past the last tile are left transparent. */
+void tileset_atlas(const TileSet *ts, const unsigned char *data, int ch, size_t stride,
+                   uint32_t acols, unsigned char *out)
+{
+    Sheet sh = { data, stride, ch, ts->tw, ts->th, ts->cols };
+    const unsigned char *src, *p;
+    unsigned char *dst;
+    uint32_t aw, ah, x, y;
+    size_t u, outstride;
+
+    tileset_atlas_size(ts, acols, &aw, &ah);
+    outstride = (size_t) aw * 4;
+    memset(out, 0, outstride * ah);
+    for (u = 0; u < ts->len; u++) {
+        src = tile_start(&sh, ts->first[u]);
+        dst = out + (u / acols) * ts->th * outstride + (u % acols) * ts->tw * 4;
+        for (y = 0; y < ts->th; y++, src += stride, dst += outstride) {
+            if (ch == 4) {
+                memcpy(dst, src, (size_t) ts->tw * 4);
+                continue;
+            }
+            for (x = 0, p = src; x < ts->tw; x++, p += 3) {
+                dst[x*4 + 0] = p[0];
+                dst[x*4 + 1] = p[1];
+                dst[x*4 + 2] = p[2];
+                dst[x*4 + 3] = 0xFF;
+            }
+        }
+    }
+}
+
+/* Writes ts's tilemap to f, in the format described in tileset.h.
+ * Returns TILESET_ERR_WRITE. */
+int tileset_write_map(FILE *f, const TileSet *ts)
+{
+    unsigned char hdr[TILESET_HEADER_SIZE], chunk[WRITE_CHUNK];
+    size_t n = (size_t) ts->cols * ts->rows, i, j, len;
+
+    memcpy(hdr, TILESET_MAGIC, 4);
+    put_le16(hdr + 4, TILESET_VERSION);
+    put_le16(hdr + 6, ts->flags);
+    put_le16(hdr + 8, ts->tw);
+    put_le16(hdr + 10, ts->th);
+    put_le32(hdr + 12, ts->cols);
+    put_le32(hdr + 16, ts->rows);
+    put_le32(hdr + 20, ts->len);
+    put_le32(hdr + 24, TILESET_HEADER_SIZE);
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+        return TILESET_ERR_WRITE;
+    if (little_endian())
+        return fwrite(ts->map, sizeof(uint32_t), n, f) != n ? TILESET_ERR_WRITE : 0;
+    for (i = 0; i < n; i += len) {
+        len = n - i < WRITE_CHUNK / 4 ? n - i : WRITE_CHUNK / 4;
+        for (j = 0; j < len; j++)
+            put_le32(chunk + j*4, ts->map[i + j]);
+        if (fwrite(chunk, 4, len, f) != len)
+            return TILESET_ERR_WRITE;
+    }
+    return 0;
+}
+
+void tileset_free(TileSet *ts)
+{
+    free(ts->map);
+    free(ts->first);
+    free(ts->hash);
+    free(ts->slots);
+    ts->map = ts->first = ts->slots = NULL;
+    ts->hash = NULL;
+    ts->len = ts->cap = ts->nslots = ts->mapcap = 0;
+}
@@ -0,0 +1,85 @@
+/* *******************************************************************
+ *                          tileset.h
+ * Finds the distinct tiles of a tileset or sprite sheet, and a tilemap
+ * that rebuilds the image from them. The image is cut in tw x th tiles,
+ * left to right and top to bottom; its sides must be multiples of the
+ * tile's. Every tile is hashed and looked up in a hash table of the
+ * tiles found so far, and is only compared pixel by pixel with the ones
+ * that have the same hash, so a sheet of millions of tiles takes one
+ * pass. With TILESET_FLIPS, a tile that isn't there as it is is looked
+ * up again mirrored horizontally, vertically and both ways (hashing the
+ * pixels in the mirrored order), and maps to the tile it mirrors.
+ * Distinct tiles aren't copied: they're kept as the position of the
+ * first tile of the image that had them, so the image must be kept
+ * around until the atlas is made.
+ *
+ * The tilemap file is little-endian:
+ *
+ *   offset  size
+ *   0       4      magic, "TMAP"
+ *   4       2      version, 1
+ *   6       2      flags, TILESET_FLIPS if flipped tiles were looked for
+ *   8       2      tile width
+ *   10      2      tile height
+ *   12      4      number of tiles across, cols
+ *   16      4      number of tiles down, rows
+ *   20      4      number of distinct tiles
+ *   24      4      size of the header, 28: the entries start here
+ *   28      4n     an entry for each of the cols * rows tiles, row by
+ *                  row: the number of the tile in the atlas, left to
+ *                  right and top to bottom, or'ed with TILESET_HFLIP and
+ *                  TILESET_VFLIP if it must be drawn mirrored
+ *
+ * *******************************************************************/
+
+#ifndef TILESET_H_INCLUDED
+#define TILESET_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILESET_MAGIC "TMAP"
+#define TILESET_VERSION 1
+#define TILESET_HEADER_SIZE 28
+
+/* bits of a tilemap entry */
+#define TILESET_HFLIP (1u << 30)
+#define TILESET_VFLIP (1u << 31)
+#define TILESET_INDEX (TILESET_HFLIP - 1)
+
+/* flags */
+enum {
+    TILESET_FLIPS = 1 << 0,
+};
+
+typedef struct _tileset {
+    uint32_t tw, th;
+    uint32_t cols, rows;
+    unsigned flags;
+    uint32_t *map;          /* cols * rows entries */
+    uint32_t *first;        /* for each distinct tile, the first tile that had it */
+    uint64_t *hash;         /* and its hash */
+    size_t len, cap;        /* distinct tiles */
+    uint32_t *slots;        /* 1 + index in first, 0 if free */
+    size_t nslots, mapcap;
+} TileSet;
+
+enum {
+    TILESET_ERR_BADPARAM = 1,
+    TILESET_ERR_BADSIZE,
+    TILESET_ERR_NOMEM,
+    TILESET_ERR_WRITE,
+};
+
+#define TILESET_INIT { 0, 0, 0, 0, 0, NULL, NULL, NULL, 0, 0, NULL, 0, 0 }
+
+int     tileset_build(TileSet *ts, const unsigned char *data, uint32_t w, uint32_t h, int ch,
+                      size_t stride, uint32_t tw, uint32_t th, unsigned flags);
+void    tileset_atlas_size(const TileSet *ts, uint32_t acols, uint32_t *w, uint32_t *h);
+void    tileset_atlas(const TileSet *ts, const unsigned char *data, int ch, size_t stride,
+                      uint32_t acols, unsigned char *out);
+int     tileset_write_map(FILE *f, const TileSet *ts);
+void    tileset_free(TileSet *ts);
+
+#endif